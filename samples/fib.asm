@@ -0,0 +1,43 @@
+; 16 bit Fibonacci numbers to 0xA000 through the stack and the pair instructions
+    LXI SP,0F000H
+    LXI H,0
+    LXI D,1
+    LXI B,0A000H
+    MVI A,24
+LOOP: PUSH PSW
+    MOV A,L
+    STAX B
+    INX B
+    MOV A,H
+    STAX B
+    INX B
+    PUSH H
+    XTHL
+    POP H
+    DAD D
+    XCHG
+    SHLD 0B000H
+    LHLD 0B000H
+    POP PSW
+    DCR A
+    JNZ LOOP
+    CALL SUM
+    HLT
+; sum of the stored numbers in HL, carries counted in C
+SUM: LXI H,0
+    LXI D,0A000H
+    MVI B,24
+    MVI C,0
+SLP: LDAX D
+    ADD L
+    MOV L,A
+    INX D
+    LDAX D
+    ADC H
+    MOV H,A
+    JNC NC
+    INR C
+NC: INX D
+    DCR B
+    JNZ SLP
+    RET
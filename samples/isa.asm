@@ -0,0 +1,104 @@
+; instruction coverage: BCD, flags through PUSH PSW and every instruction group
+    MVI A,38H
+    ADI 45H
+    DAA
+    STA 3000H
+    MVI A,99H
+    ADI 01H
+    DAA
+    PUSH PSW
+    POP B
+    MOV A,C
+    STA 3000H
+    MVI A,10H
+    SUI 01H
+    PUSH PSW
+    POP B
+    MOV A,C
+    STA 3000H
+    STC
+    MVI A,05H
+    SBI 02H
+    PUSH PSW
+    POP B
+    MOV A,C
+    STA 3000H
+    LXI H,0FFFFH
+    LXI D,0002H
+    DAD D
+    MOV A,L
+    ACI 0
+    STA 3000H
+    MVI A,0F0H
+    CMA
+    STA 3000H
+    MVI A,80H
+    ORA A
+    JM L1
+    MVI A,0EEH
+    STA 3000H
+L1: JPO L2
+    MVI A,0EEH
+    STA 3000H
+L2: CP BAD
+    CPE BAD
+    CALL SUB1
+    STA 3000H
+    LXI H,0008H
+    MVI M,3EH
+    INX H
+    MVI M,77H
+    INX H
+    MVI M,0C9H
+    RST 1
+    STA 3000H
+    LXI H,L3
+    PCHL
+    MVI A,0EEH
+    STA 3000H
+L3: LXI H,1234H
+    PUSH H
+    LXI H,5678H
+    XTHL
+    MOV A,L
+    STA 3000H
+    POP H
+    MOV A,H
+    STA 3000H
+    LXI H,0F000H
+    SPHL
+    LXI H,0
+    DAD SP
+    MOV A,H
+    STA 3000H
+    MVI A,5AH
+    OUT 10H
+    MVI A,0
+    IN 10H
+    STA 3000H
+    EI
+    MVI A,0AH
+    SIM
+    RIM
+    STA 3000H
+    MVI B,0FH
+    INR B
+    PUSH PSW
+    POP D
+    MOV A,E
+    STA 3000H
+    MVI A,0FFH
+    ANI 0FH
+    PUSH PSW
+    POP D
+    MOV A,E
+    STA 3000H
+    HLT
+SUB1: MVI A,0AAH
+    RZ
+    RNZ
+    MVI A,0EEH
+    RET
+BAD: MVI A,0EEH
+    STA 3000H
+    RET
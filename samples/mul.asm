@@ -0,0 +1,18 @@
+; 12 * 34 by repeated addition
+    MVI D,12
+    MVI E,34
+    CALL MUL
+    HLT
+MUL: LXI H,0
+    MOV A,D
+    ORA A
+    RZ
+LP: MOV A,L
+    ADD E
+    MOV L,A
+    MOV A,H
+    ACI 0
+    MOV H,A
+    DCR D
+    JNZ LP
+    RET
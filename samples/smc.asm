@@ -0,0 +1,5 @@
+; code that patches its own immediate operand, run with -p smc
+    MVI A,5
+    STA PATCH+1
+PATCH: MVI B,0
+    HLT
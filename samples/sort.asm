@@ -0,0 +1,33 @@
+; bubble sort of 16 bytes, copied from the table to 0x9000 first
+    LXI H,TABLE
+    LXI D,9000H
+    MVI C,16
+COPY: MOV A,M
+    STAX D
+    INX H
+    INX D
+    DCR C
+    JNZ COPY
+PASS: MVI B,0
+    LXI H,9000H
+    MVI C,15
+CMPL: MOV A,M
+    INX H
+    CMP M
+    JC NEXT
+    JZ NEXT
+    MOV D,M
+    MOV M,A
+    DCX H
+    MOV M,D
+    INX H
+    MVI B,1
+NEXT: DCR C
+    JNZ CMPL
+    MOV A,B
+    ORA A
+    JNZ PASS
+    LDA 9000H
+    STA 3000H
+    HLT
+TABLE: DB 5AH,03H,0FFH,17H,80H,00H,42H,42H,99H,01H,7FH,0C3H,20H,11H,0EH,0D0H
@@ -0,0 +1,636 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "opcodes.h"
+#include "aot.h"
+
+/*
+ * 8085aot - compile a program ahead of time into a shared object that
+ * "8085vm -A" runs natively. Blocks reachable from the load address become
+ * straight-line C; anything else (unknown opcodes, computed targets, code
+ * outside the image) is left to the interpreter.
+ */
+
+#ifndef AOT_INCLUDE_DIR
+#define AOT_INCLUDE_DIR "src"
+#endif
+
+#define LOAD_ADDR 0x0800
+
+static uint8_t image[MEMORY_MAX];
+static uint32_t image_end;
+
+static uint8_t leader[MEMORY_MAX];      // a block starts here
+static uint8_t seen[MEMORY_MAX];        // instruction already decoded
+static uint16_t worklist[MEMORY_MAX];
+static int work_count = 0;
+
+static const char *reg_names[R_COUNT] =
+{
+    [R_B] = "c->regs[R_B]", [R_C] = "c->regs[R_C]", [R_D] = "c->regs[R_D]", [R_E] = "c->regs[R_E]",
+    [R_H] = "c->regs[R_H]", [R_L] = "c->regs[R_L]", [R_A] = "c->regs[R_A]"
+};
+
+#define HL "c->HL"
+
+// instruction classes the block builder cares about
+enum
+{
+    I_PLAIN = 0,
+    I_JMP,
+    I_CALL,
+    I_RET,
+    I_HLT
+};
+
+// PCHL (computed target), RST, I/O and interrupt state stay in the interpreter
+static int interpreted(uint8_t op)
+{
+    return op == 0xE9 || (op & 0xC7) == 0xC7 || op == 0xDB || op == 0xD3
+        || op == 0xFB || op == 0xF3 || op == 0x20 || op == 0x30;
+}
+
+// length of an instruction the compiler handles, 0 if it's left to the interpreter
+static int insn_len(uint8_t op)
+{
+    return name_table[op] != NULL && !interpreted(op) ? length_table[op] : 0;
+}
+
+// JMP, CALL and RET
+static int unconditional(uint8_t op)
+{
+    return op == 0xC3 || op == 0xCD || op == 0xC9;
+}
+
+static int insn_class(uint8_t op)
+{
+    if (op == 0x76)
+        return I_HLT;
+    if ((op & 0xC7) == 0xC2 || op == 0xC3)
+        return I_JMP;
+    if ((op & 0xC7) == 0xC4 || op == 0xCD)
+        return I_CALL;
+    if ((op & 0xC7) == 0xC0 || op == 0xC9)
+        return I_RET;
+
+    return I_PLAIN;
+}
+
+// condition of JMP/CALL/RET, matching cond_taken in opcodes.c
+static const char *cond_expr(uint8_t op)
+{
+    static const char *conds[] =
+    {
+        "!(c->flags & FL_Z)", "(c->flags & FL_Z)", "!(c->flags & FL_CY)", "(c->flags & FL_CY)",
+        "!(c->flags & FL_P)", "(c->flags & FL_P)", "!(c->flags & FL_S)", "(c->flags & FL_S)"
+    };
+
+    return unconditional(op) ? "1" : conds[(op >> 3) & 0x07];
+}
+
+static int in_image(uint32_t addr)
+{
+    return addr >= LOAD_ADDR && addr < image_end;
+}
+
+static void add_leader(uint32_t addr)
+{
+    if (!in_image(addr) || leader[addr])
+        return;
+
+    leader[addr] = 1;
+    worklist[work_count++] = addr;
+}
+
+// follow every path from the entry point to find where blocks start
+static void find_blocks(void)
+{
+    add_leader(LOAD_ADDR);
+
+    while (work_count > 0)
+    {
+        uint32_t pc = worklist[--work_count];
+
+        while (in_image(pc) && !seen[pc])
+        {
+            uint8_t op = image[pc];
+            int len = insn_len(op);
+            uint16_t target = image[(pc + 1) & 0xFFFF] | (image[(pc + 2) & 0xFFFF] << 8);
+
+            seen[pc] = 1;
+            if (len == 0 || pc + len > image_end)
+                break;
+
+            switch (insn_class(op))
+            {
+                case I_JMP:
+                    add_leader(target);
+                    if (unconditional(op))
+                        goto next_leader;
+                    add_leader(pc + len);
+                    break;
+
+                case I_CALL:
+                    add_leader(target);
+                    add_leader(pc + len);
+                    break;
+
+                case I_RET:
+                    if (unconditional(op))
+                        goto next_leader;
+                    add_leader(pc + len);
+                    break;
+
+                case I_HLT:
+                    goto next_leader;
+            }
+
+            pc += len;
+        }
+
+    next_leader:
+        ;
+    }
+}
+
+static const char *rp_get(int rp)
+{
+    static const char *names[] = { "c->BC", "c->DE", HL, "c->SP" };
+
+    return names[rp];
+}
+
+static void rp_set(FILE *out, int rp, const char *val)
+{
+    fprintf(out, "            %s = %s;\n", rp_get(rp), val);
+}
+
+// operand of the register/memory ALU forms
+static void src_expr(char *buf, size_t size, uint8_t src)
+{
+    if (src == R_MEM)
+        snprintf(buf, size, "aot_rd(c, h, %s)", HL);
+    else
+        snprintf(buf, size, "%s", reg_names[src]);
+}
+
+// C for one instruction, returns 1 if it ends the block
+static int emit_insn(FILE *out, uint16_t pc)
+{
+    uint8_t op = image[pc];
+    uint8_t b1 = image[(uint16_t)(pc + 1)];
+    uint16_t w = b1 | (image[(uint16_t)(pc + 2)] << 8);
+    uint16_t next = pc + insn_len(op);
+    uint8_t dst = REG_INDEX((op >> 3) & 0x07), src = REG_INDEX(op & 0x07);
+    int rp = (op >> 4) & 0x03;
+    char s[64], v[64];
+
+    fprintf(out, "            /* %04X */\n            c->cycles += %d;\n", pc, cycle_table[op]);
+
+    if (op >= 0x40 && op <= 0x7F && op != 0x76)
+    {
+        src_expr(s, sizeof(s), src);
+        if (dst == R_MEM)
+            fprintf(out, "            aot_wr(c, h, %s, %s);\n", HL, s);
+        else
+            fprintf(out, "            %s = %s;\n", reg_names[dst], s);
+        return 0;
+    }
+
+    if ((op & 0xC7) == 0x06)
+    {
+        if (dst == R_MEM)
+            fprintf(out, "            aot_wr(c, h, %s, 0x%02X);\n", HL, b1);
+        else
+            fprintf(out, "            %s = 0x%02X;\n", reg_names[dst], b1);
+        return 0;
+    }
+
+    if ((op & 0xC7) == 0x04 || (op & 0xC7) == 0x05)
+    {
+        const char *fn = (op & 0xC7) == 0x04 ? "aot_inr" : "aot_dcr";
+
+        if (dst == R_MEM)
+            fprintf(out, "            t = %s(c, aot_rd(c, h, %s));\n            aot_wr(c, h, %s, t);\n", fn, HL, HL);
+        else
+            fprintf(out, "            %s = %s(c, %s);\n", reg_names[dst], fn, reg_names[dst]);
+        return 0;
+    }
+
+    // register/memory and immediate ALU forms
+    if ((op >= 0x80 && op <= 0xBF) || (op >= 0xC0 && (op & 0x07) == 0x06))
+    {
+        if (op >= 0xC0)
+            snprintf(s, sizeof(s), "0x%02X", b1);
+        else
+            src_expr(s, sizeof(s), src);
+
+        switch (op >= 0xC0 ? (op & 0x38) | 0x80 : op & 0xF8)
+        {
+            case 0x80:
+                fprintf(out, "            c->regs[R_A] = aot_add(c, %s, 0);\n", s);
+                break;
+
+            case 0x88:
+                fprintf(out, "            c->regs[R_A] = aot_add(c, %s, c->flags & FL_CY);\n", s);
+                break;
+
+            case 0x90:
+                fprintf(out, "            c->regs[R_A] = aot_sub(c, %s, 0);\n", s);
+                break;
+
+            case 0x98:
+                fprintf(out, "            c->regs[R_A] = aot_sub(c, %s, c->flags & FL_CY);\n", s);
+                break;
+
+            case 0xA0:
+                fprintf(out, "            c->regs[R_A] &= %s;\n            aot_logic(c, c->regs[R_A], FL_AC);\n", s);
+                break;
+
+            case 0xA8:
+                fprintf(out, "            c->regs[R_A] ^= %s;\n            aot_logic(c, c->regs[R_A], 0);\n", s);
+                break;
+
+            case 0xB0:
+                fprintf(out, "            c->regs[R_A] |= %s;\n            aot_logic(c, c->regs[R_A], 0);\n", s);
+                break;
+
+            case 0xB8:
+                fprintf(out, "            aot_sub(c, %s, 0);\n", s);
+                break;
+        }
+
+        return 0;
+    }
+
+    switch (op)
+    {
+        case 0x00:
+            return 0;
+
+        case 0x76:
+            fprintf(out, "            c->running = 0;\n            c->PC = 0x%04X;\n            break;\n", next);
+            return 1;
+
+        case 0x22:
+            fprintf(out, "            aot_wr(c, h, 0x%04X, c->regs[R_L]);\n", w);
+            fprintf(out, "            aot_wr(c, h, 0x%04X, c->regs[R_H]);\n", (uint16_t)(w + 1));
+            return 0;
+
+        case 0x2A:
+            fprintf(out, "            c->regs[R_L] = aot_rd(c, h, 0x%04X);\n", w);
+            fprintf(out, "            c->regs[R_H] = aot_rd(c, h, 0x%04X);\n", (uint16_t)(w + 1));
+            return 0;
+
+        case 0x32:
+            fprintf(out, "            aot_wr(c, h, 0x%04X, c->regs[R_A]);\n", w);
+            return 0;
+
+        case 0x3A:
+            fprintf(out, "            c->regs[R_A] = aot_rd(c, h, 0x%04X);\n", w);
+            return 0;
+
+        case 0xEB:
+            fprintf(out, "            t = %s;\n", HL);
+            rp_set(out, RP_HL, rp_get(RP_DE));
+            rp_set(out, RP_DE, "t");
+            return 0;
+
+        case 0x07:
+            fprintf(out, "            t = c->regs[R_A] >> 7;\n            c->regs[R_A] = (c->regs[R_A] << 1) | t;\n");
+            fprintf(out, "            c->flags = (c->flags & ~FL_CY) | t;\n");
+            return 0;
+
+        case 0x0F:
+            fprintf(out, "            t = c->regs[R_A] & 1;\n            c->regs[R_A] = (c->regs[R_A] >> 1) | (t << 7);\n");
+            fprintf(out, "            c->flags = (c->flags & ~FL_CY) | t;\n");
+            return 0;
+
+        case 0x17:
+            fprintf(out, "            t = c->regs[R_A] >> 7;\n            c->regs[R_A] = (c->regs[R_A] << 1) | (c->flags & FL_CY);\n");
+            fprintf(out, "            c->flags = (c->flags & ~FL_CY) | t;\n");
+            return 0;
+
+        case 0x1F:
+            fprintf(out, "            t = c->regs[R_A] & 1;\n            c->regs[R_A] = (c->regs[R_A] >> 1) | ((c->flags & FL_CY) << 7);\n");
+            fprintf(out, "            c->flags = (c->flags & ~FL_CY) | t;\n");
+            return 0;
+
+        case 0x27:
+            fprintf(out, "            aot_daa(c);\n");
+            return 0;
+
+        case 0x2F:
+            fprintf(out, "            c->regs[R_A] = ~c->regs[R_A];\n");
+            return 0;
+
+        case 0x37:
+            fprintf(out, "            c->flags |= FL_CY;\n");
+            return 0;
+
+        case 0x3F:
+            fprintf(out, "            c->flags ^= FL_CY;\n");
+            return 0;
+
+        case 0xF9:
+            fprintf(out, "            c->SP = %s;\n", HL);
+            return 0;
+
+        case 0xE3:
+            fprintf(out, "            t = aot_rd(c, h, c->SP) | (aot_rd(c, h, (uint16_t)(c->SP + 1)) << 8);\n");
+            fprintf(out, "            aot_wr(c, h, c->SP, c->regs[R_L]);\n");
+            fprintf(out, "            aot_wr(c, h, (uint16_t)(c->SP + 1), c->regs[R_H]);\n");
+            rp_set(out, RP_HL, "t");
+            return 0;
+
+        // PUSH/POP PSW
+        case 0xF5:
+            fprintf(out, "            aot_wr(c, h, --c->SP, c->regs[R_A]);\n            aot_wr(c, h, --c->SP, c->flags);\n");
+            return 0;
+
+        case 0xF1:
+            fprintf(out, "            c->flags = aot_rd(c, h, c->SP);\n            c->regs[R_A] = aot_rd(c, h, (uint16_t)(c->SP + 1));\n");
+            fprintf(out, "            c->SP += 2;\n");
+            return 0;
+    }
+
+    switch (op & 0xCF)
+    {
+        case 0x01:
+            snprintf(v, sizeof(v), "0x%04X", w);
+            rp_set(out, rp, v);
+            return 0;
+
+        case 0x02:
+            fprintf(out, "            aot_wr(c, h, %s, c->regs[R_A]);\n", rp_get(rp));
+            return 0;
+
+        case 0x0A:
+            fprintf(out, "            c->regs[R_A] = aot_rd(c, h, %s);\n", rp_get(rp));
+            return 0;
+
+        case 0x09:
+            fprintf(out, "            d = %s + %s;\n", HL, rp_get(rp));
+            rp_set(out, RP_HL, "d & 0xFFFF");
+            fprintf(out, "            c->flags = (c->flags & ~FL_CY) | (d >> 16);\n");
+            return 0;
+
+        case 0x03:
+        case 0x0B:
+            snprintf(v, sizeof(v), "(uint16_t)(t %s 1)", (op & 0xCF) == 0x03 ? "+" : "-");
+            fprintf(out, "            t = %s;\n", rp_get(rp));
+            rp_set(out, rp, v);
+            return 0;
+
+        case 0xC5:
+            fprintf(out, "            t = %s;\n", rp_get(rp));
+            fprintf(out, "            aot_wr(c, h, --c->SP, t >> 8);\n            aot_wr(c, h, --c->SP, t & 0xFF);\n");
+            return 0;
+
+        case 0xC1:
+            fprintf(out, "            t = aot_rd(c, h, c->SP) | (aot_rd(c, h, (uint16_t)(c->SP + 1)) << 8);\n");
+            fprintf(out, "            c->SP += 2;\n");
+            rp_set(out, rp, "t");
+            return 0;
+    }
+
+    switch (insn_class(op))
+    {
+        case I_JMP:
+            fprintf(out, "            if (%s)\n            {\n", cond_expr(op));
+            if (!unconditional(op))
+                fprintf(out, "                c->cycles += 3;\n");
+            fprintf(out, "                c->PC = 0x%04X;\n                break;\n", w);
+            fprintf(out, "            }\n");
+            break;
+
+        case I_CALL:
+            fprintf(out, "            if (%s)\n            {\n", cond_expr(op));
+            if (!unconditional(op))
+                fprintf(out, "                c->cycles += 9;\n");
+            fprintf(out, "                c->PC = 0x%04X;\n", next);
+            fprintf(out, "                if (h->hle_index[0x%04X] && h->hle_call(0x%04X))\n                    break;\n", w, w);
+            fprintf(out, "                aot_wr(c, h, --c->SP, 0x%02X);\n", next >> 8);
+            fprintf(out, "                aot_wr(c, h, --c->SP, 0x%02X);\n", next & 0xFF);
+            fprintf(out, "                c->PC = 0x%04X;\n                break;\n            }\n", w);
+            break;
+
+        case I_RET:
+            fprintf(out, "            if (%s)\n            {\n", cond_expr(op));
+            fprintf(out, "                t = aot_rd(c, h, c->SP) | (aot_rd(c, h, (uint16_t)(c->SP + 1)) << 8);\n");
+            fprintf(out, "                c->SP += 2;\n");
+            if (!unconditional(op))
+                fprintf(out, "                c->cycles += 6;\n");
+            fprintf(out, "                c->PC = t;\n                break;\n            }\n");
+            break;
+    }
+
+    if (unconditional(op))
+        return 1;
+
+    fprintf(out, "            c->PC = 0x%04X;\n            break;\n", next);
+    return 1;
+}
+
+// 1 if the instruction can write guest memory
+static int stores(uint8_t op)
+{
+    return (op >= 0x70 && op <= 0x77 && op != 0x76) || op == 0x36 || op == 0x34 || op == 0x35
+        || op == 0x22 || op == 0x32 || (op & 0xEF) == 0x02 || (op & 0xCF) == 0xC5 || op == 0xE3;
+}
+
+static void emit_block(FILE *out, uint16_t start)
+{
+    uint32_t pc = start;
+
+    fprintf(out, "        case 0x%04X: b_%04X:\n", start, start);
+
+    for (;;)
+    {
+        uint8_t op = image[pc];
+        int len = insn_len(op);
+
+        // unknown opcode or past the image, the interpreter takes it from here
+        if (len == 0 || pc + len > image_end)
+        {
+            fprintf(out, "            c->PC = 0x%04X;\n            break;\n", pc);
+            return;
+        }
+
+        if (emit_insn(out, pc))
+            return;
+
+        pc += len;
+        if (leader[pc] || !in_image(pc))
+        {
+            fprintf(out, "            c->PC = 0x%04X;\n            break;\n", pc);
+            return;
+        }
+
+        // leave the block as soon as the code ahead of it was modified
+        if (stores(op) || (pc >> MEM_PAGE_SHIFT) != ((pc - len) >> MEM_PAGE_SHIFT))
+        {
+            fprintf(out, "            if (h->code_dirty[0x%02X])\n            {\n", pc >> MEM_PAGE_SHIFT);
+            fprintf(out, "                c->PC = 0x%04X;\n                break;\n            }\n", pc);
+        }
+    }
+}
+
+static void emit(FILE *out)
+{
+    int blocks = 0;
+
+    fprintf(out, "/* generated by 8085aot, do not edit */\n#include \"aot_rt.h\"\n\n");
+    fprintf(out, "const uint32_t aot_version = %d;\n", AOT_ABI_VERSION);
+    fprintf(out, "const uint32_t aot_cpu_size = sizeof(struct cpu);\n");
+    fprintf(out, "const uint16_t aot_image_start = 0x%04X;\n", LOAD_ADDR);
+    fprintf(out, "const uint32_t aot_image_len = %u;\n\n", image_end - LOAD_ADDR);
+
+    fprintf(out, "const uint8_t aot_image[] =\n{");
+    for (uint32_t i = LOAD_ADDR; i < image_end; ++i)
+        fprintf(out, "%s0x%02X,", (i - LOAD_ADDR) % 12 == 0 ? "\n    " : " ", image[i]);
+    fprintf(out, "\n};\n\nconst uint16_t aot_blocks[] =\n{");
+
+    for (uint32_t i = LOAD_ADDR; i < image_end; ++i)
+    {
+        if (leader[i] && insn_len(image[i]))
+            fprintf(out, "%s0x%04X,", blocks++ % 8 == 0 ? "\n    " : " ", i);
+    }
+
+    fprintf(out, "\n};\n\nconst uint32_t aot_block_count = %d;\n", blocks);
+    fprintf(out, "const void *aot_block_code[%d];\n\n", blocks ? blocks : 1);
+
+    fprintf(out, "void aot_entry(struct cpu *c, uint64_t limit, const struct aot_host *h)\n{\n");
+    fprintf(out, "    static const void *const code[] =\n    {");
+    blocks = 0;
+    for (uint32_t i = LOAD_ADDR; i < image_end; ++i)
+        if (leader[i] && insn_len(image[i]))
+            fprintf(out, "%s&&b_%04X,", blocks++ % 6 == 0 ? "\n        " : " ", i);
+    fprintf(out, "%s\n    };\n", blocks ? "" : "\n        0");
+    fprintf(out, "    uint16_t t;\n    uint32_t d;\n\n");
+    fprintf(out, "    // no CPU: fill in where the blocks start, for profilers\n");
+    fprintf(out, "    if (c == NULL)\n    {\n        memcpy(aot_block_code, code, sizeof(code));\n        return;\n    }\n\n");
+    fprintf(out, "    while (c->running && c->cycles < limit && !h->code_dirty[c->PC >> MEM_PAGE_SHIFT])\n    {\n");
+    fprintf(out, "        switch (c->PC)\n        {\n");
+
+    for (uint32_t i = LOAD_ADDR; i < image_end; ++i)
+        if (leader[i] && insn_len(image[i]))
+            emit_block(out, i);
+
+    fprintf(out, "        default:\n            return;\n        }\n    }\n}\n");
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-o output.so] [-c output.c] [-n] <program>\n", name);
+    fprintf(stderr, "  -o <file>   shared object to build (default: program name with .so)\n");
+    fprintf(stderr, "  -c <file>   keep the generated C in file\n");
+    fprintf(stderr, "  -n          only generate C, don't compile it\n");
+}
+
+int main(int argc, char **argv)
+{
+    char *so_path = NULL, *c_path = NULL;
+    char tmp_path[] = "/tmp/8085aot-XXXXXX.c";
+    char cmd[4096];
+    int opt, compile = 1, keep_c = 0;
+    const char *cc = getenv("CC") ? getenv("CC") : "cc";
+    FILE *f, *out;
+    size_t n;
+
+    while ((opt = getopt(argc, argv, "o:c:n")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                so_path = optarg;
+                break;
+
+            case 'c':
+                c_path = optarg;
+                keep_c = 1;
+                break;
+
+            case 'n':
+                compile = 0;
+                break;
+
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind >= argc || (!compile && c_path == NULL))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open program\n");
+        exit(1);
+    }
+
+    n = fread(&image[LOAD_ADDR], 1, STACK_SEGMENT_START - LOAD_ADDR, f);
+    fclose(f);
+    image_end = LOAD_ADDR + n;
+
+    find_blocks();
+
+    if (c_path == NULL)
+    {
+        int fd = mkstemps(tmp_path, 2);
+        if (fd < 0)
+        {
+            perror("mkstemps");
+            exit(1);
+        }
+        close(fd);
+        c_path = tmp_path;
+    }
+
+    out = fopen(c_path, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Error: cannot create %s\n", c_path);
+        exit(1);
+    }
+
+    emit(out);
+    fclose(out);
+
+    if (!compile)
+        return 0;
+
+    if (so_path == NULL)
+    {
+        static char buf[4096];
+        char *dot;
+
+        snprintf(buf, sizeof(buf) - 3, "%s", argv[optind]);
+        dot = strrchr(buf, '.');
+        if (dot != NULL && strchr(dot, '/') == NULL)
+            *dot = '\0';
+        strcat(buf, ".so");
+        so_path = buf;
+    }
+
+    snprintf(cmd, sizeof(cmd), "%s -O2 -shared -fPIC -I\"%s\" -o \"%s\" \"%s\"", cc, AOT_INCLUDE_DIR, so_path, c_path);
+    if (system(cmd) != 0)
+    {
+        fprintf(stderr, "Error: compiling %s failed\n", c_path);
+        exit(1);
+    }
+
+    if (!keep_c)
+        unlink(c_path);
+
+    return 0;
+}
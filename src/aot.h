@@ -0,0 +1,44 @@
+#ifndef AOT_H_
+#define AOT_H_
+
+#include <stdint.h>
+#include "cpu.h"
+
+/*
+ * interface between the emulator and the shared objects built by 8085aot.
+ * The generated code works on the emulator's struct cpu, so both sides have
+ * to be built from the same cpu.h.
+ */
+
+#define AOT_ABI_VERSION 4
+
+// emulator services the generated code calls back into
+struct aot_host
+{
+    uint8_t (*read_slow)(uint16_t addr);
+    void (*write_slow)(uint16_t addr, uint8_t val);
+    const uint8_t *hle_index;
+    int (*hle_call)(uint16_t target);
+    const uint8_t *code_dirty;      // pages whose code no longer matches the image
+};
+
+/*
+ * run compiled blocks starting at c->PC until the cycle limit, a stop, or a
+ * PC with no compiled block (or a modified page) is reached. Limit and stop
+ * are only checked between blocks. Called with c NULL, it only fills in
+ * AOT_SYM_BLOCK_CODE.
+ */
+typedef void (*AotEntryFunc) (struct cpu *c, uint64_t limit, const struct aot_host *h);
+
+// symbols every generated object exports
+#define AOT_SYM_VERSION "aot_version"
+#define AOT_SYM_CPU_SIZE "aot_cpu_size"
+#define AOT_SYM_ENTRY "aot_entry"
+#define AOT_SYM_BLOCKS "aot_blocks"
+#define AOT_SYM_BLOCK_COUNT "aot_block_count"
+#define AOT_SYM_BLOCK_CODE "aot_block_code"     // host address of each block, in aot_blocks order
+#define AOT_SYM_IMAGE "aot_image"
+#define AOT_SYM_IMAGE_START "aot_image_start"
+#define AOT_SYM_IMAGE_LEN "aot_image_len"
+
+#endif /* AOT_H_ */
@@ -0,0 +1,97 @@
+#ifndef AOT_RT_H_
+#define AOT_RT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "cpu.h"
+#include "aot.h"
+
+// helpers for the C files generated by 8085aot, same semantics as opcodes.c
+
+#define AOT_FLAGS (FL_CY | FL_P | FL_AC | FL_Z | FL_S)
+
+static inline uint8_t aot_rd(struct cpu *c, const struct aot_host *h, uint16_t addr)
+{
+    uint8_t *p = c->mem_rmap[addr >> MEM_PAGE_SHIFT];
+
+    return p != NULL ? p[addr & MEM_PAGE_MASK] : h->read_slow(addr);
+}
+
+static inline void aot_wr(struct cpu *c, const struct aot_host *h, uint16_t addr, uint8_t val)
+{
+    uint8_t *p = c->mem_wmap[addr >> MEM_PAGE_SHIFT];
+
+    if (p != NULL)
+        p[addr & MEM_PAGE_MASK] = val;
+    else
+        h->write_slow(addr, val);
+}
+
+// S, Z and P of an 8-bit result
+static inline uint8_t aot_szp(uint8_t res)
+{
+    return (res & FL_S) | (res == 0 ? FL_Z : 0) | (__builtin_parity(res) ? 0 : FL_P);
+}
+
+static inline uint8_t aot_add(struct cpu *c, uint8_t data, uint8_t carry)
+{
+    uint16_t res = c->regs[R_A] + data + carry;
+
+    c->flags = (c->flags & ~AOT_FLAGS) | ((res >> 8) & FL_CY) | ((c->regs[R_A] ^ data ^ res) & FL_AC)
+        | aot_szp(res);
+    return res;
+}
+
+static inline uint8_t aot_sub(struct cpu *c, uint8_t data, uint8_t borrow)
+{
+    uint16_t res = (uint16_t)(c->regs[R_A] - data - borrow);
+
+    c->flags = (c->flags & ~AOT_FLAGS) | ((res >> 8) & FL_CY) | (((c->regs[R_A] ^ data ^ res) & FL_AC) ^ FL_AC)
+        | aot_szp(res);
+    return res;
+}
+
+// INR and DCR leave CY alone
+static inline uint8_t aot_inr(struct cpu *c, uint8_t val)
+{
+    uint8_t res = val + 1;
+
+    c->flags = (c->flags & (~AOT_FLAGS | FL_CY)) | ((res & 0x0F) == 0 ? FL_AC : 0) | aot_szp(res);
+    return res;
+}
+
+static inline uint8_t aot_dcr(struct cpu *c, uint8_t val)
+{
+    uint8_t res = val - 1;
+
+    c->flags = (c->flags & (~AOT_FLAGS | FL_CY)) | ((res & 0x0F) != 0x0F ? FL_AC : 0) | aot_szp(res);
+    return res;
+}
+
+// AND, OR and XOR clear CY, AND sets AC
+static inline void aot_logic(struct cpu *c, uint8_t res, uint8_t ac)
+{
+    c->flags = (c->flags & ~AOT_FLAGS) | ac | aot_szp(res);
+}
+
+static inline void aot_daa(struct cpu *c)
+{
+    uint8_t a = c->regs[R_A];
+    uint8_t fix = 0, cy = c->flags & FL_CY;
+    uint8_t res;
+
+    if ((a & 0x0F) > 9 || (c->flags & FL_AC))
+        fix |= 0x06;
+    if (a > 0x99 || cy)
+    {
+        fix |= 0x60;
+        cy = FL_CY;
+    }
+
+    res = a + fix;
+    c->regs[R_A] = res;
+    c->flags = (c->flags & ~AOT_FLAGS) | cy | ((a ^ fix ^ res) & FL_AC) | aot_szp(res);
+}
+
+#endif /* AOT_RT_H_ */
@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cpu.h"
+#include "mem.h"
+#include "opcodes.h"
+
+/*
+ * microbenchmarks of the interpreter, built by make bench:
+ * - every opcode handler called on its own, from a random register state
+ *   out of a table made with a fixed seed
+ * - the dispatch of the run loop over a program that runs one handler all
+ *   the time and over one that runs register instructions in random order,
+ *   and the same random instructions called from a host array
+ * Cycles, instructions, branch misses and L1 data cache misses come from
+ * perf_event_open when the kernel lets us, time from CLOCK_MONOTONIC. All
+ * numbers are per instruction, handler numbers without the cost of the
+ * empty benchmark loop, so tables of two builds can be compared line by line.
+ */
+
+#define BENCH_DEFAULT_ITERS 1000000
+#define BENCH_STATES 4096               // random register states, a power of two
+#define BENCH_SEED 0x8085
+#define BENCH_OPERANDS 0x0900           // PC of the handler runs, operand bytes follow
+#define BENCH_SP 0xF000
+#define BENCH_PROGRAM_LEN 0x1000        // instructions of the dispatch programs
+#define BENCH_REPEATS 3                 // runs of each benchmark, the fastest one counts
+
+// counters, in table order
+enum
+{
+    CNT_CYCLES = 0,
+    CNT_INSTRUCTIONS,
+    CNT_BRANCH_MISSES,
+    CNT_L1D_MISSES,
+    CNT_COUNT
+};
+
+struct bench_state
+{
+    uint8_t regs[R_COUNT];
+    uint8_t flags;
+};
+
+struct bench_result
+{
+    double ns;
+    double count[CNT_COUNT];
+};
+
+// defined in main.c, which isn't linked into the benchmark
+int step_sec = 0;
+
+static const char *const counter_names[CNT_COUNT] = { "cycles", "instr", "br-miss", "L1d-miss" };
+
+static int counter_fd[CNT_COUNT];
+static struct bench_state states[BENCH_STATES];
+static uint8_t program_ops[BENCH_PROGRAM_LEN];
+static uint64_t rng = BENCH_SEED;
+static int csv = 0;
+
+static uint32_t next_random(void)
+{
+    // xorshift64*, the same sequence on every build
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (rng * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static void open_counters(void)
+{
+    static const struct { uint32_t type; uint64_t config; } events[CNT_COUNT] =
+    {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8
+            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 }
+    };
+
+    for (int i = 0; i < CNT_COUNT; ++i)
+    {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // a counter the CPU or the kernel doesn't give us is left out
+        counter_fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void start_counters(void)
+{
+    for (int i = 0; i < CNT_COUNT; ++i)
+    {
+        if (counter_fd[i] >= 0)
+        {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void stop_counters(struct bench_result *r, uint64_t n)
+{
+    for (int i = 0; i < CNT_COUNT; ++i)
+    {
+        uint64_t v = 0;
+
+        if (counter_fd[i] >= 0)
+        {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counter_fd[i], &v, sizeof(v)) != sizeof(v))
+                v = 0;
+        }
+
+        r->count[i] = (double)v / n;
+    }
+}
+
+static void load_state(uint64_t i)
+{
+    const struct bench_state *s = &states[i & (BENCH_STATES - 1)];
+
+    memcpy(cpu->regs, s->regs, R_COUNT);
+    cpu->flags = s->flags;
+    cpu->PC = BENCH_OPERANDS;
+    cpu->SP = BENCH_SP;
+    cpu->running = 1;
+}
+
+static void no_handler(void)
+{
+}
+
+// iters calls of handler, each from the next register state
+static void bench_handler(InstrFunc handler, uint64_t iters, struct bench_result *best)
+{
+    InstrFunc volatile f = handler;
+
+    for (int n = 0; n < BENCH_REPEATS; ++n)
+    {
+        struct bench_result r;
+        uint64_t start;
+
+        start_counters();
+        start = now_ns();
+
+        for (uint64_t i = 0; i < iters; ++i)
+        {
+            load_state(i);
+            f();
+        }
+
+        r.ns = (double)(now_ns() - start) / iters;
+        stop_counters(&r, iters);
+
+        if (n == 0 || r.ns < best->ns)
+            *best = r;
+    }
+}
+
+// the run loop over the program at 0x0800 until about iters instructions ran
+static void bench_run(uint64_t iters, struct bench_result *r)
+{
+    uint64_t ops = 0, start;
+
+    load_state(0);
+    cpu->PC = 0x0800;
+    cpu->cycles = 0;
+    memset(cpu->stats.ops, 0, sizeof(cpu->stats.ops));
+
+    start_counters();
+    start = now_ns();
+
+    while (ops < iters)
+    {
+        cpu_run(iters * 4);
+        ops = 0;
+        for (int i = 0; i < 256; ++i)
+            ops += cpu->stats.ops[i];
+    }
+
+    r->ns = (double)(now_ns() - start) / ops;
+    stop_counters(r, ops);
+}
+
+// the random program's instructions called from a host array, without fetching them
+static void bench_array(uint64_t iters, struct bench_result *r)
+{
+    uint64_t start;
+
+    load_state(0);
+    start_counters();
+    start = now_ns();
+
+    for (uint64_t i = 0; i < iters; ++i)
+        opcode_table[program_ops[i & (BENCH_PROGRAM_LEN - 1)]]();
+
+    r->ns = (double)(now_ns() - start) / iters;
+    stop_counters(r, iters);
+}
+
+static void print_header(void)
+{
+    if (csv)
+    {
+        printf("opcode,name,ns");
+        for (int i = 0; i < CNT_COUNT; ++i)
+            printf(",%s", counter_names[i]);
+        printf("\n");
+        return;
+    }
+
+    printf("%-8s %-12s %8s", "opcode", "name", "ns");
+    for (int i = 0; i < CNT_COUNT; ++i)
+        printf(" %9s", counter_names[i]);
+    printf("\n");
+}
+
+// base is subtracted, counters that aren't available are shown as -
+static void print_row(const char *code, const char *name, const struct bench_result *r, const struct bench_result *base)
+{
+    if (csv)
+        printf("%s,\"%s\",%.3f", code, name, r->ns - base->ns);
+    else
+        printf("%-8s %-12s %8.2f", code, name, r->ns - base->ns);
+
+    for (int i = 0; i < CNT_COUNT; ++i)
+    {
+        if (counter_fd[i] < 0)
+            printf(csv ? ",-" : " %9s", "-");
+        else
+            printf(csv ? ",%.3f" : " %9.2f", r->count[i] - base->count[i]);
+    }
+
+    printf("\n");
+}
+
+// MOV, MVI, ALU, INR/DCR, rotates and flag instructions that don't touch memory
+static int register_only(uint8_t op)
+{
+    if (name_table[op] == NULL || length_table[op] != 1)
+        return 0;
+
+    if (op >= 0x40 && op <= 0xBF)
+        return (op & 7) != 6 && !(op < 0x80 && (op & 0x38) == 0x30);
+
+    return class_table[op] != ISA_CONTROL && class_table[op] != ISA_BRANCH && class_table[op] != ISA_TRANSFER
+        && op != 0x34 && op != 0x35;
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-c]\n", name);
+    fprintf(stderr, "  -n <n>      iterations per opcode and dispatch run (default %d)\n", BENCH_DEFAULT_ITERS);
+    fprintf(stderr, "  -c          print CSV\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_result base, r;
+    uint64_t iters = BENCH_DEFAULT_ITERS;
+    uint8_t operands[3] = { 0x55, 0x90, 0x00 };      // immediate operands, or address 0x9055
+    uint8_t regular[256];
+    int opt, nregular = 0;
+    char code[8];
+
+    while ((opt = getopt(argc, argv, "n:c")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                iters = strtoull(optarg, NULL, 0);
+                if (iters == 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+
+            case 'c':
+                csv = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (mem_init() < 0)
+        exit(1);
+    mem_load(BENCH_OPERANDS, operands, sizeof(operands));
+    open_counters();
+
+    // H stays in plain memory above the code, so M is never a device or the stack
+    for (int i = 0; i < BENCH_STATES; ++i)
+    {
+        for (int j = 0; j < R_COUNT; ++j)
+            states[i].regs[j] = next_random();
+        states[i].regs[R_H] = 0x40 + next_random() % 0x90;
+        states[i].flags = (next_random() & (FL_S | FL_Z | FL_AC | FL_P | FL_CY)) | 0x02;
+    }
+
+    if (!csv)
+    {
+        printf("# %llu iterations, per instruction, handlers without the empty loop", (unsigned long long)iters);
+        printf("%s\n", counter_fd[CNT_CYCLES] < 0 ? ", no hardware counters" : "");
+    }
+    print_header();
+
+    bench_handler(&no_handler, iters, &base);
+
+    for (int op = 0; op < 256; ++op)
+    {
+        if (name_table[op] == NULL)
+            continue;
+
+        if (register_only(op))
+            regular[nregular++] = op;
+
+        bench_handler(opcode_table[op], iters, &r);
+        snprintf(code, sizeof(code), "0x%02X", op);
+        print_row(code, name_table[op], &r, &base);
+    }
+
+    memset(&base, 0, sizeof(base));
+
+    // one handler all the time: NOPs and a jump back
+    for (int i = 0; i < BENCH_PROGRAM_LEN; ++i)
+        program_ops[i] = 0x00;
+    mem_load(0x0800, program_ops, BENCH_PROGRAM_LEN);
+    mem_load(0x0800 + BENCH_PROGRAM_LEN, (const uint8_t []) { 0xC3, 0x00, 0x08 }, 3);
+    bench_run(iters, &r);
+    print_row("loop", "same", &r, &base);
+
+    // register instructions in random order
+    for (int i = 0; i < BENCH_PROGRAM_LEN; ++i)
+        program_ops[i] = regular[next_random() % nregular];
+    mem_load(0x0800, program_ops, BENCH_PROGRAM_LEN);
+    bench_run(iters, &r);
+    print_row("loop", "random", &r, &base);
+
+    bench_array(iters, &r);
+    print_row("array", "random", &r, &base);
+
+    return 0;
+}
@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "opcodes.h"
+#include "timer.h"
+
+/*
+ * result cache of the daemon, one file mapped by every worker:
+ *   header | index of CACHE_PROBE-way slots | data ring
+ * Entries (key, reply, output bytes) are appended to the ring, overwriting
+ * the oldest ones. A hit on an entry that's about to be overwritten moves
+ * it to the head again, which keeps the ring close to LRU. Index and data
+ * are only touched under a process-shared mutex in the header, so a lookup
+ * costs no system call unless another worker holds it.
+ */
+
+#define CACHE_HEADER_SIZE 4096
+
+struct cache_header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t data_size;
+    uint32_t slots;
+    uint32_t reserved;
+    uint64_t head;                  // logical offset of the next entry
+    pthread_mutex_t lock;
+};
+
+struct cache_slot
+{
+    uint8_t key[32];
+    uint64_t offset;                // logical offset of the entry in the ring
+    uint32_t len;                   // 0 for a free slot
+    uint32_t reserved;
+};
+
+struct cache_entry
+{
+    uint8_t key[32];
+    struct proto_reply rep;         // followed by rep.output_len output bytes
+};
+
+struct sha256
+{
+    uint32_t h[8];
+    uint8_t buf[64];
+    uint32_t used;
+    uint64_t total;
+};
+
+int cache_enabled = 0;
+
+static struct cache_header *hdr;
+static struct cache_slot *slots;
+static uint8_t *data;
+static uint8_t engine[32];          // hash of the binary and everything else that changes results
+
+/* SHA-256 */
+
+static const uint32_t sha_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha_block(struct sha256 *s, const uint8_t *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h;
+
+    for (int i = 0; i < 16; ++i)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+    e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
+
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+        uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+    s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void sha_init(struct sha256 *s)
+{
+    static const uint32_t iv[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(s->h, iv, sizeof(iv));
+    s->used = 0;
+    s->total = 0;
+}
+
+static void sha_update(struct sha256 *s, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    s->total += len;
+
+    while (len > 0)
+    {
+        size_t n = 64 - s->used < len ? 64 - s->used : len;
+
+        // whole blocks straight from the input
+        if (s->used == 0 && len >= 64)
+        {
+            sha_block(s, p);
+            p += 64;
+            len -= 64;
+            continue;
+        }
+
+        memcpy(s->buf + s->used, p, n);
+        s->used += n;
+        p += n;
+        len -= n;
+
+        if (s->used == 64)
+        {
+            sha_block(s, s->buf);
+            s->used = 0;
+        }
+    }
+}
+
+static void sha_final(struct sha256 *s, uint8_t out[32])
+{
+    uint64_t bits = s->total * 8;
+    uint8_t pad = 0x80, zero = 0, len[8];
+
+    sha_update(s, &pad, 1);
+    while (s->used != 56)
+        sha_update(s, &zero, 1);
+
+    for (int i = 0; i < 8; ++i)
+        len[i] = bits >> (56 - 8 * i);
+    sha_update(s, len, 8);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        out[4 * i] = s->h[i] >> 24;
+        out[4 * i + 1] = s->h[i] >> 16;
+        out[4 * i + 2] = s->h[i] >> 8;
+        out[4 * i + 3] = s->h[i];
+    }
+}
+
+static int sha_file(struct sha256 *s, const char *path)
+{
+    uint8_t buf[65536];
+    size_t n;
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        sha_update(s, buf, n);
+
+    fclose(f);
+    return 0;
+}
+
+/* the cache file */
+
+static void lock(void)
+{
+    // a worker died holding it, whatever it left half written fails the key checks
+    if (pthread_mutex_lock(&hdr->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&hdr->lock);
+}
+
+static void unlock(void)
+{
+    pthread_mutex_unlock(&hdr->lock);
+}
+
+// not overwritten by the entries appended after it
+static int valid(const struct cache_slot *s)
+{
+    return s->len != 0 && hdr->head <= s->offset + hdr->data_size;
+}
+
+static struct cache_slot *probe(const uint8_t key[32], int i)
+{
+    uint32_t idx;
+
+    memcpy(&idx, key, sizeof(idx));
+    return &slots[(idx + i) & (hdr->slots - 1)];
+}
+
+// append an entry to the ring, entries never wrap around its end
+static void append(struct cache_slot *s, const uint8_t key[32], const struct proto_reply *rep, const uint8_t *output)
+{
+    uint32_t len = sizeof(struct cache_entry) + rep->output_len;
+    uint64_t pos = hdr->head % hdr->data_size;
+    struct cache_entry *e;
+
+    if (pos + len > hdr->data_size)
+        hdr->head += hdr->data_size - pos;
+
+    e = (struct cache_entry *)(data + hdr->head % hdr->data_size);
+    memcpy(e->key, key, 32);
+    e->rep = *rep;
+    memcpy(e + 1, output, rep->output_len);
+
+    s->len = 0;
+    memcpy(s->key, key, 32);
+    s->offset = hdr->head;
+    s->len = len;
+    hdr->head += len;
+}
+
+/*
+ * map the cache file at path, size_mb of entries, creating or resizing it
+ * as needed. Keys include a hash of this binary and of the hook and native
+ * files, so results of another build or setup never match. Called once
+ * before the workers are forked, one daemon per file.
+ */
+int cache_open(const char *path, uint32_t size_mb, const char *hook_path, const char *native_path)
+{
+    pthread_mutexattr_t attr;
+    struct sha256 s;
+    uint64_t data_size = (uint64_t)size_mb << 20, slot_count = 64, slots_size, total;
+    uint8_t policy = undef_policy | timer_enabled << 4;
+    uint8_t *base;
+    int fd;
+
+    if (size_mb == 0)
+    {
+        fprintf(stderr, "Error: cache size must be at least 1 MB\n");
+        return -1;
+    }
+
+    sha_init(&s);
+    if (sha_file(&s, "/proc/self/exe") < 0 || (hook_path != NULL && sha_file(&s, hook_path) < 0)
+        || (native_path != NULL && sha_file(&s, native_path) < 0))
+        return -1;
+    sha_update(&s, &policy, 1);
+    sha_final(&s, engine);
+
+    while (slot_count < data_size / CACHE_SLOT_BYTES)
+        slot_count <<= 1;
+    slots_size = (slot_count * sizeof(struct cache_slot) + CACHE_HEADER_SIZE - 1) / CACHE_HEADER_SIZE * CACHE_HEADER_SIZE;
+    total = CACHE_HEADER_SIZE + slots_size + data_size;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, total) < 0)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+
+    base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    hdr = (struct cache_header *)base;
+    slots = (struct cache_slot *)(base + CACHE_HEADER_SIZE);
+    data = base + CACHE_HEADER_SIZE + slots_size;
+
+    // a cache of another version or size starts over
+    if (memcmp(hdr->magic, CACHE_MAGIC, 4) != 0 || hdr->version != CACHE_VERSION
+        || hdr->data_size != data_size || hdr->slots != slot_count)
+    {
+        memset(base, 0, CACHE_HEADER_SIZE + slots_size);
+        memcpy(hdr->magic, CACHE_MAGIC, 4);
+        hdr->version = CACHE_VERSION;
+        hdr->data_size = data_size;
+        hdr->slots = slot_count;
+    }
+
+    // whoever held the lock before this daemon started is gone
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&hdr->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    cache_enabled = 1;
+    return 0;
+}
+
+// SHA-256 of the engine, the program, the input and the limits of a job
+void cache_key(uint8_t key[32], const uint8_t *program, uint32_t program_len, const uint8_t *input,
+    uint32_t input_len, uint64_t max_cycles, uint32_t max_output)
+{
+    struct sha256 s;
+
+    sha_init(&s);
+    sha_update(&s, engine, 32);
+    sha_update(&s, &program_len, sizeof(program_len));
+    sha_update(&s, program, program_len);
+    sha_update(&s, &input_len, sizeof(input_len));
+    sha_update(&s, input, input_len);
+    sha_update(&s, &max_cycles, sizeof(max_cycles));
+    sha_update(&s, &max_output, sizeof(max_output));
+    sha_final(&s, key);
+}
+
+// 1 and the stored reply and output for key, 0 if it isn't cached
+int cache_lookup(const uint8_t key[32], struct proto_reply *rep, uint8_t *output)
+{
+    lock();
+
+    for (int i = 0; i < CACHE_PROBE; ++i)
+    {
+        struct cache_slot *s = probe(key, i);
+        struct cache_entry *e;
+
+        if (!valid(s) || memcmp(s->key, key, 32) != 0)
+            continue;
+
+        e = (struct cache_entry *)(data + s->offset % hdr->data_size);
+        if (memcmp(e->key, key, 32) != 0 || s->len != sizeof(*e) + e->rep.output_len)
+            continue;
+
+        *rep = e->rep;
+        memcpy(output, e + 1, rep->output_len);
+
+        // in the oldest quarter of the ring, keep it around a little longer
+        if (hdr->head - s->offset > hdr->data_size / 4 * 3)
+            append(s, key, rep, output);
+
+        unlock();
+        return 1;
+    }
+
+    unlock();
+    return 0;
+}
+
+void cache_store(const uint8_t key[32], const struct proto_reply *rep, const uint8_t *output)
+{
+    struct cache_slot *victim = NULL;
+
+    // outputs that would push out a large part of the cache aren't worth it
+    if (sizeof(struct cache_entry) + rep->output_len > hdr->data_size / 4)
+        return;
+
+    lock();
+
+    // the same key, else a free slot, else the oldest entry
+    for (int i = 0; i < CACHE_PROBE; ++i)
+    {
+        struct cache_slot *s = probe(key, i);
+
+        if (valid(s) && memcmp(s->key, key, 32) == 0)
+        {
+            victim = s;
+            break;
+        }
+
+        if (!valid(s))
+        {
+            if (victim == NULL || valid(victim))
+                victim = s;
+        }
+        else if (victim == NULL || (valid(victim) && s->offset < victim->offset))
+            victim = s;
+    }
+
+    append(victim, key, rep, output);
+    unlock();
+}
@@ -0,0 +1,21 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdint.h>
+#include "proto.h"
+
+#define CACHE_MAGIC "85RC"
+#define CACHE_VERSION 1
+#define CACHE_DEFAULT_MB 64
+#define CACHE_PROBE 8               // index slots an entry can live in
+#define CACHE_SLOT_BYTES 4096       // data bytes per index slot
+
+extern int cache_enabled;
+
+int cache_open(const char *path, uint32_t size_mb, const char *hook_path, const char *native_path);
+void cache_key(uint8_t key[32], const uint8_t *program, uint32_t program_len, const uint8_t *input,
+    uint32_t input_len, uint64_t max_cycles, uint32_t max_output);
+int cache_lookup(const uint8_t key[32], struct proto_reply *rep, uint8_t *output);
+void cache_store(const uint8_t key[32], const struct proto_reply *rep, const uint8_t *output);
+
+#endif /* CACHE_H_ */
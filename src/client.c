@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "proto.h"
+
+/*
+ * 8085vm-client - submit a program to a running "8085vm -D" daemon.
+ * Guest output goes to stdout, the final CPU state to stderr.
+ */
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+// read a whole file ("-" for stdin) into a malloc'd buffer
+static uint8_t *slurp(const char *path, uint32_t max, uint32_t *len)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    uint8_t *buf;
+    size_t n;
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        exit(1);
+    }
+
+    buf = malloc(max + 1);
+    if (buf == NULL)
+    {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(1);
+    }
+
+    n = fread(buf, 1, max + 1, f);
+    if (n > max)
+    {
+        fprintf(stderr, "Error: %s is larger than %u bytes\n", path, max);
+        exit(1);
+    }
+
+    if (f != stdin)
+        fclose(f);
+
+    *len = n;
+    return buf;
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-s socket] [-i input file] [-c max cycles] [-o max output] [-q] <program>\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    struct proto_request req;
+    struct proto_reply rep;
+    struct sockaddr_un addr;
+    char *socket_path = PROTO_DEFAULT_SOCKET;
+    char *input_path = NULL;
+    uint8_t *program, *input = NULL, *output;
+    int fd, opt, quiet = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.magic = PROTO_MAGIC;
+    req.version = PROTO_VERSION;
+
+    while ((opt = getopt(argc, argv, "s:i:c:o:q")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                socket_path = optarg;
+                break;
+
+            case 'i':
+                input_path = optarg;
+                break;
+
+            case 'c':
+                req.max_cycles = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'o':
+                req.max_output = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+
+            case 'q':
+                quiet = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    program = slurp(argv[optind], PROTO_MAX_PROGRAM, &req.program_len);
+    if (input_path != NULL)
+        input = slurp(input_path, PROTO_MAX_INPUT, &req.input_len);
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: socket path too long\n");
+        exit(1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+
+    if (write_full(fd, &req, sizeof(req)) < 0 || write_full(fd, program, req.program_len) < 0
+        || write_full(fd, input, req.input_len) < 0)
+    {
+        fprintf(stderr, "Error: failed to send request\n");
+        exit(1);
+    }
+
+    if (read_full(fd, &rep, sizeof(rep)) < 0 || rep.magic != PROTO_MAGIC)
+    {
+        fprintf(stderr, "Error: no reply from daemon\n");
+        exit(1);
+    }
+
+    if (rep.status == PROTO_BAD_REQUEST)
+    {
+        fprintf(stderr, "Error: daemon rejected the request\n");
+        exit(1);
+    }
+
+    output = malloc(rep.output_len + 1);
+    if (output == NULL || read_full(fd, output, rep.output_len) < 0)
+    {
+        fprintf(stderr, "Error: truncated reply from daemon\n");
+        exit(1);
+    }
+
+    fwrite(output, 1, rep.output_len, stdout);
+    fflush(stdout);
+    close(fd);
+
+    if (!quiet)
+    {
+        fprintf(stderr, "PC = 0x%04X\n", rep.PC);
+        fprintf(stderr, "SP = 0x%04X\n", rep.SP);
+        fprintf(stderr, "A = 0x%02X\n", rep.regs[7]);
+        fprintf(stderr, "B = 0x%02X\n", rep.regs[0]);
+        fprintf(stderr, "C = 0x%02X\n", rep.regs[1]);
+        fprintf(stderr, "D = 0x%02X\n", rep.regs[2]);
+        fprintf(stderr, "E = 0x%02X\n", rep.regs[3]);
+        fprintf(stderr, "H = 0x%02X\n", rep.regs[4]);
+        fprintf(stderr, "L = 0x%02X\n", rep.regs[5]);
+        fprintf(stderr, "F = 0x%02X\n", rep.psw);
+        fprintf(stderr, "Cycles = %llu\n", (unsigned long long)rep.cycles);
+
+        if (rep.status == PROTO_CYCLE_LIMIT)
+            fprintf(stderr, "Cycle limit reached\n");
+        if (rep.status == PROTO_UNDEFINED)
+            fprintf(stderr, "Undefined opcode at PC\n");
+        if (rep.flags & PROTO_OUTPUT_TRUNCATED)
+            fprintf(stderr, "Output truncated\n");
+    }
+
+    // 0 = halted, 2 = cycle limit, 3 = ran off the program segment, 4 = undefined opcode
+    switch (rep.status)
+    {
+        case PROTO_HALTED:
+            return 0;
+
+        case PROTO_CYCLE_LIMIT:
+            return 2;
+
+        case PROTO_UNDEFINED:
+            return 4;
+
+        default:
+            return 3;
+    }
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "mem.h"
+#include "opcodes.h"
+#include "debug.h"
+#include "native.h"
+#include "prof.h"
+#include "io.h"
+
+struct cpu cpu0 = { .PC = 0x0800, .SP = 0xFFFF, .running = 1, .im = 0x07 };
+__thread struct cpu *cpu = &cpu0;
+
+// power-on state with all of memory cleared
+void cpu_reset(void)
+{
+    memset(cpu->regs, 0, sizeof(cpu->regs));
+    cpu->flags = 0;
+    cpu->PC = 0x0800;
+    cpu->SP = 0xFFFF;
+    cpu->stats.cycles_done += cpu->cycles;
+    cpu->cycles = 0;
+    cpu->running = 1;
+    cpu->im = 0x07;
+    cpu->trap = 0;
+    cpu->undef_count = 0;
+    memset(&cpu->timer, 0, sizeof(cpu->timer));
+
+    mem_clear(cpu);
+}
+
+/*
+ * c (zeroed or released) becomes a copy of src: registers, cycles, timer and the
+ * undefined opcode state are copied and memory is shared copy-on-write,
+ * in O(pages) with no copying after the first clone of src
+ */
+void cpu_clone(struct cpu *c, struct cpu *src)
+{
+    memcpy(c->regs, src->regs, sizeof(c->regs));
+    c->flags = src->flags;
+    c->PC = src->PC;
+    c->SP = src->SP;
+    c->cycles = src->cycles;
+    c->running = src->running;
+    c->im = src->im;
+    c->trap = src->trap;
+    c->undef_count = src->undef_count;
+    c->timer = src->timer;
+    c->native = src->native;
+
+    mem_clone(c, src);
+}
+
+// end of a clone, its pages go away with their last user
+void cpu_release(struct cpu *c)
+{
+    mem_release(c);
+    c->mem_cow = 0;
+}
+
+// registers in operand order B C D E H L M A, M as 0, the order traces and replies store
+void cpu_get_regs(const struct cpu *c, uint8_t *regs)
+{
+    for (int code = 0; code < R_COUNT; ++code)
+        regs[code] = REG_INDEX(code) == R_MEM ? 0 : c->regs[REG_INDEX(code)];
+}
+
+/*
+ * the run loop, specialized so the normal loop tests for neither of:
+ * profile - opcode fetches are counted as executions and the stack is
+ *           followed after every instruction
+ * debug   - stop before an instruction with a breakpoint, returning 1
+ * async   - an instruction whose access of the I/O cells has to wait is
+ *           undone, so the run can be resumed from it later. Instructions
+ *           read memory before they write it, so only registers need saving
+ * all leave compiled blocks alone
+ */
+static inline __attribute__((always_inline)) int run_loop(uint64_t limit, int profile, int debug, int async)
+{
+    while (cpu->PC < STACK_SEGMENT_START && cpu->running && cpu->cycles < limit)
+    {
+        uint16_t sp = cpu->SP;
+        uint16_t pc = cpu->PC;
+        uint8_t regs[R_COUNT], flags = cpu->flags;
+        uint64_t cycles = cpu->cycles;
+        uint64_t in_bytes = cpu->stats.in_bytes, out_bytes = cpu->stats.out_bytes;
+
+        if (async)
+            memcpy(regs, cpu->regs, sizeof(regs));
+
+        if (debug)
+        {
+            if (cpu->breaks[cpu->PC] && !cpu->break_skip)
+                return 1;
+            cpu->break_skip = 0;
+        }
+
+        // compiled blocks run until they reach code they don't cover
+        if (!profile && !debug && !async && cpu->native && native_index[cpu->PC] && !step_sec)
+        {
+            if (!code_dirty[cpu->PC >> MEM_PAGE_SHIFT])
+            {
+                uint64_t start = cpu->cycles;
+
+                native_run(limit);
+                cpu->stats.native_runs++;
+                cpu->stats.native_cycles += cpu->cycles - start;
+                continue;
+            }
+
+            cpu->stats.native_stale++;
+        }
+
+        if (profile)
+        {
+            cpu->prof->execs[cpu->PC >> PROF_SHIFT]++;
+            cpu->opcode = mem_fetch(cpu->PC++);
+        }
+        else
+            cpu->opcode = mem_read(cpu->PC++);
+
+        cpu->cycles += cycle_table[cpu->opcode];
+        cpu->stats.ops[cpu->opcode]++;
+        opcode_table[cpu->opcode]();
+
+        if (async && io.blocked)
+        {
+            memcpy(cpu->regs, regs, sizeof(regs));
+            cpu->flags = flags;
+            cpu->PC = pc;
+            cpu->SP = sp;
+            cpu->cycles = cycles;
+            cpu->stats.ops[cpu->opcode]--;
+            cpu->stats.in_bytes = in_bytes;
+            cpu->stats.out_bytes = out_bytes;
+            break;
+        }
+
+        if (profile)
+            prof_step(cpu->prof, cpu->opcode, sp);
+
+        if (step_sec)
+            cpu->stats.throttle_sec += step_sec - sleep(step_sec);
+    }
+
+    return 0;
+}
+
+/*
+ * execute until HLT, the stack segment, a breakpoint or max_cycles T-states
+ * (0 = no limit), and with asynchronous I/O until the I/O cells have to wait
+ */
+int cpu_run(uint64_t max_cycles)
+{
+    uint64_t limit = max_cycles ? cpu->cycles + max_cycles : UINT64_MAX;
+    int hit;
+
+    io.blocked = 0;
+
+    // a data write to the stack guard page stops the loop so the guard is armed again
+    do
+    {
+        switch ((cpu->prof != NULL) | (cpu->breaks != NULL) << 1 | (io.async != 0) << 2)
+        {
+            case 0:
+                hit = run_loop(limit, 0, 0, 0);
+                break;
+
+            case 1:
+                hit = run_loop(limit, 1, 0, 0);
+                break;
+
+            case 2:
+                hit = run_loop(limit, 0, 1, 0);
+                break;
+
+            case 3:
+                hit = run_loop(limit, 1, 1, 0);
+                break;
+
+            case 4:
+                hit = run_loop(limit, 0, 0, 1);
+                break;
+
+            case 5:
+                hit = run_loop(limit, 1, 0, 1);
+                break;
+
+            case 6:
+                hit = run_loop(limit, 0, 1, 1);
+                break;
+
+            default:
+                hit = run_loop(limit, 1, 1, 1);
+                break;
+        }
+    }
+    while (!hit && mem_guard_rearm());
+
+    if (hit)
+        return RUN_BREAK;
+    if (io.blocked)
+        return io.blocked;
+    if (mem_fault != FAULT_NONE)
+        return RUN_FAULT;
+    if (cpu->trap)
+        return RUN_UNDEF;
+    if (cpu->PC >= STACK_SEGMENT_START)
+        return RUN_END;
+    if (cpu->running)
+        return RUN_LIMIT;
+
+    return RUN_HALT;
+}
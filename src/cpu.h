@@ -6,7 +6,36 @@
 #define MEMORY_MAX (1 << 16)
 #define STACK_SEGMENT_START 0xE000  // 8KB stack segment
 
-// registers 
+#define MEM_PAGE_SHIFT 12      // 4KB windows
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_PAGES (MEMORY_MAX >> MEM_PAGE_SHIFT)
+
+#define CPU_ALIGN 64            // the CPU state starts on a cache line
+#define CPU_REPORTS 16          // slots of the guest timing reports, see timer.c
+
+/*
+ * registers, numbered by their byte in regs[]. Each pair is stored in host
+ * byte order so the 16-bit views of struct cpu read it in one load, and
+ * the flags take the slot of M, which is never stored. Operand fields of
+ * instructions number them B C D E H L M A, REG_INDEX() maps those codes.
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+enum
+{
+    R_C = 0,
+    R_B,
+    R_E,
+    R_D,
+    R_L,
+    R_H,
+    R_F,
+    R_A,
+    R_COUNT
+};
+
+#define REG_INDEX(code) ((code) < 6 ? (code) ^ 1 : (code))
+#else
 enum
 {
     R_B = 0,
@@ -15,11 +44,16 @@ enum
     R_E,
     R_H,
     R_L,
-    R_MEM,
     R_A,
+    R_F,
     R_COUNT
 };
 
+#define REG_INDEX(code) ((code) < 6 ? (code) : (code) ^ 1)
+#endif
+
+#define R_MEM R_F               // M as an operand, memory at HL
+
 // register pairs
 enum
 {
@@ -30,6 +64,19 @@ enum
     RP_PSW
 };
 
+// why cpu_run returned
+enum
+{
+    RUN_HALT = 0,       // HLT or stopped from the debugger
+    RUN_LIMIT,          // cycle limit reached
+    RUN_END,            // PC ran into the stack segment
+    RUN_FAULT,          // protected page written
+    RUN_UNDEF,          // undefined opcode trapped
+    RUN_BREAK,          // breakpoint of the gdb stub reached
+    RUN_INPUT,          // asynchronous I/O: waiting for input, PC on the reading instruction
+    RUN_OUTPUT          // asynchronous I/O: output buffer full, PC on the writing instruction
+};
+
 // flags
 enum
 {
@@ -40,11 +87,95 @@ enum
     FL_S = 1 << 7
 };
 
-extern uint8_t memory[MEMORY_MAX];
-extern uint8_t regs[R_COUNT];
-extern uint8_t flags;
+struct mem_prof;
+struct mem_shared;
+
+// counters of one CPU, written only by the thread running it
+struct cpu_stats
+{
+    uint64_t ops[256];              // interpreted instructions by opcode
+    uint64_t taken;                 // conditional jumps, calls and returns taken
+    uint64_t cycles_done;           // T-states of the runs before the last cpu_reset
+    uint64_t in_bytes;              // reads of the standard input cell
+    uint64_t out_bytes;             // writes to the standard output cell
+    uint64_t native_runs;           // entries into compiled blocks
+    uint64_t native_cycles;         // T-states spent in them
+    uint64_t native_stale;          // compiled blocks skipped because their page was written
+    uint64_t throttle_sec;          // seconds slept for step_sec
+    uint64_t report_count[CPU_REPORTS];     // stopwatch times the guest reported, by slot
+    uint64_t report_cycles[CPU_REPORTS];    // their sum
+    uint64_t report_min[CPU_REPORTS];
+    uint64_t report_max[CPU_REPORTS];
+};
+
+// guest timer registers of one CPU
+struct cpu_timer
+{
+    uint32_t latch;                 // T-state counter, latched by a read of its low byte
+    uint32_t elapsed_latch;         // stopwatch, the same
+    uint64_t start;                 // cycles when the stopwatch started
+    uint64_t elapsed;               // T-states of the last start to stop
+    uint8_t running;
+};
+
+// state of one emulated 8085
+struct cpu
+{
+    union
+    {
+        uint8_t regs[R_COUNT];
+        uint16_t pairs[4];      // BC, DE, HL and PSW, indexed by RP_ except PSW in the slot of SP
+        struct
+        {
+            uint16_t BC, DE, HL, PSW;
+        };
+        struct
+        {
+            uint8_t flags_slot[R_F];
+            uint8_t flags;
+        };
+    };
+    uint8_t opcode;
+    uint8_t running;
+
+    uint16_t PC;
+    uint16_t SP;
+    uint64_t cycles;            // T-states executed
+
+    uint8_t *mem_rmap[MEM_PAGES];   // direct read pointer, NULL -> slow path
+    uint8_t *mem_wmap[MEM_PAGES];   // direct write pointer, NULL -> slow path
+    uint8_t *memory;            // private 64KB
+    uint8_t *mem_page[MEM_PAGES];   // host storage behind each window
+    struct mem_shared *mem_ref[MEM_PAGES];  // refcounted storage shared with clones, NULL for own storage
+    uint16_t mem_cow;               // pages still shared with clones, copied on first write
+
+    uint8_t native;                 // memory holds the program of the loaded 8085aot object
+
+    uint8_t im;                     // interrupt masks (bits 0-2) and enable (bit 3), as RIM reads them
+    uint8_t trap;                   // stopped on an undefined opcode
+    uint64_t undef_count;           // undefined opcodes skipped under UNDEF_COUNT
+
+    int id;
+
+    struct cpu_stats stats;
+    struct mem_prof *prof;          // memory profile, NULL unless profiling
+    const uint8_t *breaks;          // breakpoint map of the gdb stub, NULL if there are none
+    uint8_t break_skip;             // run over a breakpoint at PC once, when resuming from it
+    uint8_t log_writes;             // writes take the slow path and are hashed into write_hash
+    uint64_t write_hash;            // FNV-1a over the address and value of every write
+
+    struct cpu_timer timer;
+} __attribute__((aligned(CPU_ALIGN)));
+
+extern struct cpu cpu0;
+
+// CPU driven by the calling thread, &cpu0 unless the thread picked another
+extern __thread struct cpu *cpu;
 
-extern uint16_t PC;
-extern uint16_t SP;
+void cpu_reset(void);
+int cpu_run(uint64_t max_cycles);
+void cpu_clone(struct cpu *c, struct cpu *src);
+void cpu_release(struct cpu *c);
+void cpu_get_regs(const struct cpu *c, uint8_t *regs);
 
 #endif /* CPU_H_ */
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "ctl.h"
+#include "cpu.h"
+#include "mem.h"
+#include "debug.h"
+#include "opcodes.h"
+
+/*
+ * run control of a single CPU. The CPU thread runs the program in slices
+ * (ctl_run) and only looks at the state below when a request is pending,
+ * which costs one relaxed atomic load per slice. Everything else is
+ * handed over under ctl_mutex: the debugger thread and the gdb stub ask
+ * for a pause, steps or a call on the CPU thread, and wait on ctl_cond.
+ * A paused CPU thread sleeps on ctl_cond as well.
+ */
+
+#define BREAK_USER 1        // breakpoint set from the gdb stub
+#define BREAK_UNTIL 2       // target of until
+
+int ctl_enabled = 0;
+
+static pthread_mutex_t ctl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ctl_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int pending = 0;
+
+static int state = CTL_RUNNING;
+static int idle = 0;                // the CPU thread sleeps while paused
+static int skip = 0;                // run over the breakpoint at PC when the CPU thread goes on
+static int quit = 0;
+static struct ctl_stop last = { 0, CTL_STOP_PAUSE, RUN_LIMIT };
+
+static void (*request)(void) = NULL;
+static uint64_t steps;              // instructions left while stepping, 0 for finish
+static uint16_t finish_sp;
+
+static uint8_t breaks[MEMORY_MAX];
+static int break_count = 0;
+static int until_set = 0;
+static uint16_t until_addr;
+
+// ctl_mutex held
+static void kick(void)
+{
+    atomic_store_explicit(&pending, 1, memory_order_relaxed);
+    pthread_cond_broadcast(&ctl_cond);
+}
+
+// ctl_mutex held
+static void stopped(int new_state, int reason)
+{
+    state = new_state;
+    last.seq++;
+    last.reason = reason;
+    pthread_cond_broadcast(&ctl_cond);
+}
+
+static void clear_until(void)
+{
+    if (until_set)
+        breaks[until_addr] &= ~BREAK_UNTIL;
+    until_set = 0;
+}
+
+// only stops the console asked for are announced there
+static void announce(const char *what)
+{
+    const char *name = name_table[mem_peek(cpu->PC)];
+
+    printf("\n%s at 0x%04X: %s\n8085vm# ", what, cpu->PC, name ? name : "undefined");
+    fflush(stdout);
+}
+
+// run the loaded program under run control, instead of cpu_run
+int ctl_run(void)
+{
+    int ret = RUN_LIMIT;
+
+    pthread_mutex_lock(&ctl_mutex);
+
+    while (!quit)
+    {
+        int stepping;
+
+        atomic_store_explicit(&pending, 0, memory_order_relaxed);
+
+        if (request != NULL)
+        {
+            request();
+            request = NULL;
+            pthread_cond_broadcast(&ctl_cond);
+            continue;
+        }
+
+        if (state == CTL_PAUSED)
+        {
+            idle = 1;
+            pthread_cond_broadcast(&ctl_cond);
+            pthread_cond_wait(&ctl_cond, &ctl_mutex);
+            idle = 0;
+            continue;
+        }
+
+        stepping = state == CTL_STEPPING;
+        cpu->break_skip = skip;
+        skip = 0;
+        cpu->breaks = (break_count || until_set) ? breaks : NULL;
+        pthread_mutex_unlock(&ctl_mutex);
+
+        if (stepping)
+        {
+            // a compiled block would run more than one instruction
+            uint8_t native = cpu->native;
+
+            cpu->native = 0;
+            ret = cpu_run(1);
+            cpu->native = native;
+        }
+        else
+        {
+            // single instructions with a step delay, so a pause doesn't wait for a whole slice
+            do
+                ret = cpu_run(step_sec ? 1 : CTL_SLICE_CYCLES);
+            while (ret == RUN_LIMIT && !atomic_load_explicit(&pending, memory_order_relaxed));
+        }
+
+        pthread_mutex_lock(&ctl_mutex);
+
+        if (ret == RUN_BREAK)
+        {
+            if (until_set && cpu->PC == until_addr)
+            {
+                clear_until();
+                stopped(CTL_PAUSED, CTL_STOP_UNTIL);
+                announce("Reached");
+            }
+            else
+                stopped(CTL_PAUSED, CTL_STOP_BREAK);
+        }
+        else if (ret == RUN_LIMIT && stepping && state == CTL_STEPPING)
+        {
+            if (steps == 0 && cpu->SP > finish_sp)
+            {
+                stopped(CTL_PAUSED, CTL_STOP_FINISH);
+                announce("Returned");
+            }
+            else if (steps != 0 && --steps == 0)
+                stopped(CTL_PAUSED, CTL_STOP_STEP);
+        }
+        else if (ret != RUN_LIMIT)
+            break;
+    }
+
+    // exit from the debugger
+    if (quit)
+    {
+        cpu->running = 0;
+        ret = RUN_HALT;
+    }
+
+    clear_until();
+    last.result = ret;
+    stopped(CTL_DONE, CTL_STOP_END);
+    pthread_mutex_unlock(&ctl_mutex);
+    return ret;
+}
+
+// let ctl_run return, the debugger's exit
+void ctl_stop(void)
+{
+    pthread_mutex_lock(&ctl_mutex);
+    quit = 1;
+    kick();
+    pthread_mutex_unlock(&ctl_mutex);
+}
+
+int ctl_state(struct ctl_stop *stop)
+{
+    int ret;
+
+    pthread_mutex_lock(&ctl_mutex);
+    ret = state;
+    if (stop != NULL)
+        *stop = last;
+    pthread_mutex_unlock(&ctl_mutex);
+
+    return ret;
+}
+
+// stop at the next slice, with wait until the CPU thread is asleep
+int ctl_pause(int wait)
+{
+    pthread_mutex_lock(&ctl_mutex);
+
+    if (state == CTL_DONE)
+    {
+        pthread_mutex_unlock(&ctl_mutex);
+        return -1;
+    }
+
+    if (state != CTL_PAUSED)
+    {
+        clear_until();
+        stopped(CTL_PAUSED, CTL_STOP_PAUSE);
+        kick();
+    }
+
+    while (wait && !idle && state == CTL_PAUSED)
+        pthread_cond_wait(&ctl_cond, &ctl_mutex);
+
+    pthread_mutex_unlock(&ctl_mutex);
+    return 0;
+}
+
+// ctl_mutex held, seq gets the number of the last stop before this
+static int go(int new_state, uint32_t *seq)
+{
+    if (state == CTL_DONE)
+        return -1;
+
+    // run over the breakpoint we stopped on, once the CPU thread really stopped there
+    if (state == CTL_PAUSED && idle)
+        skip = 1;
+
+    if (seq != NULL)
+        *seq = last.seq;
+
+    state = new_state;
+    kick();
+    return 0;
+}
+
+int ctl_resume(uint32_t *seq)
+{
+    int ret;
+
+    pthread_mutex_lock(&ctl_mutex);
+    ret = go(CTL_RUNNING, seq);
+    pthread_mutex_unlock(&ctl_mutex);
+
+    return ret;
+}
+
+// run count instructions, with wait until they're done or the program ended
+int ctl_step(uint64_t count, int wait, uint32_t *seq)
+{
+    uint32_t from = 0;
+    int ret;
+
+    pthread_mutex_lock(&ctl_mutex);
+    steps = count;
+    ret = go(CTL_STEPPING, &from);
+
+    while (ret == 0 && wait && last.seq == from)
+        pthread_cond_wait(&ctl_cond, &ctl_mutex);
+
+    pthread_mutex_unlock(&ctl_mutex);
+
+    if (seq != NULL)
+        *seq = from;
+    return ret;
+}
+
+// run until PC reaches addr
+int ctl_until(uint16_t addr)
+{
+    int ret;
+
+    pthread_mutex_lock(&ctl_mutex);
+    clear_until();
+    until_set = 1;
+    until_addr = addr;
+    breaks[addr] |= BREAK_UNTIL;
+
+    ret = go(CTL_RUNNING, NULL);
+    if (ret < 0)
+        clear_until();
+    pthread_mutex_unlock(&ctl_mutex);
+
+    return ret;
+}
+
+// run until SP rises above its current value, the RET of the current routine
+int ctl_finish(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&ctl_mutex);
+    steps = 0;
+    finish_sp = cpu0.SP;
+    ret = go(CTL_STEPPING, NULL);
+    pthread_mutex_unlock(&ctl_mutex);
+
+    return ret;
+}
+
+// run fn on the CPU thread between two slices, or right here once it's done
+void ctl_call(void (*fn)(void))
+{
+    pthread_mutex_lock(&ctl_mutex);
+
+    while (request != NULL && state != CTL_DONE)
+        pthread_cond_wait(&ctl_cond, &ctl_mutex);
+
+    if (state != CTL_DONE)
+    {
+        request = fn;
+        kick();
+
+        while (request == fn && state != CTL_DONE)
+            pthread_cond_wait(&ctl_cond, &ctl_mutex);
+    }
+
+    // the program ended before the CPU thread got to it
+    if (state == CTL_DONE && request == fn)
+        request = NULL;
+    if (state == CTL_DONE)
+        fn();
+
+    pthread_mutex_unlock(&ctl_mutex);
+}
+
+void ctl_break(uint16_t addr, int on)
+{
+    pthread_mutex_lock(&ctl_mutex);
+
+    if (on && !(breaks[addr] & BREAK_USER))
+        break_count++;
+    else if (!on && (breaks[addr] & BREAK_USER))
+        break_count--;
+
+    breaks[addr] = on ? (breaks[addr] | BREAK_USER) : (breaks[addr] & ~BREAK_USER);
+    kick();
+    pthread_mutex_unlock(&ctl_mutex);
+}
+
+void ctl_clear_breaks(void)
+{
+    pthread_mutex_lock(&ctl_mutex);
+
+    for (int i = 0; i < MEMORY_MAX; ++i)
+        breaks[i] &= ~BREAK_USER;
+    break_count = 0;
+
+    pthread_mutex_unlock(&ctl_mutex);
+}
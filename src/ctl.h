@@ -0,0 +1,51 @@
+#ifndef CTL_H_
+#define CTL_H_
+
+#include <stdint.h>
+
+#define CTL_SLICE_CYCLES 100000      // T-states run between two looks at pending requests
+
+// what the CPU thread is doing
+enum
+{
+    CTL_RUNNING = 0,
+    CTL_STEPPING,       // a number of instructions, or until the current routine returns
+    CTL_PAUSED,
+    CTL_DONE            // the program is over, ctl_run returned
+};
+
+// why it last stopped
+enum
+{
+    CTL_STOP_PAUSE = 0, // pause request
+    CTL_STOP_BREAK,     // breakpoint
+    CTL_STOP_STEP,      // stepping finished
+    CTL_STOP_UNTIL,     // until address reached
+    CTL_STOP_FINISH,    // the routine returned
+    CTL_STOP_END        // the program ended, see ctl_result
+};
+
+// a stop, numbered so waiters can tell a new one from the last
+struct ctl_stop
+{
+    uint32_t seq;
+    int reason;
+    int result;         // RUN_ code of the end of the program
+};
+
+extern int ctl_enabled;
+
+int ctl_run(void);
+void ctl_stop(void);
+
+int ctl_state(struct ctl_stop *last);
+int ctl_pause(int wait);
+int ctl_resume(uint32_t *seq);
+int ctl_step(uint64_t count, int wait, uint32_t *seq);
+int ctl_until(uint16_t addr);
+int ctl_finish(void);
+void ctl_call(void (*fn)(void));
+void ctl_break(uint16_t addr, int on);
+void ctl_clear_breaks(void);
+
+#endif /* CTL_H_ */
@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include "daemon.h"
+#include "proto.h"
+#include "cpu.h"
+#include "mem.h"
+#include "io.h"
+#include "native.h"
+#include "stats.h"
+#include "cache.h"
+
+#define DAEMON_MAX_EVENTS 64
+#define DAEMON_QUEUE_SIZE 1024
+#define DAEMON_IO_TIMEOUT 5         // seconds a client gets to send or receive
+#define LISTEN_TAG UINT64_MAX
+
+struct worker
+{
+    pid_t pid;
+    int ctl;        // socketpair end used to hand over clients
+    int busy;
+};
+
+static struct worker workers[DAEMON_MAX_WORKERS];
+static int worker_count = 0;
+
+// accepted clients waiting for an idle worker
+static int pending[DAEMON_QUEUE_SIZE];
+static int pending_head = 0, pending_count = 0;
+
+static int listen_fd = -1, epoll_fd = -1;
+static volatile sig_atomic_t daemon_stop = 0;
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int send_fd(int ctl, int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    char byte = 'j';
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return sendmsg(ctl, &msg, 0) == 1 ? 0 : -1;
+}
+
+static int recv_fd(int ctl)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    char byte;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    int fd;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    if (recvmsg(ctl, &msg, 0) <= 0)
+        return -1;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+// run one request on this worker's already initialized VM
+static void worker_job(int fd)
+{
+    static uint8_t program[PROTO_MAX_PROGRAM];
+    static uint8_t input[PROTO_MAX_INPUT];
+    static uint8_t output[PROTO_MAX_OUTPUT];
+
+    struct proto_request req;
+    struct proto_reply rep;
+    struct timeval tv = { DAEMON_IO_TIMEOUT, 0 };
+    uint32_t max_output;
+    uint64_t max_cycles;
+    uint8_t key[32];
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    memset(&rep, 0, sizeof(rep));
+    rep.magic = PROTO_MAGIC;
+
+    if (read_full(fd, &req, sizeof(req)) < 0)
+        return;
+
+    if (req.magic != PROTO_MAGIC || req.version != PROTO_VERSION
+        || req.program_len > PROTO_MAX_PROGRAM || req.input_len > PROTO_MAX_INPUT)
+    {
+        rep.status = PROTO_BAD_REQUEST;
+        write_full(fd, &rep, sizeof(rep));
+        return;
+    }
+
+    if (read_full(fd, program, req.program_len) < 0 || read_full(fd, input, req.input_len) < 0)
+        return;
+
+    max_output = (req.max_output && req.max_output < PROTO_MAX_OUTPUT) ? req.max_output : PROTO_MAX_OUTPUT;
+    max_cycles = req.max_cycles ? req.max_cycles : DAEMON_DEFAULT_CYCLES;
+
+    // runs are deterministic, the same job gets the same reply
+    if (cache_enabled)
+    {
+        cache_key(key, program, req.program_len, input, req.input_len, max_cycles, max_output);
+
+        if (cache_lookup(key, &rep, output))
+        {
+            if (write_full(fd, &rep, sizeof(rep)) == 0)
+                write_full(fd, output, rep.output_len);
+            return;
+        }
+    }
+
+    cpu_reset();
+    mem_load(cpu->PC, program, req.program_len);
+    cpu->native = native_match();
+    io_reset(input, req.input_len, output, max_output);
+
+    switch (cpu_run(max_cycles))
+    {
+        case RUN_LIMIT:
+            rep.status = PROTO_CYCLE_LIMIT;
+            break;
+
+        case RUN_END:
+            rep.status = PROTO_SEGMENT_END;
+            break;
+
+        case RUN_UNDEF:
+            rep.status = PROTO_UNDEFINED;
+            break;
+
+        default:
+            rep.status = PROTO_HALTED;
+            break;
+    }
+
+    cpu_get_regs(cpu, rep.regs);
+    rep.psw = cpu->flags;
+    rep.PC = cpu->PC;
+    rep.SP = cpu->SP;
+    rep.cycles = cpu->cycles;
+    rep.output_len = io.out_len;
+    rep.flags = io.truncated ? PROTO_OUTPUT_TRUNCATED : 0;
+
+    if (cache_enabled)
+        cache_store(key, &rep, output);
+
+    if (write_full(fd, &rep, sizeof(rep)) == 0)
+        write_full(fd, output, io.out_len);
+}
+
+static void worker_main(int idx, int ctl)
+{
+    int fd;
+    char done = 'd';
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    // threads don't survive the fork, every worker samples and writes its own file
+    if (stats_file != NULL && stats_start(idx) < 0)
+        exit(1);
+
+    // parent closing its end of ctl ends the worker
+    while ((fd = recv_fd(ctl)) >= 0)
+    {
+        worker_job(fd);
+        close(fd);
+
+        if (write_full(ctl, &done, 1) < 0)
+            break;
+    }
+
+    stats_stop();
+    exit(0);
+}
+
+static int spawn_worker(int idx)
+{
+    int sv[2];
+    struct epoll_event ev;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        perror("socketpair");
+        return -1;
+    }
+
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        // keep only our own control socket
+        close(sv[0]);
+        close(listen_fd);
+        close(epoll_fd);
+        for (int i = 0; i < worker_count; ++i)
+            if (i != idx && workers[i].ctl >= 0)
+                close(workers[i].ctl);
+
+        worker_main(idx, sv[1]);
+    }
+
+    close(sv[1]);
+    workers[idx].pid = pid;
+    workers[idx].ctl = sv[0];
+    workers[idx].busy = 0;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = idx;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sv[0], &ev);
+    return 0;
+}
+
+static void dispatch(int client)
+{
+    for (int i = 0; i < worker_count; ++i)
+    {
+        if (workers[i].busy || workers[i].ctl < 0)
+            continue;
+
+        if (send_fd(workers[i].ctl, client) == 0)
+        {
+            workers[i].busy = 1;
+            close(client);
+            return;
+        }
+    }
+
+    if (pending_count == DAEMON_QUEUE_SIZE)
+    {
+        // overloaded, drop the connection
+        close(client);
+        return;
+    }
+
+    pending[(pending_head + pending_count) % DAEMON_QUEUE_SIZE] = client;
+    pending_count++;
+}
+
+static void worker_event(int idx)
+{
+    char byte;
+    ssize_t n = read(workers[idx].ctl, &byte, 1);
+
+    if (n < 0 && errno == EINTR)
+        return;
+
+    // worker died, its client (if any) is gone with it
+    if (n <= 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, workers[idx].ctl, NULL);
+        close(workers[idx].ctl);
+        workers[idx].ctl = -1;
+        waitpid(workers[idx].pid, NULL, 0);
+
+        if (spawn_worker(idx) < 0)
+            return;
+    }
+
+    workers[idx].busy = 0;
+
+    if (pending_count > 0)
+    {
+        int client = pending[pending_head];
+
+        pending_head = (pending_head + 1) % DAEMON_QUEUE_SIZE;
+        pending_count--;
+        dispatch(client);
+    }
+}
+
+static void stop_handler(int sig)
+{
+    (void)sig;
+    daemon_stop = 1;
+}
+
+/*
+ * serve requests on a Unix socket with a pool of pre-forked workers, each
+ * holding a VM that was initialized once before the fork
+ */
+int daemon_main(const char *socket_path, int nworkers)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev, events[DAEMON_MAX_EVENTS];
+    struct sigaction sa;
+
+    if (nworkers < 1 || nworkers > DAEMON_MAX_WORKERS)
+    {
+        fprintf(stderr, "Error: worker count must be between 1 and %d\n", DAEMON_MAX_WORKERS);
+        return -1;
+    }
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: socket path too long\n");
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, SOMAXCONN) < 0)
+    {
+        perror("bind");
+        close(listen_fd);
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTEN_TAG;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    for (worker_count = 0; worker_count < nworkers; ++worker_count)
+        if (spawn_worker(worker_count) < 0)
+            break;
+
+    fprintf(stderr, "8085vm daemon listening on %s with %d workers\n", socket_path, worker_count);
+
+    while (!daemon_stop)
+    {
+        int n = epoll_wait(epoll_fd, events, DAEMON_MAX_EVENTS, -1);
+
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.u64 == LISTEN_TAG)
+            {
+                int client;
+                while ((client = accept(listen_fd, NULL, NULL)) >= 0)
+                    dispatch(client);
+            }
+            else
+                worker_event((int)events[i].data.u64);
+        }
+    }
+
+    // closing the control sockets lets idle workers exit
+    for (int i = 0; i < worker_count; ++i)
+    {
+        close(workers[i].ctl);
+        waitpid(workers[i].pid, NULL, 0);
+    }
+
+    close(listen_fd);
+    close(epoll_fd);
+    unlink(socket_path);
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include <stdint.h>
+
+#define DAEMON_MAX_WORKERS 256
+#define DAEMON_DEFAULT_CYCLES 100000000ULL     // about 30s of a 3MHz 8085
+
+int daemon_main(const char *socket_path, int nworkers);
+
+#endif /* DAEMON_H_ */
@@ -6,14 +6,19 @@
 
 #include "debug.h"
 #include "cpu.h"
+#include "mem.h"
+#include "smp.h"
+#include "stats.h"
+#include "prof.h"
+#include "ctl.h"
+#include "opcodes.h"
+#include "script.h"
+#include "rr.h"
 
-#define NUM_CMDS 6
 #define CHAR_DELIM " \t"
 #define TOKEN_BUFFER_SIZE 64
 #define MAX_BUFF_SIZE 256
 
-pthread_mutex_t debug_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 char *get_input(void)
 {
     char *line = NULL;
@@ -138,23 +143,58 @@ int d_help(char **argv)
                 printf("dump - display register, flag, stdout contents\n");
                 break;
 
-            // info
+            // stats
             case 3:
-                printf("info [r [register] | f [flag] | a <address>] - get reg/flag/addr info\n");
+                printf("stats - display instruction, branch, I/O and native code counters\n");
                 break;
 
-            // set
+            // heatmap
             case 4:
+                printf("heatmap - display memory accesses per page and stack depth (needs -P)\n");
+                break;
+
+            // info
+            case 5:
+                printf("info [r [register] | f [flag] | a [bank:]<address>] - get reg/flag/addr info\n");
+                break;
+
+            // set
+            case 6:
                 printf("set <addr> <val> - write value into address\n");
                 break;
 
             // step
-            case 5:
+            case 7:
                 printf("step <seconds> - set sleep time between commands (0 by default)\n");
                 break;
 
+            // pause
+            case 8:
+                printf("pause - stop the program at the end of its current slice of %d T-states\n", CTL_SLICE_CYCLES);
+                break;
+
+            // resume
+            case 9:
+                printf("resume - continue a paused program\n");
+                break;
+
+            // stepi
+            case 10:
+                printf("stepi [count] - run count instructions of a paused program (1 by default)\n");
+                break;
+
+            // until
+            case 11:
+                printf("until <addr> - run until PC reaches addr, then pause\n");
+                break;
+
+            // finish
+            case 12:
+                printf("finish - run until the current routine returns, then pause\n");
+                break;
+
             // exit
-            case 6:
+            case 13:
                 printf("exit - exits debugger\n");
                 break;
         }
@@ -166,24 +206,57 @@ int d_help(char **argv)
 int d_dump(char **argv)
 {
     printf("\nRegister state:\n");
-    printf("PC = 0x%04X\n", PC);
-    printf("SP = 0x%04X\n", SP);
-    printf("A = 0x%02X\n", regs[R_A]);
-    printf("B = 0x%02X\n", regs[R_B]);
-    printf("C = 0x%02X\n", regs[R_C]);
-    printf("D = 0x%02X\n", regs[R_D]);
-    printf("E = 0x%02X\n", regs[R_E]);
-    printf("H = 0x%02X\n", regs[R_H]);
-    printf("L = 0x%02X\n", regs[R_L]);
+    printf("PC = 0x%04X\n", cpu->PC);
+    printf("SP = 0x%04X\n", cpu->SP);
+    printf("A = 0x%02X\n", cpu->regs[R_A]);
+    printf("B = 0x%02X\n", cpu->regs[R_B]);
+    printf("C = 0x%02X\n", cpu->regs[R_C]);
+    printf("D = 0x%02X\n", cpu->regs[R_D]);
+    printf("E = 0x%02X\n", cpu->regs[R_E]);
+    printf("H = 0x%02X\n", cpu->regs[R_H]);
+    printf("L = 0x%02X\n", cpu->regs[R_L]);
+    printf("Cycles = %llu\n", (unsigned long long)cpu->cycles);
     printf("\nFlags:\n");
-    printf("CY: %d\n", flags & FL_CY);
-    printf("P:  %d\n", (flags & FL_P) >> 2);
-    printf("AC: %d\n", (flags & FL_AC) >> 4);
-    printf("Z:  %d\n", (flags & FL_Z) >> 6);
-    printf("S:  %d\n", (flags & FL_S) >> 7);
-    printf("\nPort 0x3000 (standard output): %02X\n", memory[0x3000]);
-    printf("Port 0x2000 (standard input): %02X\n\n", memory[0x2000]);
+    printf("CY: %d\n", cpu->flags & FL_CY);
+    printf("P:  %d\n", (cpu->flags & FL_P) >> 2);
+    printf("AC: %d\n", (cpu->flags & FL_AC) >> 4);
+    printf("Z:  %d\n", (cpu->flags & FL_Z) >> 6);
+    printf("S:  %d\n", (cpu->flags & FL_S) >> 7);
+    printf("\nPort 0x3000 (standard output): %02X\n", mem_peek(0x3000));
+    printf("Port 0x2000 (standard input): %02X\n", mem_peek(0x2000));
+    if (bank_count)
+        printf("Selected bank: %d of %d\n", bank_selected, bank_count);
+    if (mem_prot_mode == MEM_PROT_SMC)
+        printf("Modified code pages: %u\n", smc_writes);
+    if (cpu->trap)
+        printf("Stopped on undefined opcode %02X\n", mem_peek(cpu->PC));
+    if (cpu->undef_count)
+        printf("Undefined opcodes skipped: %llu\n", (unsigned long long)cpu->undef_count);
+    printf("\n");
+
+    return 1;
+}
+
+int d_stats(char **argv)
+{
+    (void)argv;
+    stats_print();
+    return 1;
+}
+
+int d_heatmap(char **argv)
+{
+    (void)argv;
+
+    if (prof_file == NULL)
+    {
+        printf("Memory profiling is off, start the emulator with -P <file>\n");
+        return 1;
+    }
 
+    printf("\n");
+    prof_print(stdout);
+    printf("\n");
     return 1;
 }
 
@@ -200,15 +273,15 @@ int d_info (char **argv)
         case 'r':
             if (argv[2] == NULL)
             {
-                printf("PC = 0x%04X\n", PC);
-                printf("SP = 0x%04X\n", SP);
-                printf("A = 0x%02X\n", regs[R_A]);
-                printf("B = 0x%02X\n", regs[R_B]);
-                printf("C = 0x%02X\n", regs[R_C]);
-                printf("D = 0x%02X\n", regs[R_D]);
-                printf("E = 0x%02X\n", regs[R_E]);
-                printf("H = 0x%02X\n", regs[R_H]);
-                printf("L = 0x%02X\n", regs[R_L]);
+                printf("PC = 0x%04X\n", cpu->PC);
+                printf("SP = 0x%04X\n", cpu->SP);
+                printf("A = 0x%02X\n", cpu->regs[R_A]);
+                printf("B = 0x%02X\n", cpu->regs[R_B]);
+                printf("C = 0x%02X\n", cpu->regs[R_C]);
+                printf("D = 0x%02X\n", cpu->regs[R_D]);
+                printf("E = 0x%02X\n", cpu->regs[R_E]);
+                printf("H = 0x%02X\n", cpu->regs[R_H]);
+                printf("L = 0x%02X\n", cpu->regs[R_L]);
                 break;
             }
 
@@ -216,49 +289,49 @@ int d_info (char **argv)
             {
                 case 'A':
                 case 'a':
-                    printf("A = 0x%02X\n", regs[R_A]);
+                    printf("A = 0x%02X\n", cpu->regs[R_A]);
                     break;
 
                 case 'B':
                 case 'b':
-                    printf("B = 0x%02X\n", regs[R_B]);
+                    printf("B = 0x%02X\n", cpu->regs[R_B]);
                     break;
 
                 case 'C':
                 case 'c':
-                    printf("C = 0x%02X\n", regs[R_C]);
+                    printf("C = 0x%02X\n", cpu->regs[R_C]);
                     break;
 
                 case 'D':
                 case 'd':
-                    printf("D = 0x%02X\n", regs[R_D]);
+                    printf("D = 0x%02X\n", cpu->regs[R_D]);
                     break;
                 
                 case 'E':
                 case 'e':
-                    printf("E = 0x%02X\n", regs[R_E]);
+                    printf("E = 0x%02X\n", cpu->regs[R_E]);
                     break;
 
                 case 'H':
                 case 'h':
-                    printf("H = 0x%02X\n", regs[R_H]);
+                    printf("H = 0x%02X\n", cpu->regs[R_H]);
                     break;
 
                 case 'L':
                 case 'l':
-                    printf("L = 0x%02X\n", regs[R_L]);
+                    printf("L = 0x%02X\n", cpu->regs[R_L]);
                     break;
 
                 default:
                     if (strcmp(argv[2], "pc") == 0 || strcmp(argv[2], "PC") == 0)
                     {
-                        printf("PC = 0x%04X\n", PC);
+                        printf("PC = 0x%04X\n", cpu->PC);
                         break;
                     }
 
                     if (strcmp(argv[2], "SP") == 0 || strcmp(argv[2], "sp") == 0)
                     {
-                        printf("SP = 0x%04X\n", SP);
+                        printf("SP = 0x%04X\n", cpu->SP);
                         break;
                     }
 
@@ -272,26 +345,26 @@ int d_info (char **argv)
         case 'f':
             if (argv[2] == NULL)
             {
-                printf("CY: %d\n", flags & FL_CY);
-                printf("P:  %d\n", (flags & FL_P) >> 2);
-                printf("AC: %d\n", (flags & FL_AC) >> 4);
-                printf("Z:  %d\n", (flags & FL_Z) >> 6);
-                printf("S:  %d\n", (flags & FL_S) >> 7);
+                printf("CY: %d\n", cpu->flags & FL_CY);
+                printf("P:  %d\n", (cpu->flags & FL_P) >> 2);
+                printf("AC: %d\n", (cpu->flags & FL_AC) >> 4);
+                printf("Z:  %d\n", (cpu->flags & FL_Z) >> 6);
+                printf("S:  %d\n", (cpu->flags & FL_S) >> 7);
                 break;
             }
 
             uint8_t val;
 
             if (strcmp(argv[2], "CY") == 0 || strcmp(argv[2], "cy") == 0)
-                val = flags & FL_CY;
+                val = cpu->flags & FL_CY;
             else if (strcmp(argv[2], "P") == 0 || strcmp(argv[2], "p") == 0)
-                val = (flags & FL_P) >> 2;
+                val = (cpu->flags & FL_P) >> 2;
             else if (strcmp(argv[2], "AC") == 0 || strcmp(argv[2], "ac") == 0)
-                val = (flags & FL_AC) >> 4;
+                val = (cpu->flags & FL_AC) >> 4;
             else if (strcmp(argv[2], "Z") == 0 || strcmp(argv[2], "z") == 0)
-                val = (flags & FL_Z) >> 6;
+                val = (cpu->flags & FL_Z) >> 6;
             else if (strcmp(argv[2], "S") == 0 || strcmp(argv[2], "s") == 0)
-                val = (flags & FL_S) >> 7;
+                val = (cpu->flags & FL_S) >> 7;
             else
             {
                 fprintf(stderr, "Error: invalid flag\n");
@@ -303,8 +376,37 @@ int d_info (char **argv)
 
         // address
         case 'a':
-            uint16_t addr = (uint16_t)strtol(argv[2], NULL, 16);
-            printf("Address 0x%04X: 0x%02X\n", addr, memory[addr]);
+            if (argv[2] == NULL)
+            {
+                fprintf(stderr, "Error: missing address\n");
+                break;
+            }
+
+            // [bank:]address
+            char *end;
+            int bank = -1;
+            uint16_t addr = (uint16_t)strtol(argv[2], &end, 16);
+
+            if (*end == ':')
+            {
+                bank = addr;
+                addr = (uint16_t)strtol(end + 1, NULL, 16);
+
+                if (bank_of(addr) < 0 || bank >= bank_count)
+                {
+                    fprintf(stderr, "Error: address 0x%04X isn't banked or bank doesn't exist\n", addr);
+                    break;
+                }
+
+                printf("Address 0x%04X (bank %d): 0x%02X\n", addr, bank, bank_peek(bank, addr));
+                break;
+            }
+
+            bank = bank_of(addr);
+            if (bank >= 0)
+                printf("Address 0x%04X (bank %d): 0x%02X\n", addr, bank, mem_peek(addr));
+            else
+                printf("Address 0x%04X: 0x%02X\n", addr, mem_peek(addr));
             break;
 
         default:
@@ -315,24 +417,32 @@ int d_info (char **argv)
     return 1;
 }
 
-int d_set(char **argv)
+static uint16_t set_addr;
+static uint8_t set_val;
+
+static void set_mem(void)
 {
-    uint16_t addr;
-    uint8_t val;
+    mem_poke(set_addr, set_val);
+}
 
+int d_set(char **argv)
+{
     if (argv[1] == NULL || argv[2] == NULL)
     {
         fprintf(stderr, "Error: missing argument for set\n");
         return 1;
     }
 
-    addr = (uint16_t)strtol(argv[1], NULL, 16);
-    val = (uint8_t)strtol(argv[2], NULL, 16);
+    set_addr = (uint16_t)strtol(argv[1], NULL, 16);
+    set_val = (uint8_t)strtol(argv[2], NULL, 16);
 
-    // lock mutex to change value
-    pthread_mutex_lock(&debug_mutex);
-    memory[addr] = val;
-    pthread_mutex_unlock(&debug_mutex);
+    // script commands already run on the CPU thread
+    if (script_loaded)
+        set_mem();
+    else if (!ctl_enabled)
+        fprintf(stderr, "Error: set isn't available with more than one CPU or with -r/-y\n");
+    else
+        ctl_call(&set_mem);
 
     return 1;
 }
@@ -352,13 +462,115 @@ int d_step(char **argv)
     return 1;
 }
 
+// the run control commands need a single CPU without replay
+static int ctl_check(void)
+{
+    if (!ctl_enabled)
+    {
+        fprintf(stderr, "Error: run control isn't available with more than one CPU or with -r/-y\n");
+        return 0;
+    }
+
+    if (ctl_state(NULL) == CTL_DONE)
+    {
+        printf("The program has ended\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+static void print_pc(const char *what)
+{
+    const char *name = name_table[mem_peek(cpu->PC)];
+
+    printf("%s at 0x%04X: %s\n", what, cpu->PC, name ? name : "undefined");
+}
+
+int d_pause(char **argv)
+{
+    (void)argv;
+
+    if (!ctl_check())
+        return 1;
+
+    ctl_pause(1);
+    print_pc("Paused");
+    return 1;
+}
+
+int d_resume(char **argv)
+{
+    (void)argv;
+
+    if (ctl_check())
+        ctl_resume(NULL);
+
+    return 1;
+}
+
+int d_stepi(char **argv)
+{
+    long count = 1;
+
+    if (argv[1] != NULL && (count = strtol(argv[1], NULL, 0)) <= 0)
+    {
+        fprintf(stderr, "Error: invalid instruction count\n");
+        return 1;
+    }
+
+    if (!ctl_check())
+        return 1;
+
+    // a running program is paused first
+    ctl_pause(1);
+    ctl_step(count, 1, NULL);
+
+    if (ctl_state(NULL) == CTL_DONE)
+        printf("The program has ended\n");
+    else
+        print_pc("Stopped");
+    return 1;
+}
+
+int d_until(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        fprintf(stderr, "Error: missing address\n");
+        return 1;
+    }
+
+    if (ctl_check())
+        ctl_until((uint16_t)strtol(argv[1], NULL, 16));
+
+    return 1;
+}
+
+int d_finish(char **argv)
+{
+    (void)argv;
+
+    if (!ctl_check())
+        return 1;
+
+    ctl_pause(1);
+    ctl_finish();
+    return 1;
+}
+
+// the CPU threads clear running themselves at their next look at the requests
 int d_exit(char **argv)
 {
-    // lock mutex to change value
-    pthread_mutex_lock(&debug_mutex);
-    running = 0;
-    pthread_mutex_unlock(&debug_mutex);
-    
+    (void)argv;
+
+    // script commands already run on the CPU thread
+    if (script_loaded)
+        cpu->running = 0;
+
+    smp_stop();
+    rr_stop();
+    ctl_stop();
     return 0;
 }
 
@@ -366,9 +578,16 @@ char *cmd_names[] =
 {
     "help",
     "dump",
+    "stats",
+    "heatmap",
     "info",
     "set",
     "step",
+    "pause",
+    "resume",
+    "stepi",
+    "until",
+    "finish",
     "exit"
 };
 
@@ -376,8 +595,15 @@ int (*cmd_funcs[]) (char **) =
 {
     &d_help,
     &d_dump,
+    &d_stats,
+    &d_heatmap,
     &d_info,
     &d_set,
     &d_step,
+    &d_pause,
+    &d_resume,
+    &d_stepi,
+    &d_until,
+    &d_finish,
     &d_exit
 };
\ No newline at end of file
@@ -4,18 +4,26 @@
 #include "cpu.h"
 #include <stdint.h>
 
+#define NUM_CMDS 13
+
 extern int step_sec;
 extern char* cmd_names[];
 extern int (*cmd_funcs[]) (char **);
-extern uint8_t running;
-extern uint16_t PC, SP;
 
 void *debugger_loop(void *argv);
+int exec_cmd(char **argv);
 int d_help (char **argv);
 int d_dump(char **argv);
+int d_stats(char **argv);
+int d_heatmap(char **argv);
 int d_info(char **argv);
 int d_set(char **argv);
 int d_step(char **argv);
+int d_pause(char **argv);
+int d_resume(char **argv);
+int d_stepi(char **argv);
+int d_until(char **argv);
+int d_finish(char **argv);
 int d_exit(char **argv);
 
 #endif /* DEBUG_H_ */
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+
+#include "display.h"
+#include "mem.h"
+
+/*
+ * display bound to a range of memory. A guest write stores the byte and
+ * marks its cell dirty, nothing else; the renderer thread redraws the
+ * dirty cells DISPLAY_HZ times a second, in one write to the terminal.
+ * The display is drawn in a frame at the top of the terminal and the
+ * console scrolls in the lines below it.
+ */
+
+static uint16_t disp_start;
+static int disp_size;
+static int disp_columns;
+static int disp_mode;
+static int disp_rows;               // terminal lines taken by the frame
+
+static atomic_uchar *cells;
+static atomic_uchar *dirty;
+static atomic_int pending = 0;      // something is dirty
+static atomic_int quit = 0;
+static int started = 0;
+
+static pthread_t render_thread;
+static char *frame;
+
+// seven-segment patterns and the characters they show
+static const struct
+{
+    uint8_t pattern;
+    char c;
+} seg_glyphs[] =
+{
+    { 0x3F, '0' }, { 0x06, '1' }, { 0x5B, '2' }, { 0x4F, '3' }, { 0x66, '4' }, { 0x6D, '5' },
+    { 0x7D, '6' }, { 0x07, '7' }, { 0x7F, '8' }, { 0x6F, '9' }, { 0x77, 'A' }, { 0x7C, 'b' },
+    { 0x39, 'C' }, { 0x5E, 'd' }, { 0x79, 'E' }, { 0x71, 'F' }, { 0x76, 'H' }, { 0x38, 'L' },
+    { 0x73, 'P' }, { 0x3E, 'U' }, { 0x40, '-' }, { 0x08, '_' }, { 0x00, ' ' }
+};
+
+static void display_write(uint16_t addr, uint8_t val)
+{
+    int i = addr - disp_start;
+
+    mem_poke(addr, val);
+    atomic_store_explicit(&cells[i], val, memory_order_relaxed);
+    atomic_store_explicit(&dirty[i], 1, memory_order_release);
+    atomic_store_explicit(&pending, 1, memory_order_relaxed);
+}
+
+static int cell_width(void)
+{
+    return disp_mode == DISPLAY_SEG ? 2 : 1;
+}
+
+static char *glyph(char *p, uint8_t val)
+{
+    if (disp_mode == DISPLAY_TEXT)
+    {
+        *p++ = (val >= 0x20 && val < 0x7F) ? val : ' ';
+        return p;
+    }
+
+    *p = '?';
+    for (size_t i = 0; i < sizeof(seg_glyphs) / sizeof(seg_glyphs[0]); ++i)
+        if (seg_glyphs[i].pattern == (val & 0x7F))
+            *p = seg_glyphs[i].c;
+
+    p[1] = (val & 0x80) ? '.' : ' ';
+    return p + 2;
+}
+
+// draw the dirty cells and leave the cursor where the console had it
+static void render(void)
+{
+    char *p = frame;
+    int next = -1;      // cell the terminal cursor is on
+
+    if (!atomic_exchange_explicit(&pending, 0, memory_order_acquire))
+        return;
+
+    p += sprintf(p, "\0337");
+
+    for (int i = 0; i < disp_size; ++i)
+    {
+        if (!atomic_load_explicit(&dirty[i], memory_order_relaxed))
+            continue;
+
+        atomic_store_explicit(&dirty[i], 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+
+        if (i != next || i % disp_columns == 0)
+            p += sprintf(p, "\033[%d;%dH", 2 + i / disp_columns, 2 + i % disp_columns * cell_width());
+
+        p = glyph(p, atomic_load_explicit(&cells[i], memory_order_relaxed));
+        next = i + 1;
+    }
+
+    p += sprintf(p, "\0338");
+
+    if (write(STDOUT_FILENO, frame, p - frame) < 0)
+        return;
+}
+
+static void *render_loop(void *arg)
+{
+    struct timespec next;
+
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!atomic_load_explicit(&quit, memory_order_relaxed))
+    {
+        next.tv_nsec += 1000000000 / DISPLAY_HZ;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        render();
+    }
+
+    return NULL;
+}
+
+// give the whole terminal back to the console, also on exit()
+static void restore_terminal(void)
+{
+    if (started)
+        printf("\0337\033[r\0338");
+    fflush(stdout);
+    started = 0;
+}
+
+/*
+ * bind the display to [start, end], columns cells per line, and start the
+ * renderer. Needs stdout to be a terminal with room for the frame and a few
+ * lines of console below it.
+ */
+int display_start(uint16_t start, uint16_t end, int columns, int mode)
+{
+    struct winsize ws;
+    char *p;
+    int width;
+
+    if (!isatty(STDOUT_FILENO) || ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0)
+    {
+        fprintf(stderr, "Error: the display needs a terminal\n");
+        return -1;
+    }
+
+    disp_start = start;
+    disp_size = end - start + 1;
+    disp_columns = columns;
+    disp_mode = mode;
+    disp_rows = (disp_size + columns - 1) / columns + 2;
+    width = columns * cell_width() + 2;
+
+    if (disp_rows + 4 > ws.ws_row || width > ws.ws_col)
+    {
+        fprintf(stderr, "Error: a %dx%d display doesn't fit in the terminal\n", width, disp_rows);
+        return -1;
+    }
+
+    cells = calloc(disp_size, sizeof(*cells));
+    dirty = calloc(disp_size, sizeof(*dirty));
+    frame = malloc((size_t)disp_size * 16 + (size_t)disp_rows * 24 + width * 2 + 64);
+    if (cells == NULL || dirty == NULL || frame == NULL)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return -1;
+    }
+
+    if (mem_map_device(start, end, NULL, &display_write) < 0)
+        return -1;
+
+    // clear the screen, draw the empty frame and keep the console below it
+    p = frame;
+    p += sprintf(p, "\033[2J\033[1;1H+");
+    for (int i = 0; i < width - 2; ++i)
+        *p++ = '-';
+    p += sprintf(p, "+");
+
+    for (int r = 2; r < disp_rows; ++r)
+        p += sprintf(p, "\033[%d;1H|\033[%d;%dH|", r, r, width);
+
+    p += sprintf(p, "\033[%d;1H+", disp_rows);
+    for (int i = 0; i < width - 2; ++i)
+        *p++ = '-';
+    p += sprintf(p, "+\033[%d;%dr\033[%d;1H", disp_rows + 2, ws.ws_row, disp_rows + 2);
+
+    fflush(stdout);
+    if (write(STDOUT_FILENO, frame, p - frame) < 0)
+        return -1;
+
+    started = 1;
+    atexit(&restore_terminal);
+
+    if (pthread_create(&render_thread, NULL, &render_loop, NULL) != 0)
+    {
+        fprintf(stderr, "Error: cannot start the display renderer\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// draw the last frame and stop the renderer
+void display_stop(void)
+{
+    if (!started)
+        return;
+
+    atomic_store_explicit(&quit, 1, memory_order_relaxed);
+    pthread_join(render_thread, NULL);
+    render();
+    restore_terminal();
+}
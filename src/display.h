@@ -0,0 +1,19 @@
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+#include <stdint.h>
+
+#define DISPLAY_HZ 60                   // terminal refreshes per second
+#define DISPLAY_DEFAULT_COLUMNS 16
+
+// how a display byte is drawn
+enum
+{
+    DISPLAY_TEXT = 0,   // LCD character, ASCII
+    DISPLAY_SEG         // seven-segment digit, bits 0-6 segments a-g, bit 7 decimal point
+};
+
+int display_start(uint16_t start, uint16_t end, int columns, int mode);
+void display_stop(void);
+
+#endif /* DISPLAY_H_ */
@@ -0,0 +1,658 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "gdb.h"
+#include "cpu.h"
+#include "mem.h"
+#include "ctl.h"
+
+/*
+ * GDB remote serial protocol stub on top of run control (ctl.c): reads
+ * and writes of registers and memory are run by the CPU thread between
+ * two slices, so they see the state at an instruction boundary without
+ * stopping the program. Only interrupt, breakpoints and stepping stop it.
+ * Registers follow the z80 layout of GDB, which covers the 8080.
+ */
+
+#define GDB_REGS 13             // af bc de hl sp pc ix iy af' bc' de' hl' ir
+#define GDB_MAX_MEM ((GDB_PACKET_SIZE - 8) / 2)
+
+// arguments of the calls on the CPU thread, only the stub thread sets them
+static uint16_t req_addr;
+static uint32_t req_len;
+static uint8_t req_buf[GDB_MAX_MEM];
+static uint8_t req_regs[GDB_REGS * 2];
+
+static int listen_fd = -1;
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<architecture>z80</architecture>"
+    "<feature name=\"org.gnu.gdb.z80.cpu\">"
+    "<reg name=\"af\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"bc\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"de\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"hl\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"sp\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "<reg name=\"ix\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"iy\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"af'\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"bc'\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"de'\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"hl'\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"ir\" bitsize=\"16\" type=\"int\"/>"
+    "</feature>"
+    "</target>";
+
+/* requests, run by the CPU thread between slices */
+
+static void read_regs(void)
+{
+    memset(req_regs, 0, sizeof(req_regs));
+    req_regs[0] = cpu->flags;
+    req_regs[1] = cpu->regs[R_A];
+    req_regs[2] = cpu->regs[R_C];
+    req_regs[3] = cpu->regs[R_B];
+    req_regs[4] = cpu->regs[R_E];
+    req_regs[5] = cpu->regs[R_D];
+    req_regs[6] = cpu->regs[R_L];
+    req_regs[7] = cpu->regs[R_H];
+    req_regs[8] = cpu->SP & 0xFF;
+    req_regs[9] = cpu->SP >> 8;
+    req_regs[10] = cpu->PC & 0xFF;
+    req_regs[11] = cpu->PC >> 8;
+}
+
+static void write_regs(void)
+{
+    cpu->flags = req_regs[0];
+    cpu->regs[R_A] = req_regs[1];
+    cpu->regs[R_C] = req_regs[2];
+    cpu->regs[R_B] = req_regs[3];
+    cpu->regs[R_E] = req_regs[4];
+    cpu->regs[R_D] = req_regs[5];
+    cpu->regs[R_L] = req_regs[6];
+    cpu->regs[R_H] = req_regs[7];
+    cpu->SP = req_regs[8] | (req_regs[9] << 8);
+    cpu->PC = req_regs[10] | (req_regs[11] << 8);
+}
+
+// memory as the program sees it, without triggering devices
+static void read_mem(void)
+{
+    for (uint32_t i = 0; i < req_len; ++i)
+        req_buf[i] = mem_peek(req_addr + i);
+}
+
+static void write_mem(void)
+{
+    for (uint32_t i = 0; i < req_len; ++i)
+        mem_poke(req_addr + i, req_buf[i]);
+}
+
+/* the stub thread */
+
+static int hex(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+static void to_hex(char *out, const uint8_t *buf, uint32_t len)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        out[2 * i] = digits[buf[i] >> 4];
+        out[2 * i + 1] = digits[buf[i] & 0xF];
+    }
+
+    out[2 * len] = '\0';
+}
+
+static int from_hex(uint8_t *buf, const char *in, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        int hi = hex(in[2 * i]), lo = hex(in[2 * i + 1]);
+
+        if (hi < 0 || lo < 0)
+            return -1;
+
+        buf[i] = (hi << 4) | lo;
+    }
+
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+// $data#cs, or %data#cs for a notification
+static int send_packet(int fd, char start, const char *data)
+{
+    static char out[GDB_PACKET_SIZE + 8];
+    size_t len = strlen(data);
+    uint8_t sum = 0;
+
+    for (size_t i = 0; i < len; ++i)
+        sum += (uint8_t)data[i];
+
+    out[0] = start;
+    memcpy(out + 1, data, len);
+    snprintf(out + 1 + len, 4, "#%02x", sum);
+
+    return write_all(fd, out, len + 4);
+}
+
+// everything a debugger connection changed goes away with it
+static void detach(void)
+{
+    ctl_clear_breaks();
+    if (ctl_state(NULL) != CTL_RUNNING)
+        ctl_resume(NULL);
+}
+
+struct session
+{
+    int fd;
+    int noack;
+    int nonstop;
+    int waiting;        // all-stop: a continue or step waits for its stop reply
+    int quiet;          // the pause was a vCont;t, reported as signal 0
+    uint32_t seen;      // number of the last stop the debugger knows about
+};
+
+static void stop_reply(struct session *s, const struct ctl_stop *stop, char *out)
+{
+    switch (stop->reason)
+    {
+        case CTL_STOP_PAUSE:
+            strcpy(out, s->quiet ? "T00thread:1;" : "T02thread:1;");
+            break;
+
+        case CTL_STOP_END:
+            // the program is over, registers and memory can still be read
+            if (stop->result == RUN_UNDEF)
+                strcpy(out, "T04thread:1;");
+            else if (stop->result == RUN_FAULT)
+                strcpy(out, "T0bthread:1;");
+            else
+                strcpy(out, "W00");
+            break;
+
+        default:
+            strcpy(out, "T05thread:1;");
+            break;
+    }
+
+    s->quiet = 0;
+}
+
+// continue or step, the reply is the last stop if the program is over
+static int go_on(struct session *s, int step, char *reply)
+{
+    struct ctl_stop stop;
+    int ret = step ? ctl_step(1, 0, &s->seen) : ctl_resume(&s->seen);
+
+    if (ret < 0)
+    {
+        ctl_state(&stop);
+        stop_reply(s, &stop, reply);
+        s->seen = stop.seq;
+    }
+
+    return ret;
+}
+
+/*
+ * handle one packet, writing the reply into reply. Returns 0 to send it,
+ * 1 for no reply (it comes with the stop), -1 to end the session
+ */
+static int handle(struct session *s, char *pkt, char *reply)
+{
+    unsigned int addr, len;
+    char *p;
+
+    reply[0] = '\0';
+
+    switch (pkt[0])
+    {
+        case '?':
+        {
+            struct ctl_stop stop;
+            int state = ctl_state(&stop);
+
+            if (state == CTL_PAUSED || state == CTL_DONE)
+                stop_reply(s, &stop, reply);
+            else
+                strcpy(reply, s->nonstop ? "OK" : "S00");
+            s->seen = stop.seq;
+            return 0;
+        }
+
+        case 'g':
+            ctl_call(&read_regs);
+            to_hex(reply, req_regs, sizeof(req_regs));
+            return 0;
+
+        case 'G':
+            if (strlen(pkt + 1) < 24)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            ctl_call(&read_regs);
+            if (from_hex(req_regs, pkt + 1, 12) < 0)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            ctl_call(&write_regs);
+            strcpy(reply, "OK");
+            return 0;
+
+        case 'p':
+            addr = strtoul(pkt + 1, NULL, 16);
+            if (addr >= GDB_REGS)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            ctl_call(&read_regs);
+            to_hex(reply, &req_regs[2 * addr], 2);
+            return 0;
+
+        case 'P':
+            addr = strtoul(pkt + 1, &p, 16);
+            if (addr >= GDB_REGS || *p != '=' || strlen(p + 1) < 4)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            ctl_call(&read_regs);
+            if (from_hex(&req_regs[2 * addr], p + 1, 2) < 0)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            ctl_call(&write_regs);
+            strcpy(reply, "OK");
+            return 0;
+
+        case 'm':
+            if (sscanf(pkt + 1, "%x,%x", &addr, &len) != 2 || addr >= MEMORY_MAX)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            // gdb asks again for whatever is left
+            if (len > GDB_MAX_MEM)
+                len = GDB_MAX_MEM;
+            if (addr + len > MEMORY_MAX)
+                len = MEMORY_MAX - addr;
+
+            req_addr = addr;
+            req_len = len;
+            ctl_call(&read_mem);
+            to_hex(reply, req_buf, len);
+            return 0;
+
+        case 'M':
+            if (sscanf(pkt + 1, "%x,%x:", &addr, &len) != 2 || (p = strchr(pkt, ':')) == NULL
+                || len > GDB_MAX_MEM || addr + len > MEMORY_MAX || strlen(p + 1) < 2 * len)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            if (from_hex(req_buf, p + 1, len) < 0)
+            {
+                strcpy(reply, "E01");
+                return 0;
+            }
+
+            req_addr = addr;
+            req_len = len;
+            ctl_call(&write_mem);
+            strcpy(reply, "OK");
+            return 0;
+
+        case 'Z':
+        case 'z':
+            // software and hardware breakpoints are the same thing here
+            if ((pkt[1] != '0' && pkt[1] != '1') || sscanf(pkt + 2, ",%x", &addr) != 1 || addr >= MEMORY_MAX)
+                return 0;
+
+            ctl_break(addr, pkt[0] == 'Z');
+            strcpy(reply, "OK");
+            return 0;
+
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+            if (go_on(s, tolower(pkt[0]) == 's', reply) < 0)
+                return 0;
+
+            s->waiting = 1;
+            return 1;
+
+        case 'D':
+            detach();
+            strcpy(reply, "OK");
+            send_packet(s->fd, '$', reply);
+            return -1;
+
+        case 'k':
+            ctl_stop();
+            return -1;
+
+        case 'H':
+        case 'T':
+            strcpy(reply, "OK");
+            return 0;
+
+        case 'q':
+            if (strncmp(pkt, "qSupported", 10) == 0)
+                sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+;QNonStop+;vContSupported+", GDB_PACKET_SIZE);
+            else if (strcmp(pkt, "qAttached") == 0)
+                strcpy(reply, "1");
+            else if (strcmp(pkt, "qC") == 0)
+                strcpy(reply, "QC1");
+            else if (strcmp(pkt, "qfThreadInfo") == 0)
+                strcpy(reply, "m1");
+            else if (strcmp(pkt, "qsThreadInfo") == 0)
+                strcpy(reply, "l");
+            else if (sscanf(pkt, "qXfer:features:read:target.xml:%x,%x", &addr, &len) == 2)
+            {
+                size_t total = sizeof(target_xml) - 1;
+
+                if (addr >= total)
+                    strcpy(reply, "l");
+                else
+                {
+                    if (len > GDB_PACKET_SIZE - 8)
+                        len = GDB_PACKET_SIZE - 8;
+                    reply[0] = addr + len >= total ? 'l' : 'm';
+                    snprintf(reply + 1, len + 1, "%s", target_xml + addr);
+                }
+            }
+            return 0;
+
+        case 'Q':
+            if (strcmp(pkt, "QStartNoAckMode") == 0)
+            {
+                send_packet(s->fd, '$', "OK");
+                s->noack = 1;
+                return 1;
+            }
+
+            if (strncmp(pkt, "QNonStop:", 9) == 0)
+            {
+                s->nonstop = pkt[9] == '1';
+                strcpy(reply, "OK");
+            }
+            return 0;
+
+        case 'v':
+            if (strcmp(pkt, "vCont?") == 0)
+                strcpy(reply, "vCont;c;C;s;S;t");
+            else if (strcmp(pkt, "vStopped") == 0)
+                strcpy(reply, "OK");
+            else if (strncmp(pkt, "vCont;", 6) == 0)
+            {
+                int action = pkt[6];
+
+                if (action == 't')
+                {
+                    if (ctl_state(NULL) == CTL_RUNNING)
+                    {
+                        s->quiet = 1;
+                        ctl_pause(0);
+                    }
+                }
+                else if (go_on(s, action == 's' || action == 'S', reply) < 0)
+                    return 0;
+
+                if (s->nonstop)
+                {
+                    strcpy(reply, "OK");
+                    return 0;
+                }
+
+                s->waiting = action != 't';
+                return 1;
+            }
+            return 0;
+    }
+
+    return 0;
+}
+
+static void serve(int fd)
+{
+    static char pkt[GDB_PACKET_SIZE + 1], reply[GDB_PACKET_SIZE + 1];
+    struct session s = { fd, 0, 0, 0, 0, 0 };
+    struct ctl_stop stop;
+    int len = -1;           // -1 outside of a packet
+    int sum_digits = 0;
+
+    ctl_state(&stop);
+    s.seen = stop.seq;
+
+    while (1)
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        char buf[4096];
+        ssize_t n = 0;
+
+        if (poll(&pfd, 1, GDB_POLL_MS) > 0)
+        {
+            n = read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+        }
+
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            char c = buf[i];
+
+            if (len < 0)
+            {
+                if (c == '$')
+                    len = sum_digits = 0;
+                else if (c == 0x03)
+                {
+                    // interrupt from the debugger
+                    if (ctl_state(NULL) == CTL_RUNNING)
+                        ctl_pause(0);
+                }
+                continue;
+            }
+
+            if (sum_digits == 0 && c != '#')
+            {
+                if (len < GDB_PACKET_SIZE)
+                    pkt[len++] = c;
+                continue;
+            }
+
+            // the checksum isn't checked, the stream is reliable
+            if (++sum_digits < 3)
+                continue;
+
+            pkt[len] = '\0';
+            len = -1;
+
+            if (!s.noack)
+                write_all(fd, "+", 1);
+
+            switch (handle(&s, pkt, reply))
+            {
+                case 0:
+                    send_packet(fd, '$', reply);
+                    break;
+
+                case -1:
+                    if (pkt[0] != 'D')
+                        detach();
+                    return;
+            }
+        }
+
+        // report a stop the debugger waits for, or tell a non-stop debugger about it
+        ctl_state(&stop);
+        if (stop.seq != s.seen && (s.waiting || s.nonstop))
+        {
+            if (s.nonstop)
+            {
+                strcpy(reply, "Stop:");
+                stop_reply(&s, &stop, reply + 5);
+                send_packet(fd, '%', reply);
+            }
+            else
+            {
+                stop_reply(&s, &stop, reply);
+                send_packet(fd, '$', reply);
+            }
+
+            s.seen = stop.seq;
+            s.waiting = 0;
+        }
+    }
+
+    detach();
+}
+
+static void *gdb_loop(void *arg)
+{
+    (void)arg;
+
+    while (1)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return NULL;
+        }
+
+        serve(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/*
+ * listen for GDB on a TCP port of localhost (where is a number) or on a
+ * Unix socket (where is a path), the program runs until told otherwise
+ */
+int gdb_start(const char *where)
+{
+    pthread_t thread;
+    char *end;
+    long port = strtol(where, &end, 10);
+
+    if (*where != '\0' && *end == '\0')
+    {
+        struct sockaddr_in addr;
+        int one = 1;
+
+        if (port <= 0 || port > 65535)
+        {
+            fprintf(stderr, "Error: bad port %s\n", where);
+            return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd >= 0)
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bind");
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_un addr;
+
+        if (strlen(where) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Error: socket path too long\n");
+            return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, where);
+        unlink(where);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bind");
+            return -1;
+        }
+    }
+
+    if (listen(listen_fd, 1) < 0 || pthread_create(&thread, NULL, &gdb_loop, NULL) != 0)
+    {
+        perror("listen");
+        return -1;
+    }
+
+    pthread_detach(thread);
+    return 0;
+}
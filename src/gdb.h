@@ -0,0 +1,9 @@
+#ifndef GDB_H_
+#define GDB_H_
+
+#define GDB_PACKET_SIZE 16384
+#define GDB_POLL_MS 20
+
+int gdb_start(const char *where);
+
+#endif /* GDB_H_ */
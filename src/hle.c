@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hle.h"
+#include "opcodes.h"
+#include "cpu.h"
+#include "mem.h"
+#include "io.h"
+
+#define MAX_LINE_SIZE 256
+#define MAX_DIFF_REPORT 8
+#define GUEST_MAX_CYCLES 10000000       // T-states a verified guest routine gets to return
+
+struct hle_hook hle_hooks[HLE_MAX_HOOKS];
+int hle_count = 0;
+
+// hooked address -> hook slot + 1, 0 if none
+uint8_t hle_index[MEMORY_MAX];
+uint8_t hle_verify = 0;
+
+// CPU state captured around a hooked call in verification mode
+struct hle_state
+{
+    uint8_t regs[R_COUNT];
+    uint8_t flags;
+    uint16_t PC;
+    uint16_t SP;
+    uint64_t cycles;
+    uint8_t bank;
+    struct io_stream io;            // input read, output written so far and port latches
+    struct cpu_stats stats;
+    uint8_t mem[MEMORY_MAX];
+};
+
+static void set_or_flags(void)
+{
+    // flags left by "ORA" on a zero accumulator
+    cpu->flags = (cpu->flags & ~(FL_CY | FL_S | FL_AC)) | FL_Z | FL_P;
+}
+
+// HL <- D * E
+static uint32_t hle_mul8(void)
+{
+    uint16_t res = cpu->regs[R_D] * cpu->regs[R_E];
+
+    cpu->regs[R_H] = (res >> 8) & 0xFF;
+    cpu->regs[R_L] = res & 0xFF;
+    return 330;
+}
+
+// HL <- BC * DE (low 16 bits)
+static uint32_t hle_mul16(void)
+{
+    uint16_t res = get_rp(RP_BC) * get_rp(RP_DE);
+
+    set_rp(RP_HL, res);
+    return 1100;
+}
+
+// B <- B / C, C <- B % C
+static uint32_t hle_div8(void)
+{
+    uint8_t num = cpu->regs[R_B];
+    uint8_t den = cpu->regs[R_C];
+
+    cpu->regs[R_B] = den ? num / den : 0xFF;
+    cpu->regs[R_C] = den ? num % den : num;
+    return 420;
+}
+
+// HL <- HL / DE, DE <- HL % DE
+static uint32_t hle_div16(void)
+{
+    uint16_t num = get_rp(RP_HL);
+    uint16_t den = get_rp(RP_DE);
+
+    set_rp(RP_HL, den ? num / den : 0xFFFF);
+    set_rp(RP_DE, den ? num % den : num);
+    return 1400;
+}
+
+// A <- packed BCD of A (0-99)
+static uint32_t hle_bin2bcd(void)
+{
+    uint8_t val = cpu->regs[R_A] % 100;
+
+    cpu->regs[R_A] = ((val / 10) << 4) | (val % 10);
+    return 120;
+}
+
+// A <- binary value of packed BCD in A
+static uint32_t hle_bcd2bin(void)
+{
+    cpu->regs[R_A] = (cpu->regs[R_A] >> 4) * 10 + (cpu->regs[R_A] & 0x0F);
+    return 60;
+}
+
+/*
+ * MOV A,M / ORA A / RZ / STA 3000H / INX H / JMP loop:
+ * writes the zero-terminated string at (HL) to the output cell
+ */
+static uint32_t hle_print(void)
+{
+    uint16_t addr = get_rp(RP_HL);
+    uint32_t t = 0;
+
+    while (mem_read(addr) != 0)
+    {
+        mem_write(0x3000, mem_read(addr++));
+        t += 46;
+    }
+
+    set_rp(RP_HL, addr);
+    cpu->regs[R_A] = 0;
+    set_or_flags();
+    return t + 23;
+}
+
+// DCX B / MOV A,C / ORA B / JNZ loop / RET: BC iterations (0 = 65536)
+static uint32_t hle_delay(void)
+{
+    uint32_t n = get_rp(RP_BC);
+
+    if (n == 0)
+        n = 0x10000;
+
+    set_rp(RP_BC, 0);
+    cpu->regs[R_A] = 0;
+    set_or_flags();
+    return 24 * n - 3 + 10;
+}
+
+static const struct
+{
+    const char *name;
+    HleFunc func;
+}
+hle_builtins[] =
+{
+    { "mul8", &hle_mul8 },
+    { "mul16", &hle_mul16 },
+    { "div8", &hle_div8 },
+    { "div16", &hle_div16 },
+    { "bin2bcd", &hle_bin2bcd },
+    { "bcd2bin", &hle_bcd2bin },
+    { "print", &hle_print },
+    { "delay", &hle_delay }
+};
+
+#define NUM_BUILTINS (int)(sizeof(hle_builtins) / sizeof(hle_builtins[0]))
+
+int hle_load(const char *path)
+{
+    char line[MAX_LINE_SIZE], name[MAX_LINE_SIZE];
+    unsigned int addr;
+    unsigned long hook_cycles;
+    int line_no = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open hook file %s\n", path);
+        return -1;
+    }
+
+    // each line: <address> <routine> [cycles]
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        int fields, i;
+
+        line_no++;
+        if (line[strspn(line, " \t\r\n")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+
+        hook_cycles = 0;
+        fields = sscanf(line, "%x %255s %lu", &addr, name, &hook_cycles);
+        if (fields < 2 || addr >= MEMORY_MAX)
+        {
+            fprintf(stderr, "Error: %s:%d: expected <address> <routine> [cycles]\n", path, line_no);
+            fclose(f);
+            return -1;
+        }
+
+        for (i = 0; i < NUM_BUILTINS; ++i)
+            if (strcmp(name, hle_builtins[i].name) == 0)
+                break;
+
+        if (i == NUM_BUILTINS)
+        {
+            fprintf(stderr, "Error: %s:%d: unknown routine \"%s\"\n", path, line_no, name);
+            fclose(f);
+            return -1;
+        }
+
+        if (hle_count >= HLE_MAX_HOOKS)
+        {
+            fprintf(stderr, "Error: %s:%d: too many hooks (max %d)\n", path, line_no, HLE_MAX_HOOKS);
+            fclose(f);
+            return -1;
+        }
+
+        hle_hooks[hle_count].name = hle_builtins[i].name;
+        hle_hooks[hle_count].func = hle_builtins[i].func;
+        hle_hooks[hle_count].addr = addr;
+        hle_hooks[hle_count].cycles = hook_cycles;
+        hle_count++;
+        hle_index[addr] = hle_count;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void save_state(struct hle_state *s)
+{
+    memcpy(s->regs, cpu->regs, sizeof(s->regs));
+    s->flags = cpu->flags;
+    s->PC = cpu->PC;
+    s->SP = cpu->SP;
+    s->cycles = cpu->cycles;
+    s->bank = bank_selected;
+    s->io = io;
+    s->stats = cpu->stats;
+    mem_save_view(s->mem);
+}
+
+static void restore_state(const struct hle_state *s)
+{
+    memcpy(cpu->regs, s->regs, sizeof(s->regs));
+    cpu->flags = s->flags;
+    cpu->PC = s->PC;
+    cpu->SP = s->SP;
+    cpu->cycles = s->cycles;
+    bank_select(s->bank);
+    io = s->io;
+    cpu->stats = s->stats;
+    mem_restore_view(s->mem);
+}
+
+static void run_native(struct hle_hook *h)
+{
+    uint32_t t;
+
+    // leave the return address where CALL would have pushed it
+    mem_write(cpu->SP - 1, (cpu->PC >> 8) & 0xFF);
+    mem_write(cpu->SP - 2, cpu->PC & 0xFF);
+
+    t = h->func();
+    cpu->cycles += h->cycles ? h->cycles : t;
+}
+
+/*
+ * run the guest routine until it returns to the caller, with a breakpoint
+ * on the return address that deeper returns of a recursive routine pass
+ * over. Returns 1 once it returned, 0 with the RUN_ code it stopped with
+ * in status, RUN_LIMIT if it didn't return within GUEST_MAX_CYCLES.
+ */
+static int run_guest(uint16_t target, int *status)
+{
+    static uint8_t ret_break[MEMORY_MAX];
+    const uint8_t *breaks = cpu->breaks;
+    uint16_t ret_pc = cpu->PC;
+    uint16_t ret_sp = cpu->SP;
+    uint64_t limit = cpu->cycles + GUEST_MAX_CYCLES;
+    int ret;
+
+    mem_write(--cpu->SP, (cpu->PC >> 8) & 0xFF);
+    mem_write(--cpu->SP, cpu->PC & 0xFF);
+    cpu->PC = target;
+
+    ret_break[ret_pc] = 1;
+    cpu->breaks = ret_break;
+
+    for (;;)
+    {
+        ret = cpu->cycles < limit ? cpu_run(limit - cpu->cycles) : RUN_LIMIT;
+        if (ret != RUN_BREAK || cpu->SP == ret_sp)
+            break;
+
+        cpu->break_skip = 1;
+    }
+
+    ret_break[ret_pc] = 0;
+    cpu->breaks = breaks;
+
+    *status = ret;
+    return ret == RUN_BREAK;
+}
+
+static void report_diff(struct hle_hook *h, const struct hle_state *native,
+    const struct hle_state *guest, const struct hle_state *base)
+{
+    static const char reg_names[] = "BCDEHLMA";
+    int diffs = 0;
+
+    fprintf(stderr, "HLE verify: %s at %04X", h->name, h->addr);
+
+    for (int code = 0; code < R_COUNT; ++code)
+    {
+        int i = REG_INDEX(code);
+
+        if (i != R_MEM && native->regs[i] != guest->regs[i])
+            fprintf(stderr, "%s %c=%02X/%02X", diffs++ ? "," : ":", reg_names[code], native->regs[i], guest->regs[i]);
+    }
+
+    if (native->flags != guest->flags)
+        fprintf(stderr, "%s F=%02X/%02X", diffs++ ? "," : ":", native->flags, guest->flags);
+
+    if (native->SP != guest->SP)
+        fprintf(stderr, "%s SP=%04X/%04X", diffs++ ? "," : ":", native->SP, guest->SP);
+
+    if (native->bank != guest->bank)
+        fprintf(stderr, "%s bank=%d/%d", diffs++ ? "," : ":", native->bank, guest->bank);
+
+    if (native->io.in_pos != guest->io.in_pos)
+        fprintf(stderr, "%s input=%u/%u", diffs++ ? "," : ":",
+            native->io.in_pos - base->io.in_pos, guest->io.in_pos - base->io.in_pos);
+
+    if (native->io.out_len != guest->io.out_len)
+        fprintf(stderr, "%s output=%u/%u", diffs++ ? "," : ":",
+            native->io.out_len - base->io.out_len, guest->io.out_len - base->io.out_len);
+
+    for (uint32_t a = 0, shown = 0; a < MEMORY_MAX; ++a)
+    {
+        if (native->mem[a] == guest->mem[a])
+            continue;
+
+        if (shown++ < MAX_DIFF_REPORT)
+            fprintf(stderr, "%s (%04X)=%02X/%02X", diffs ? "," : ":", a, native->mem[a], guest->mem[a]);
+        diffs++;
+    }
+
+    if (native->cycles != guest->cycles)
+        fprintf(stderr, "%s cycles=%llu/%llu", diffs++ ? "," : ":",
+            (unsigned long long)(native->cycles - base->cycles),
+            (unsigned long long)(guest->cycles - base->cycles));
+
+    if (diffs)
+        fprintf(stderr, " (native/guest)\n");
+    else
+        fprintf(stderr, ": ok\n");
+}
+
+/*
+ * called by CALL once it has decided to transfer control to target; returns 1
+ * if a native routine handled it (PC left at the return address, exactly as
+ * after the guest routine's RET), 0 to fall through to the normal call
+ */
+int hle_call(uint16_t target)
+{
+    struct hle_hook *h = &hle_hooks[hle_index[target] - 1];
+    struct hle_state *base, *native, *guest;
+    int status;
+    uint8_t blocked;
+
+    if (!hle_verify)
+    {
+        run_native(h);
+        return 1;
+    }
+
+    base = malloc(sizeof(*base));
+    native = malloc(sizeof(*native));
+    guest = malloc(sizeof(*guest));
+    if (base == NULL || native == NULL || guest == NULL)
+    {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(1);
+    }
+
+    // run both paths from the same state, keep the guest result
+    save_state(base);
+    run_native(h);
+    save_state(native);
+    restore_state(base);
+
+    if (run_guest(target, &status))
+    {
+        save_state(guest);
+        report_diff(h, native, guest, base);
+    }
+    else if (status == RUN_INPUT || status == RUN_OUTPUT)
+    {
+        // the CALL is undone and both paths run again once the I/O can go on
+        blocked = io.blocked;
+        restore_state(base);
+        io.blocked = blocked;
+    }
+    else if (status == RUN_LIMIT)
+    {
+        fprintf(stderr, "HLE verify: %s at %04X: the guest routine didn't return within %d T-states, native result kept\n",
+            h->name, h->addr, GUEST_MAX_CYCLES);
+        restore_state(native);
+    }
+    else
+        fprintf(stderr, "HLE verify: %s at %04X: the guest routine stopped the program before returning\n", h->name, h->addr);
+
+    free(base);
+    free(native);
+    free(guest);
+    return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef HLE_H_
+#define HLE_H_
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define HLE_MAX_HOOKS 64
+
+// native routine - returns the T-states the guest routine takes, from its
+// first instruction up to and including its RET
+typedef uint32_t (*HleFunc) (void);
+
+struct hle_hook
+{
+    const char *name;
+    HleFunc func;
+    uint16_t addr;
+    uint32_t cycles;    // fixed cost from the config file, 0 if unset
+};
+
+extern uint8_t hle_index[MEMORY_MAX];
+extern uint8_t hle_verify;
+
+int hle_load(const char *path);
+int hle_call(uint16_t target);
+
+#endif /* HLE_H_ */
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instr.h"
+#include "opcodes.h"
+
+// executions per opcode, shared by all CPUs
+uint64_t instr_count[256];
+
+// called by every handler before it runs
+void instr_exec(uint8_t opcode)
+{
+    __atomic_fetch_add(&instr_count[opcode], 1, __ATOMIC_RELAXED);
+}
+
+// instruction mix, most executed first
+void instr_report(void)
+{
+    uint8_t order[256];
+    uint64_t total = 0;
+
+    for (int i = 0; i < 256; ++i)
+    {
+        order[i] = i;
+        total += instr_count[i];
+    }
+
+    // insertion sort, 256 entries
+    for (int i = 1; i < 256; ++i)
+    {
+        uint8_t op = order[i];
+        int j = i;
+
+        for (; j > 0 && instr_count[order[j - 1]] < instr_count[op]; --j)
+            order[j] = order[j - 1];
+        order[j] = op;
+    }
+
+    printf("Instruction mix (%llu instructions):\n", (unsigned long long)total);
+    for (int i = 0; i < 256 && instr_count[order[i]]; ++i)
+    {
+        const char *name = name_table[order[i]];
+
+        printf("  %02X %-9s %12llu  %5.1f%%\n", order[i], name ? name : "undefined",
+            (unsigned long long)instr_count[order[i]], 100.0 * instr_count[order[i]] / total);
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef INSTR_H_
+#define INSTR_H_
+
+#include <stdint.h>
+
+// only linked into the instrumented build (make instrument)
+
+extern uint64_t instr_count[256];
+
+void instr_exec(uint8_t opcode);
+void instr_report(void);
+
+#endif /* INSTR_H_ */
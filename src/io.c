@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "io.h"
+#include "mem.h"
+#include "cpu.h"
+#include "rr.h"
+
+__thread struct io_stream io;
+static int io_attached = 0;
+
+// every read of the input cell takes the next input byte, the last one sticks
+static uint8_t io_stdin_read(uint16_t addr)
+{
+    // the instruction is undone and runs again once there's input
+    if (io.async && io.in_pos >= io.in_len)
+    {
+        io.blocked = RUN_INPUT;
+        return 0;
+    }
+
+    if (io.in_pos < io.in_len)
+        mem_poke(addr, io.in[io.in_pos++]);
+
+    if (rr_mode != RR_OFF)
+        mem_poke(addr, rr_input(RR_INPUT, 0, mem_peek(addr)));
+
+    cpu->stats.in_bytes++;
+    return mem_peek(addr);
+}
+
+// every write to the output cell is also appended to the output buffer
+static void io_stdout_write(uint16_t addr, uint8_t val)
+{
+    if (io.async && io.out_len >= io.out_cap)
+    {
+        io.blocked = RUN_OUTPUT;
+        return;
+    }
+
+    mem_poke(addr, val);
+    cpu->stats.out_bytes++;
+
+    if (io.out_len < io.out_cap)
+        io.out[io.out_len++] = val;
+    else
+        io.truncated = 1;
+}
+
+// route the standard input/output cells through the stream buffers
+int io_attach(void)
+{
+    if (io_attached)
+        return 0;
+
+    if (mem_map_device(IO_STDIN_ADDR, IO_STDIN_ADDR, &io_stdin_read, NULL) < 0)
+        return -1;
+    if (mem_map_device(IO_STDOUT_ADDR, IO_STDOUT_ADDR, NULL, &io_stdout_write) < 0)
+        return -1;
+
+    io_attached = 1;
+    return 0;
+}
+
+void io_reset(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_cap)
+{
+    memset(&io, 0, sizeof(io));
+    io.in = in;
+    io.in_len = in_len;
+    io.out = out;
+    io.out_cap = out_cap;
+}
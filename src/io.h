@@ -0,0 +1,32 @@
+#ifndef IO_H_
+#define IO_H_
+
+#include <stdint.h>
+
+#define IO_STDIN_ADDR 0x2000
+#define IO_STDOUT_ADDR 0x3000
+
+// byte streams behind the standard input/output cells in batch runs
+struct io_stream
+{
+    const uint8_t *in;
+    uint32_t in_len;
+    uint32_t in_pos;
+
+    uint8_t *out;
+    uint32_t out_len;
+    uint32_t out_cap;
+    uint8_t truncated;
+
+    uint8_t async;          // suspend instead of repeating the last input or dropping output
+    uint8_t blocked;        // RUN_INPUT or RUN_OUTPUT when an access of the cells had to wait
+
+    uint8_t ports[256];     // latches behind IN/OUT
+};
+
+extern __thread struct io_stream io;       // stream and ports of the CPU the calling thread runs
+
+int io_attach(void);
+void io_reset(const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_cap);
+
+#endif /* IO_H_ */
@@ -0,0 +1,42 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "opcodes.h"
+
+// per-opcode tables built from isa.def, undefined opcodes are 1 byte long
+
+#define OP(code, name, len, cyc, ...) [code] = cyc,
+#define UNDEF(code, cyc) [code] = cyc,
+const uint8_t cycle_table[256] =
+{
+#include "isa.def"
+};
+#undef OP
+#undef UNDEF
+
+#define OP(code, name, len, cyc, ...) [code] = len,
+#define UNDEF(code, cyc) [code] = 1,
+const uint8_t length_table[256] =
+{
+#include "isa.def"
+};
+#undef OP
+#undef UNDEF
+
+#define OP(code, name, len, cyc, ...) [code] = name,
+#define UNDEF(code, cyc) [code] = NULL,
+const char *const name_table[256] =
+{
+#include "isa.def"
+};
+#undef OP
+#undef UNDEF
+
+#define OP(code, name, len, cyc, cls, ...) [code] = ISA_##cls,
+#define UNDEF(code, cyc) [code] = ISA_UNDEF,
+const uint8_t class_table[256] =
+{
+#include "isa.def"
+};
+#undef OP
+#undef UNDEF
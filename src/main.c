@@ -9,23 +9,41 @@
 #include "opcodes.h"
 #include "cpu.h"
 #include "debug.h"
+#include "hle.h"
+#include "mem.h"
+#include "io.h"
+#include "daemon.h"
+#include "proto.h"
+#include "smp.h"
+#include "wide.h"
+#include "native.h"
+#include "stats.h"
+#include "prof.h"
+#include "rr.h"
+#include "gdb.h"
+#include "ctl.h"
+#include "cache.h"
+#include "display.h"
+#include "perf.h"
+#include "script.h"
+#include "timer.h"
+#ifdef INSTRUMENT
+#include "instr.h"
+#endif
 
-uint8_t memory[MEMORY_MAX];
-uint8_t regs[R_COUNT];
-uint8_t flags = 0;
-uint16_t PC = 0x0800;
-uint16_t SP = 0xFFFF;
-
-uint8_t opcode;
-uint8_t running = 1;
 
 // debug
 int step_sec = 0;
 
+// programs of the additional CPUs
+char *smp_programs[SMP_MAX_CPUS];
+uint64_t quantum_cycles = SMP_DEFAULT_QUANTUM;
+
 void load_program(char *program_path)
 {
     long filesize;
     uint16_t load_addr = 0x0800;
+    uint8_t *buf;
 
     FILE *f = fopen(program_path, "rb");
     if (f == NULL)
@@ -39,70 +57,660 @@ void load_program(char *program_path)
     filesize = ftell(f);
     fseek(f, 0, SEEK_SET);
 
-    // ensure program doesn't cross into stack segment
-    if (load_addr + filesize >= STACK_SEGMENT_START)
+    // ensure program doesn't cross into stack segment (or its guard page)
+    if (load_addr + filesize >= STACK_SEGMENT_START - (mem_prot_mode ? MEM_PAGE_SIZE : 0))
     {
         fprintf(stderr, "Error: program doesn't fit into memory\n");
         exit(1);
     }
 
-    fread(&memory[load_addr], 1, filesize, f);
+    buf = malloc(filesize);
+    if (buf == NULL)
+    {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(1);
+    }
+
+    // program lands in whichever banks are selected at load time
+    filesize = fread(buf, 1, filesize, f);
+    mem_load(load_addr, buf, filesize);
+    mem_protect_code(load_addr, filesize);
+    free(buf);
     fclose(f);
-    PC = load_addr;
+    cpu->PC = load_addr;
+    cpu->native = native_match();
 }
 
 // program loop
 void *run_prog(void *args)
 {   
-    char **argv = (char **)args;
+    char *program_path = (char *)args;
 
     // load program into memory
-    load_program(argv[1]);
+    load_program(program_path);
 
-    // main loop
-    while (PC < STACK_SEGMENT_START && running)
+    if (smp_count == 0)
     {
-        opcode = memory[PC++];
-        if (opcode_table[opcode] != NULL)
-            opcode_table[opcode]();
+        perf_sample_thread();
+        if (rr_mode != RR_OFF)
+            rr_run();
+        else if (script_loaded)
+            script_run();
         else
-            printf("Unknown opcode %02X at %04X\n", opcode, PC - 1);
+            ctl_run();
+        perf_sample_thread_end();
+        return NULL;
+    }
 
-        if (step_sec)
-            sleep(step_sec);
+    for (int i = 1; i < smp_count; ++i)
+    {
+        cpu = smp_cpu[i];
+        load_program(smp_programs[i]);
     }
+
+    cpu = &cpu0;
+    smp_run(quantum_cycles);
+    return NULL;
+}
+
+void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-H hook file] [-V] [-b banks[:start-end[:select]]] [-p strict|smc] [-Z]\n", name);
+    fprintf(stderr, "           [-m program]... [-S start-end] [-Q cycles] [-R] [-U policy] [-A file [-X] [-c max cycles]]\n");
+    fprintf(stderr, "           [-M file[:seconds]] [-P file] [-r log | -y log] [-G port|socket] [-d start-end[:columns[:seg]]]\n");
+    fprintf(stderr, "           [-Y symbols] [-J] [-T file[:hz]] [-q] [-s script] [-t] <program> [initial step delay]\n");
+    fprintf(stderr, "       %s -W <input vectors> [-c max cycles] [-H hook file] <program>\n", name);
+    fprintf(stderr, "       %s -D [socket] [-j workers] [-H hook file] [-M file[:seconds]] [-C file[:MiB]] [-t]\n", name);
+    fprintf(stderr, "  -H <file>   run native replacements for the routines listed in file\n");
+    fprintf(stderr, "  -V          run both native and guest routines and compare results\n");
+    fprintf(stderr, "  -b <spec>   bank switched memory, default window 8000-BFFF, select register 2001\n");
+    fprintf(stderr, "  -p <mode>   guard the stack and write-protect code; code writes stop (strict) or are allowed (smc)\n");
+    fprintf(stderr, "  -m <file>   add a CPU running file, repeat for more CPUs\n");
+    fprintf(stderr, "  -S <range>  memory shared by all CPUs (default C000-CFFF)\n");
+    fprintf(stderr, "  -Q <n>      T-states each CPU runs between synchronization points (default %d)\n", SMP_DEFAULT_QUANTUM);
+    fprintf(stderr, "  -R          relaxed shared memory, writes are seen immediately in no particular order\n");
+    fprintf(stderr, "  -Z          sparse memory: pages are allocated on first write and read as zero before\n");
+    fprintf(stderr, "  -W <file>   run the program once per line of input bytes in file, in lockstep\n");
+    fprintf(stderr, "  -F <addr>   with -W, run to addr once and start every lane from there\n");
+    fprintf(stderr, "  -c <n>      cycle limit of -W and -X runs (default %llu)\n", WIDE_DEFAULT_CYCLES);
+    fprintf(stderr, "  -A <file>   run the blocks compiled by 8085aot into file natively\n");
+    fprintf(stderr, "  -X          run the program with -A and interpreted in lockstep, and compare after every block\n");
+    fprintf(stderr, "  -U <policy> on an undefined opcode: trap (stop on it, default), halt or count (skip it)\n");
+    fprintf(stderr, "  -M <file>   rewrite file with the run counters every %d seconds, Prometheus text if it ends in .prom, JSON otherwise\n", STATS_DEFAULT_INTERVAL);
+    fprintf(stderr, "  -P <file>   count memory accesses per page and track the stack, written to file at exit\n");
+    fprintf(stderr, "  -r <file>   record every input read into file\n");
+    fprintf(stderr, "  -y <file>   replay the input recorded in file at full speed and check the state against it\n");
+    fprintf(stderr, "  -G <where>  accept GDB on a localhost TCP port or a Unix socket, the program keeps running\n");
+    fprintf(stderr, "  -d <spec>   show the memory range on a display at the top of the terminal, %d cells per line by default,\n", DISPLAY_DEFAULT_COLUMNS);
+    fprintf(stderr, "              as characters or with seg as seven-segment digits\n");
+    fprintf(stderr, "  -Y <file>   guest symbols, <address> <name> per line, for -J and -T\n");
+    fprintf(stderr, "  -J          describe the blocks of -A to perf in /tmp/perf-<pid>.map and /tmp/jit-<pid>.dump\n");
+    fprintf(stderr, "  -T <file>   sample the guest PC and call stack %d times per CPU second, written to file like perf script\n", PERF_DEFAULT_HZ);
+    fprintf(stderr, "  -q          headless: no debugger, banner or final dump, the console is left to the program\n");
+    fprintf(stderr, "  -s <file>   headless, running the debugger commands in file at T-state counts, addresses or the end\n");
+    fprintf(stderr, "  -t          T-state counter at %04X, stopwatch at %04X-%04X and timing reports to %04X for the program\n",
+        TIMER_COUNTER, TIMER_CONTROL, TIMER_ELAPSED + 3, TIMER_REPORT);
+    fprintf(stderr, "  -D          serve programs submitted over a Unix socket (default %s)\n", PROTO_DEFAULT_SOCKET);
+    fprintf(stderr, "  -j <n>      number of daemon workers (default: online CPUs)\n");
+    fprintf(stderr, "  -C <file>   keep the replies of the daemon in file and answer repeated jobs from it (default %d MiB)\n", CACHE_DEFAULT_MB);
 }
 
 int main(int argc, char **argv)
 {
     pthread_t prog_thread, debug_thread;
     int ret_prog, ret_debug;
+    int opt;
+    char *hook_path = NULL;
+    int banks = 0;
+    int prot_mode = MEM_PROT_OFF;
+    int daemon_mode = 0;
+    int nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    char *socket_path = PROTO_DEFAULT_SOCKET;
+    unsigned int bank_start = 0x8000, bank_end = 0xBFFF, bank_reg = 0x2001;
+    int ncpus = 1;
+    int smp_mode = SMP_STRICT;
+    unsigned int shared_start = SMP_DEFAULT_SHARED_START, shared_end = SMP_DEFAULT_SHARED_END;
+    char *inputs_path = NULL;
+    uint64_t max_cycles = WIDE_DEFAULT_CYCLES;
+    int fork_addr = -1;
+    char *native_path = NULL;
+    int validate = 0;
+    char *rr_path = NULL;
+    int rr = RR_OFF;
+    char *gdb_where = NULL;
+    char *cache_path = NULL;
+    int cache_mb = CACHE_DEFAULT_MB;
+    int display = 0;
+    unsigned int display_first, display_last;
+    int display_columns = DISPLAY_DEFAULT_COLUMNS;
+    int display_mode = DISPLAY_TEXT;
+    char *symbols_path = NULL;
+    int perf_jit = 0;
+    char *samples_path = NULL;
+    int sample_hz = PERF_DEFAULT_HZ;
+    int headless = 0;
+    char *script_path = NULL;
+    int timer = 0;
+
+    while ((opt = getopt(argc, argv, "H:Vb:p:Dj:m:S:Q:RW:F:c:A:XU:M:P:r:y:G:ZC:d:Y:JT:qs:t")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                hook_path = optarg;
+                break;
+
+            case 'V':
+                hle_verify = 1;
+                break;
+
+            case 'b':
+                if (sscanf(optarg, "%d:%x-%x:%x", &banks, &bank_start, &bank_end, &bank_reg) < 1)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+
+            case 'p':
+                if (strcmp(optarg, "strict") == 0)
+                    prot_mode = MEM_PROT_STRICT;
+                else if (strcmp(optarg, "smc") == 0)
+                    prot_mode = MEM_PROT_SMC;
+                else
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+
+            case 'U':
+                if (strcmp(optarg, "trap") == 0)
+                    undef_policy = UNDEF_TRAP;
+                else if (strcmp(optarg, "halt") == 0)
+                    undef_policy = UNDEF_HALT;
+                else if (strcmp(optarg, "count") == 0)
+                    undef_policy = UNDEF_COUNT;
+                else
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+
+            case 'M':
+            {
+                char *colon = strrchr(optarg, ':');
+
+                if (colon != NULL)
+                {
+                    *colon = '\0';
+                    stats_interval = (int)strtol(colon + 1, NULL, 0);
+                }
+
+                if (stats_interval < 1 || *optarg == '\0')
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+
+                stats_file = optarg;
+                break;
+            }
+
+            case 'C':
+            {
+                char *colon = strrchr(optarg, ':');
+
+                if (colon != NULL)
+                {
+                    *colon = '\0';
+                    cache_mb = (int)strtol(colon + 1, NULL, 0);
+                }
+
+                if (cache_mb < 1 || *optarg == '\0')
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+
+                cache_path = optarg;
+                break;
+            }
+
+            case 'd':
+            {
+                char mode[8] = "";
+
+                if (sscanf(optarg, "%x-%x:%d:%7s", &display_first, &display_last, &display_columns, mode) < 2
+                    || display_first > display_last || display_last > 0xFFFF || display_columns < 1
+                    || (mode[0] != '\0' && strcmp(mode, "seg") != 0))
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+
+                display_mode = mode[0] != '\0' ? DISPLAY_SEG : DISPLAY_TEXT;
+                display = 1;
+                break;
+            }
+
+            case 'Y':
+                symbols_path = optarg;
+                break;
+
+            case 'J':
+                perf_jit = 1;
+                break;
+
+            case 'T':
+            {
+                char *colon = strrchr(optarg, ':');
+
+                if (colon != NULL)
+                {
+                    *colon = '\0';
+                    sample_hz = (int)strtol(colon + 1, NULL, 0);
+                }
+
+                if (sample_hz < 1 || sample_hz > 1000000 || *optarg == '\0')
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+
+                samples_path = optarg;
+                break;
+            }
+
+            case 'q':
+                headless = 1;
+                break;
+
+            case 's':
+                script_path = optarg;
+                headless = 1;
+                break;
+
+            case 't':
+                timer = 1;
+                break;
+
+            case 'P':
+                prof_file = optarg;
+                break;
+
+            case 'r':
+                rr_path = optarg;
+                rr = RR_RECORD;
+                break;
+
+            case 'y':
+                rr_path = optarg;
+                rr = RR_REPLAY;
+                break;
+
+            case 'G':
+                gdb_where = optarg;
+                break;
+
+            case 'D':
+                daemon_mode = 1;
+                break;
+
+            case 'j':
+                nworkers = (int)strtol(optarg, NULL, 0);
+                break;
+
+            case 'm':
+                if (ncpus >= SMP_MAX_CPUS)
+                {
+                    fprintf(stderr, "Error: at most %d CPUs\n", SMP_MAX_CPUS);
+                    exit(1);
+                }
+                smp_programs[ncpus++] = optarg;
+                break;
+
+            case 'S':
+                if (sscanf(optarg, "%x-%x", &shared_start, &shared_end) != 2)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+
+            case 'Q':
+                quantum_cycles = strtoull(optarg, NULL, 0);
+                if (quantum_cycles == 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+
+            case 'R':
+                smp_mode = SMP_RELAXED;
+                break;
+
+            case 'Z':
+                mem_sparse = 1;
+                break;
+
+            case 'W':
+                inputs_path = optarg;
+                break;
+
+            case 'F':
+                fork_addr = (uint16_t)strtol(optarg, NULL, 16);
+                break;
+
+            case 'c':
+                max_cycles = strtoull(optarg, NULL, 0);
+                break;
+
+            case 'A':
+                native_path = optarg;
+                break;
+
+            case 'X':
+                validate = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    // sparse pages live outside the regions banks, protection and shared windows map
+    if (mem_sparse && (banks || prot_mode != MEM_PROT_OFF || ncpus > 1))
+    {
+        fprintf(stderr, "Error: -b, -p and -m can't be used with -Z\n");
+        exit(1);
+    }
+
+    // the display draws on the console's terminal
+    if (display && (daemon_mode || inputs_path != NULL || validate))
+    {
+        fprintf(stderr, "Error: -d can't be used with -D, -W or -X\n");
+        exit(1);
+    }
+
+    // forked workers and lanes have no thread of their own to sample
+    if ((perf_jit || samples_path != NULL) && (daemon_mode || inputs_path != NULL || validate))
+    {
+        fprintf(stderr, "Error: -J and -T can't be used with -D, -W or -X\n");
+        exit(1);
+    }
+
+    if (script_path != NULL && (daemon_mode || inputs_path != NULL || validate))
+    {
+        fprintf(stderr, "Error: -s can't be used with -D, -W or -X\n");
+        exit(1);
+    }
+
+    // lanes and the checker have nowhere to show the reports
+    if (timer && (inputs_path != NULL || validate))
+    {
+        fprintf(stderr, "Error: -t can't be used with -W or -X\n");
+        exit(1);
+    }
+
+    if (perf_jit && native_path == NULL)
+    {
+        fprintf(stderr, "Error: -J needs -A\n");
+        exit(1);
+    }
+
+    if (daemon_mode)
+    {
+        if (optind < argc)
+            socket_path = argv[optind];
+
+        if (prof_file != NULL || rr != RR_OFF || gdb_where != NULL)
+        {
+            fprintf(stderr, "Error: -P, -r, -y and -G can't be used with -D\n");
+            exit(1);
+        }
+
+        if (mem_init() < 0 || io_attach() < 0)
+            exit(1);
+        if (timer && timer_attach() < 0)
+            exit(1);
+        if (hook_path != NULL && hle_load(hook_path) < 0)
+            exit(1);
+        if (native_path != NULL && native_load(native_path) < 0)
+            exit(1);
+        if (cache_path != NULL && cache_open(cache_path, cache_mb, hook_path, native_path) < 0)
+            exit(1);
+
+        return daemon_main(socket_path, nworkers) < 0;
+    }
 
-    printf("8085vm v1.0 by theos78\n");
-    printf("Type \"help\" for a list of all available debugger commands\n");
+    if (cache_path != NULL)
+    {
+        fprintf(stderr, "Error: -C can only be used with -D\n");
+        exit(1);
+    }
+
+    if (inputs_path != NULL)
+    {
+        if (optind >= argc)
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+
+        if (banks || prot_mode != MEM_PROT_OFF || ncpus > 1 || stats_file != NULL || prof_file != NULL || rr != RR_OFF
+            || gdb_where != NULL)
+        {
+            fprintf(stderr, "Error: -b, -p, -m, -M, -P, -r, -y and -G can't be used with -W\n");
+            exit(1);
+        }
+
+        if (mem_init() < 0)
+            exit(1);
+        if (hook_path != NULL && hle_load(hook_path) < 0)
+            exit(1);
+        if (native_path != NULL && native_load(native_path) < 0)
+            exit(1);
+
+        load_program(argv[optind]);
+        return wide_main(inputs_path, max_cycles, fork_addr) < 0;
+    }
+
+    if (validate)
+    {
+        int diffs;
 
-    if (argv[1] == NULL)
+        if (optind >= argc || native_path == NULL)
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+
+        if (banks || ncpus > 1 || prof_file != NULL || rr != RR_OFF || gdb_where != NULL)
+        {
+            fprintf(stderr, "Error: -b, -m, -P, -r, -y and -G can't be used with -X\n");
+            exit(1);
+        }
+
+        if (mem_init() < 0)
+            exit(1);
+        if (hook_path != NULL && hle_load(hook_path) < 0)
+            exit(1);
+        if (prot_mode != MEM_PROT_OFF && mem_protect_init(prot_mode) < 0)
+            exit(1);
+        if (native_load(native_path) < 0)
+            exit(1);
+
+        load_program(argv[optind]);
+        diffs = native_validate(max_cycles);
+        if (diffs == 0)
+            printf("Native code matches the interpreter\n");
+
+        return diffs != 0;
+    }
+
+    if (!headless)
+    {
+        printf("8085vm v1.0 by theos78\n");
+        printf("Type \"help\" for a list of all available debugger commands\n");
+    }
+
+    if (optind >= argc)
     {
         fprintf(stderr, "Error: no file provided\n");
-        fprintf(stderr, "Usage: %s <program> [initial step delay]\n", argv[0]);
+        usage(argv[0]);
         exit(1);
     }
 
     // initialization
-    init_opcodes();
-    memset(memory, 0, sizeof(memory));
-    flags = 0;
-    if (argv[2] != NULL)
-        step_sec = (uint32_t)strtol(argv[2], NULL, 0);
+    if (mem_init() < 0 || io_attach() < 0)
+        exit(1);
+    if (timer && timer_attach() < 0)
+        exit(1);
+    cpu->flags = 0;
+    if (optind + 1 < argc)
+        step_sec = (uint32_t)strtol(argv[optind + 1], NULL, 0);
+
+    if (hook_path != NULL && hle_load(hook_path) < 0)
+        exit(1);
+
+    if (native_path != NULL && native_load(native_path) < 0)
+        exit(1);
+
+    if (banks && bank_init(banks, bank_start, bank_end, bank_reg) < 0)
+        exit(1);
+
+    if (prot_mode != MEM_PROT_OFF && mem_protect_init(prot_mode) < 0)
+        exit(1);
+
+    // bank registers and protection are per process, not per CPU
+    if (ncpus > 1 && (banks || prot_mode != MEM_PROT_OFF))
+    {
+        fprintf(stderr, "Error: -b and -p can't be used with more than one CPU\n");
+        exit(1);
+    }
+
+    if (ncpus > 1 && (rr != RR_OFF || gdb_where != NULL))
+    {
+        fprintf(stderr, "Error: -r, -y and -G can't be used with more than one CPU\n");
+        exit(1);
+    }
+
+    // the script drives the CPU thread in place of run control
+    if (script_path != NULL && (ncpus > 1 || rr != RR_OFF || gdb_where != NULL))
+    {
+        fprintf(stderr, "Error: -s can't be used with -m, -r, -y or -G\n");
+        exit(1);
+    }
+
+    if (rr != RR_OFF && gdb_where != NULL)
+    {
+        fprintf(stderr, "Error: -G can't be used with -r or -y\n");
+        exit(1);
+    }
+
+    // both paths of a verified call read input, the log would hold it twice
+    if (rr != RR_OFF && hle_verify)
+    {
+        fprintf(stderr, "Error: -V can't be used with -r or -y\n");
+        exit(1);
+    }
+
+    // pause, stepi and the gdb stub drive a single CPU
+    ctl_enabled = ncpus == 1 && rr == RR_OFF;
+
+    if (script_path != NULL && script_load(script_path) < 0)
+        exit(1);
+
+    if (gdb_where != NULL && gdb_start(gdb_where) < 0)
+        exit(1);
+
+    if (rr != RR_OFF && rr_open(rr_path, rr) < 0)
+        exit(1);
 
-    // spawn program and debugger thread
-    ret_prog = pthread_create(&prog_thread, NULL, run_prog, (void *)argv);
-    ret_debug = pthread_create(&debug_thread, NULL, debugger_loop, NULL);
+    if (ncpus > 1 && smp_init(ncpus, shared_start, shared_end, smp_mode) < 0)
+        exit(1);
+
+    if (prof_file != NULL && prof_init() < 0)
+        exit(1);
+
+    // the rates are only read by -M and the stats command of the debugger
+    if ((stats_file != NULL || !headless) && stats_start(-1) < 0)
+        exit(1);
+
+    if (symbols_path != NULL && perf_load_symbols(symbols_path) < 0)
+        exit(1);
+
+    if (perf_jit && (perf_jit_open() < 0 || native_perf() < 0))
+        exit(1);
+
+    if (samples_path != NULL && perf_sample_init(samples_path, sample_hz) < 0)
+        exit(1);
+
+    if (display && display_start(display_first, display_last, display_columns, display_mode) < 0)
+        exit(1);
+
+    // spawn program and debugger thread, headless runs have no debugger
+    ret_prog = pthread_create(&prog_thread, NULL, run_prog, (void *)argv[optind]);
+    if (!headless)
+        ret_debug = pthread_create(&debug_thread, NULL, debugger_loop, NULL);
 
     // wait until threads are done
     pthread_join(prog_thread, NULL);
-    pthread_join(debug_thread, NULL);
+    if (!headless)
+        pthread_join(debug_thread, NULL);
+    display_stop();
+    stats_stop();
+    if (prof_file != NULL)
+        prof_write();
+    perf_sample_write();
+    perf_jit_close();
 
-    printf("Execution finished.\n");
-    d_dump(NULL);
+    if (!headless)
+    {
+        printf("Execution finished.\n");
+        d_dump(NULL);
+    }
+#ifdef INSTRUMENT
+    instr_report();
+#endif
+
+    for (int i = 1; i < smp_count && !headless; ++i)
+    {
+        printf("CPU %d:", i);
+        cpu = smp_cpu[i];
+        d_dump(NULL);
+    }
+    cpu = &cpu0;
+
+    if (rr_diverged)
+        return 1;
+
+    if (mem_fault == FAULT_STACK)
+    {
+        fprintf(stderr, "Error: stack overflow, write to guard page at 0x%04X\n", mem_fault_addr);
+        return 1;
+    }
+
+    if (mem_fault == FAULT_CODE)
+    {
+        fprintf(stderr, "Error: write to program code at 0x%04X\n", mem_fault_addr);
+        return 1;
+    }
+
+    for (int i = 0; i < (smp_count ? smp_count : 1); ++i)
+    {
+        cpu = i ? smp_cpu[i] : &cpu0;
+        if (cpu->trap)
+        {
+            fprintf(stderr, "Error: undefined opcode 0x%02X at 0x%04X", mem_peek(cpu->PC), cpu->PC);
+            if (i)
+                fprintf(stderr, " on CPU %d", i);
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
 }
\ No newline at end of file
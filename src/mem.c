@@ -0,0 +1,651 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mem.h"
+#include "cpu.h"
+#include "prof.h"
+
+struct mem_device mem_devices[MEM_MAX_DEVICES];
+int mem_device_count = 0;
+
+// bank switching
+uint8_t *bank_store = NULL;
+int bank_count = 0;
+uint8_t bank_selected = 0;
+int bank_first_page, bank_last_page;
+size_t bank_store_size = 0;
+
+// host pages made read-only by mem_protect_init / mem_protect_code
+struct mem_protected
+{
+    uint8_t *host;
+    uint16_t guest;
+    uint8_t kind;       // FAULT_STACK or FAULT_CODE
+};
+
+struct mem_protected mem_prot[MEM_MAX_PROTECTED];
+volatile int mem_prot_count = 0;
+int mem_prot_mode = MEM_PROT_OFF;
+
+// the stack guard stays protected, a data write opens it until the next instruction boundary
+static uint8_t *guard_host = NULL;
+static volatile int guard_open = 0;
+
+volatile int mem_fault = FAULT_NONE;
+volatile uint16_t mem_fault_addr;
+uint8_t code_dirty[MEM_PAGES];
+volatile uint32_t smc_writes = 0;
+
+// sparse memory: unwritten pages read from mem_zero, written ones come from a per-thread free list
+int mem_sparse = 0;
+static struct mem_shared mem_zero;
+static __thread struct mem_shared *free_pages = NULL;
+
+// recompute the direct pointers of a page after its storage or devices changed
+static void update_maps(struct cpu *c, int page)
+{
+    uint16_t start = page << MEM_PAGE_SHIFT;
+    uint16_t end = start + MEM_PAGE_MASK;
+
+    c->mem_rmap[page] = c->mem_page[page];
+    c->mem_wmap[page] = (c->mem_cow & (1 << page)) ? NULL : c->mem_page[page];
+
+    // a profiled CPU takes the slow path everywhere, where accesses are counted
+    if (c->prof != NULL)
+        c->mem_rmap[page] = c->mem_wmap[page] = NULL;
+
+    // and so does every write of a CPU under the differential checker
+    if (c->log_writes)
+        c->mem_wmap[page] = NULL;
+
+    for (int i = 0; i < mem_device_count; ++i)
+    {
+        if (mem_devices[i].end < start || mem_devices[i].start > end)
+            continue;
+
+        if (mem_devices[i].read != NULL)
+            c->mem_rmap[page] = NULL;
+        if (mem_devices[i].write != NULL)
+            c->mem_wmap[page] = NULL;
+    }
+}
+
+// every page of c reads as zero until written, without any storage of its own
+static void map_zero(struct cpu *c, int page)
+{
+    c->mem_ref[page] = &mem_zero;
+    c->mem_page[page] = mem_zero.data;
+    c->mem_cow |= 1 << page;
+    update_maps(c, page);
+}
+
+// give a CPU its own 64KB address space
+int mem_init_cpu(struct cpu *c)
+{
+    if (mem_sparse)
+    {
+        c->memory = NULL;
+        for (int i = 0; i < MEM_PAGES; ++i)
+            map_zero(c, i);
+
+        return 0;
+    }
+
+    // page aligned and zeroed, so single pages can be protected later
+    c->memory = mmap(NULL, MEMORY_MAX, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c->memory == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    for (int i = 0; i < MEM_PAGES; ++i)
+    {
+        c->mem_page[i] = &c->memory[i << MEM_PAGE_SHIFT];
+        update_maps(c, i);
+    }
+
+    return 0;
+}
+
+int mem_init(void)
+{
+    return mem_init_cpu(&cpu0);
+}
+
+// back a page of c with host storage shared with other CPUs
+void mem_map_shared(struct cpu *c, int page, uint8_t *host)
+{
+    c->mem_page[page] = host;
+    update_maps(c, page);
+}
+
+// a page with a copy of data, zeroed without. Pages are carved out of slabs and never go back to the system
+static struct mem_shared *shared_alloc(const uint8_t *data)
+{
+    struct mem_shared *s;
+
+    if (free_pages == NULL)
+    {
+        struct mem_shared *slab = malloc(MEM_SLAB_PAGES * sizeof(struct mem_shared));
+
+        if (slab == NULL)
+        {
+            fprintf(stderr, "Error: malloc failed\n");
+            exit(1);
+        }
+
+        for (int i = 0; i < MEM_SLAB_PAGES; ++i)
+        {
+            slab[i].next = free_pages;
+            free_pages = &slab[i];
+        }
+    }
+
+    s = free_pages;
+    free_pages = s->next;
+
+    atomic_init(&s->refs, 1);
+    if (data != NULL)
+        memcpy(s->data, data, MEM_PAGE_SIZE);
+    else
+        memset(s->data, 0, MEM_PAGE_SIZE);
+    return s;
+}
+
+// the zero page isn't counted, it's never written or freed
+static void shared_get(struct mem_shared *s)
+{
+    if (s != &mem_zero)
+        atomic_fetch_add(&s->refs, 1);
+}
+
+// freed pages go to the free list of the thread that dropped the last reference
+static void shared_put(struct mem_shared *s)
+{
+    if (s != &mem_zero && atomic_fetch_sub(&s->refs, 1) == 1)
+    {
+        s->next = free_pages;
+        free_pages = s;
+    }
+}
+
+/*
+ * make c a copy of src that shares all of its pages until either of them
+ * writes to one. Pages of src that aren't shared yet are moved into
+ * refcounted storage first, so only the first clone of a CPU copies
+ * memory. src must not be running meanwhile, the clones can run on any
+ * thread. Registers are left alone, see cpu_clone.
+ */
+void mem_clone(struct cpu *c, struct cpu *src)
+{
+    for (int i = 0; i < MEM_PAGES; ++i)
+    {
+        if (src->mem_ref[i] == NULL)
+        {
+            src->mem_ref[i] = shared_alloc(src->mem_page[i]);
+            src->mem_page[i] = src->mem_ref[i]->data;
+        }
+
+        shared_get(src->mem_ref[i]);
+        c->mem_ref[i] = src->mem_ref[i];
+        c->mem_page[i] = src->mem_ref[i]->data;
+    }
+
+    src->mem_cow = c->mem_cow = 0xFFFF;
+    c->memory = NULL;
+
+    for (int i = 0; i < MEM_PAGES; ++i)
+    {
+        update_maps(src, i);
+        update_maps(c, i);
+    }
+}
+
+/*
+ * all of memory back to zero: own storage is cleared, shared pages are
+ * dropped for the zero page, which for sparse memory and clones costs
+ * nothing but the pages that were written
+ */
+void mem_clear(struct cpu *c)
+{
+    for (int i = 0; i < MEM_PAGES; ++i)
+    {
+        if (c->mem_ref[i] != NULL)
+        {
+            shared_put(c->mem_ref[i]);
+            map_zero(c, i);
+        }
+        else
+            memset(c->mem_page[i], 0, MEM_PAGE_SIZE);
+    }
+}
+
+// drop the shared pages of c, the last CPU using a page frees it
+void mem_release(struct cpu *c)
+{
+    for (int i = 0; i < MEM_PAGES; ++i)
+    {
+        if (c->mem_ref[i] != NULL)
+            shared_put(c->mem_ref[i]);
+
+        c->mem_ref[i] = NULL;
+    }
+}
+
+// give c a private copy of a shared page, or the page itself once nobody else uses it
+static void cow_break(struct cpu *c, int page)
+{
+    struct mem_shared *s = c->mem_ref[page];
+
+    if (s == &mem_zero)
+    {
+        c->mem_ref[page] = shared_alloc(NULL);
+        c->mem_page[page] = c->mem_ref[page]->data;
+    }
+    else if (atomic_load(&s->refs) > 1)
+    {
+        c->mem_ref[page] = shared_alloc(s->data);
+        c->mem_page[page] = c->mem_ref[page]->data;
+        shared_put(s);
+    }
+
+    c->mem_cow &= ~(1 << page);
+    update_maps(c, page);
+}
+
+int mem_map_device(uint16_t start, uint16_t end, MemReadFunc read, MemWriteFunc write)
+{
+    if (mem_device_count >= MEM_MAX_DEVICES)
+    {
+        fprintf(stderr, "Error: too many memory-mapped devices\n");
+        return -1;
+    }
+
+    mem_devices[mem_device_count].start = start;
+    mem_devices[mem_device_count].end = end;
+    mem_devices[mem_device_count].read = read;
+    mem_devices[mem_device_count].write = write;
+    mem_device_count++;
+
+    for (int i = start >> MEM_PAGE_SHIFT; i <= end >> MEM_PAGE_SHIFT; ++i)
+        update_maps(cpu, i);
+
+    return 0;
+}
+
+// start or stop counting the accesses of c
+void mem_profile(struct cpu *c, struct mem_prof *p)
+{
+    c->prof = p;
+
+    for (int i = 0; i < MEM_PAGES; ++i)
+        update_maps(c, i);
+}
+
+// start or stop hashing the writes of c
+void mem_log_writes(struct cpu *c, int on)
+{
+    c->log_writes = on;
+
+    for (int i = 0; i < MEM_PAGES; ++i)
+        update_maps(c, i);
+}
+
+// read through devices and mapped storage, not counted by the profiler
+uint8_t mem_fetch(uint16_t addr)
+{
+    for (int i = 0; i < mem_device_count; ++i)
+    {
+        struct mem_device *d = &mem_devices[i];
+
+        if (addr >= d->start && addr <= d->end && d->read != NULL)
+            return d->read(addr);
+    }
+
+    return cpu->mem_page[addr >> MEM_PAGE_SHIFT][addr & MEM_PAGE_MASK];
+}
+
+uint8_t mem_read_slow(uint16_t addr)
+{
+    if (cpu->prof != NULL)
+        cpu->prof->reads[addr >> PROF_SHIFT]++;
+
+    return mem_fetch(addr);
+}
+
+void mem_write_slow(uint16_t addr, uint8_t val)
+{
+    if (cpu->prof != NULL)
+        cpu->prof->writes[addr >> PROF_SHIFT]++;
+
+    if (cpu->log_writes)
+    {
+        cpu->write_hash = (cpu->write_hash ^ (addr & 0xFF)) * 0x100000001B3ULL;
+        cpu->write_hash = (cpu->write_hash ^ (addr >> 8)) * 0x100000001B3ULL;
+        cpu->write_hash = (cpu->write_hash ^ val) * 0x100000001B3ULL;
+    }
+
+    for (int i = 0; i < mem_device_count; ++i)
+    {
+        struct mem_device *d = &mem_devices[i];
+
+        if (addr >= d->start && addr <= d->end && d->write != NULL)
+        {
+            d->write(addr, val);
+            return;
+        }
+    }
+
+    if (cpu->mem_cow & (1 << (addr >> MEM_PAGE_SHIFT)))
+        cow_break(cpu, addr >> MEM_PAGE_SHIFT);
+
+    cpu->mem_page[addr >> MEM_PAGE_SHIFT][addr & MEM_PAGE_MASK] = val;
+}
+
+// raw access to the currently mapped storage, bypassing devices
+uint8_t mem_peek(uint16_t addr)
+{
+    return cpu->mem_page[addr >> MEM_PAGE_SHIFT][addr & MEM_PAGE_MASK];
+}
+
+static int find_protected(const uint8_t *host)
+{
+    for (int i = 0; i < mem_prot_count; ++i)
+        if (host >= mem_prot[i].host && host < mem_prot[i].host + MEM_PAGE_SIZE)
+            return i;
+
+    return -1;
+}
+
+// make a protected page writable again and forget about it
+static void unprotect(int idx)
+{
+    mprotect(mem_prot[idx].host, MEM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+    if (mem_prot[idx].kind == FAULT_CODE)
+        code_dirty[mem_prot[idx].guest >> MEM_PAGE_SHIFT] = 1;
+
+    mem_prot[idx] = mem_prot[--mem_prot_count];
+}
+
+void mem_poke(uint16_t addr, uint8_t val)
+{
+    if (mem_prot_count)
+    {
+        uint8_t *host = &cpu->mem_page[addr >> MEM_PAGE_SHIFT][addr & MEM_PAGE_MASK];
+        int idx = find_protected(host);
+
+        if (idx >= 0 && mem_prot[idx].kind == FAULT_STACK)
+        {
+            mprotect(guard_host, MEM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+            *host = val;
+            mprotect(guard_host, MEM_PAGE_SIZE, PROT_READ);
+            return;
+        }
+
+        if (idx >= 0)
+            unprotect(idx);
+    }
+
+    if (cpu->mem_cow & (1 << (addr >> MEM_PAGE_SHIFT)))
+        cow_break(cpu, addr >> MEM_PAGE_SHIFT);
+
+    cpu->mem_page[addr >> MEM_PAGE_SHIFT][addr & MEM_PAGE_MASK] = val;
+}
+
+void mem_load(uint16_t addr, const uint8_t *buf, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; ++i)
+        mem_poke(addr + i, buf[i]);
+}
+
+// copy of the 64KB the CPU currently sees, used for snapshots
+void mem_save_view(uint8_t *buf)
+{
+    for (int i = 0; i < MEM_PAGES; ++i)
+        memcpy(buf + (i << MEM_PAGE_SHIFT), cpu->mem_page[i], MEM_PAGE_SIZE);
+}
+
+void mem_restore_view(const uint8_t *buf)
+{
+    // unchanged pages are skipped so read-only code isn't written to
+    for (int i = 0; i < MEM_PAGES; ++i)
+    {
+        if (memcmp(cpu->mem_page[i], buf + (i << MEM_PAGE_SHIFT), MEM_PAGE_SIZE) == 0)
+            continue;
+
+        if (cpu->mem_cow & (1 << i))
+            cow_break(cpu, i);
+
+        if (cpu->mem_page[i] == guard_host)
+        {
+            mprotect(guard_host, MEM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+            memcpy(cpu->mem_page[i], buf + (i << MEM_PAGE_SHIFT), MEM_PAGE_SIZE);
+            mprotect(guard_host, MEM_PAGE_SIZE, PROT_READ);
+            continue;
+        }
+
+        memcpy(cpu->mem_page[i], buf + (i << MEM_PAGE_SHIFT), MEM_PAGE_SIZE);
+    }
+}
+
+static uint8_t bank_reg_read(uint16_t addr)
+{
+    (void)addr;
+    return bank_selected;
+}
+
+static void bank_reg_write(uint16_t addr, uint8_t val)
+{
+    (void)addr;
+    bank_select(val);
+}
+
+/*
+ * banks: number of banks behind the window [start, end], which must be
+ * aligned to 4KB pages. The bank-select register at select_addr is readable
+ * and writable by the program; selecting a bank only swaps page pointers.
+ */
+int bank_init(int banks, uint16_t start, uint16_t end, uint16_t select_addr)
+{
+    uint32_t window_size = (uint32_t)end - start + 1;
+
+    if (banks < 2 || banks > MEM_MAX_BANKS)
+    {
+        fprintf(stderr, "Error: bank count must be between 2 and %d\n", MEM_MAX_BANKS);
+        return -1;
+    }
+
+    if ((start & MEM_PAGE_MASK) != 0 || ((end + 1) & MEM_PAGE_MASK) != 0 || end < start)
+    {
+        fprintf(stderr, "Error: bank window must be aligned to %d byte pages\n", MEM_PAGE_SIZE);
+        return -1;
+    }
+
+    if (select_addr >= start && select_addr <= end)
+    {
+        fprintf(stderr, "Error: bank select register can't be inside the bank window\n");
+        return -1;
+    }
+
+    bank_store_size = (size_t)banks * window_size;
+    bank_store = mmap(NULL, bank_store_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bank_store == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    bank_count = banks;
+    bank_first_page = start >> MEM_PAGE_SHIFT;
+    bank_last_page = end >> MEM_PAGE_SHIFT;
+
+    if (mem_map_device(select_addr, select_addr, &bank_reg_read, &bank_reg_write) < 0)
+        return -1;
+
+    bank_select(0);
+    return 0;
+}
+
+void bank_select(uint8_t bank)
+{
+    uint32_t window_size = (bank_last_page - bank_first_page + 1) << MEM_PAGE_SHIFT;
+    uint8_t *base;
+
+    if (bank_count == 0)
+        return;
+
+    bank_selected = bank % bank_count;
+    base = bank_store + bank_selected * window_size;
+
+    for (int i = bank_first_page; i <= bank_last_page; ++i)
+    {
+        cpu->mem_page[i] = base + ((i - bank_first_page) << MEM_PAGE_SHIFT);
+        update_maps(cpu, i);
+    }
+}
+
+// bank currently mapped at addr, -1 if addr isn't banked
+int bank_of(uint16_t addr)
+{
+    int page = addr >> MEM_PAGE_SHIFT;
+
+    if (bank_count == 0 || page < bank_first_page || page > bank_last_page)
+        return -1;
+
+    return bank_selected;
+}
+
+uint8_t bank_peek(int bank, uint16_t addr)
+{
+    uint32_t window_size = (bank_last_page - bank_first_page + 1) << MEM_PAGE_SHIFT;
+    uint32_t offset = addr - (bank_first_page << MEM_PAGE_SHIFT);
+
+    return bank_store[bank * window_size + offset];
+}
+
+static void protect(uint8_t *host, uint16_t guest, uint8_t kind)
+{
+    if (find_protected(host) >= 0 || mem_prot_count >= MEM_MAX_PROTECTED)
+        return;
+
+    if (mprotect(host, MEM_PAGE_SIZE, PROT_READ) < 0)
+    {
+        perror("mprotect");
+        return;
+    }
+
+    mem_prot[mem_prot_count].host = host;
+    mem_prot[mem_prot_count].guest = guest;
+    mem_prot[mem_prot_count].kind = kind;
+    mem_prot_count++;
+}
+
+/*
+ * a write to a read-only page lands here. The page is made writable so the
+ * faulting store completes when the handler returns; stack and strict code
+ * faults then stop the CPU loop after the current instruction. Only pushes,
+ * calls and XTHL around SP count as a stack overflow, other writes to the
+ * guard page are data and go through. Either way the CPU loop stops after
+ * the instruction so cpu_run can arm the guard again, and goes on for data.
+ */
+static void segv_handler(int sig, siginfo_t *info, void *ctx)
+{
+    int idx = find_protected((uint8_t *)info->si_addr);
+    (void)ctx;
+
+    // not ours - crash as usual
+    if (idx < 0)
+    {
+        signal(sig, SIG_DFL);
+        return;
+    }
+
+    mem_fault_addr = mem_prot[idx].guest + ((uint8_t *)info->si_addr - mem_prot[idx].host);
+
+    if (mem_prot[idx].kind == FAULT_STACK)
+    {
+        if ((uint16_t)(mem_fault_addr - cpu->SP + 2) <= 3)
+            mem_fault = FAULT_STACK;
+
+        mprotect(guard_host, MEM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+        guard_open = 1;
+        cpu->running = 0;
+        return;
+    }
+
+    if (mem_prot[idx].kind == FAULT_CODE && mem_prot_mode == MEM_PROT_SMC)
+        smc_writes++;
+    else
+    {
+        mem_fault = mem_prot[idx].kind;
+        cpu->running = 0;
+    }
+
+    unprotect(idx);
+}
+
+/*
+ * guard the page below the stack segment and install the fault handler. The
+ * 16-bit SP wraps at the top, so overflow can only run into the guard.
+ */
+int mem_protect_init(int mode)
+{
+    struct sigaction sa;
+    uint16_t guard = STACK_SEGMENT_START - MEM_PAGE_SIZE;
+
+    if (sysconf(_SC_PAGESIZE) != MEM_PAGE_SIZE)
+    {
+        fprintf(stderr, "Error: memory protection needs %d byte host pages\n", MEM_PAGE_SIZE);
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &segv_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, NULL) < 0)
+    {
+        perror("sigaction");
+        return -1;
+    }
+
+    mem_prot_mode = mode;
+    guard_host = cpu->mem_page[guard >> MEM_PAGE_SHIFT];
+    protect(guard_host, guard, FAULT_STACK);
+    return 0;
+}
+
+/*
+ * after the run loop stopped: protect the guard page again if a write
+ * opened it, 1 if that write was data and the run has to go on
+ */
+int mem_guard_rearm(void)
+{
+    if (!guard_open)
+        return 0;
+
+    guard_open = 0;
+    mprotect(guard_host, MEM_PAGE_SIZE, PROT_READ);
+
+    if (mem_fault != FAULT_NONE)
+        return 0;
+
+    cpu->running = 1;
+    return 1;
+}
+
+// make the pages holding [start, start + len) read-only
+void mem_protect_code(uint16_t start, uint32_t len)
+{
+    if (mem_prot_mode == MEM_PROT_OFF || len == 0)
+        return;
+
+    for (uint32_t p = start >> MEM_PAGE_SHIFT; p <= (start + len - 1) >> MEM_PAGE_SHIFT && p < MEM_PAGES; ++p)
+        protect(cpu->mem_page[p], p << MEM_PAGE_SHIFT, FAULT_CODE);
+}
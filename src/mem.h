@@ -0,0 +1,107 @@
+#ifndef MEM_H_
+#define MEM_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "cpu.h"
+
+#define MEM_MAX_DEVICES 16
+#define MEM_MAX_BANKS 256
+#define MEM_MAX_PROTECTED (MEM_PAGES + 1)
+#define MEM_SLAB_PAGES 64       // pages a thread takes from the system at once for sparse memory
+
+// what a write to a read-only code page does
+enum
+{
+    MEM_PROT_OFF = 0,
+    MEM_PROT_STRICT,    // stop with an error
+    MEM_PROT_SMC        // allow it and mark the page as modified code
+};
+
+// faults raised by protected pages
+enum
+{
+    FAULT_NONE = 0,
+    FAULT_STACK,
+    FAULT_CODE
+};
+
+typedef uint8_t (*MemReadFunc) (uint16_t addr);
+typedef void (*MemWriteFunc) (uint16_t addr, uint8_t val);
+
+// storage of a page shared by cloned CPUs, freed with its last user
+struct mem_shared
+{
+    atomic_int refs;
+    struct mem_shared *next;    // free list link
+    uint8_t data[MEM_PAGE_SIZE];
+};
+
+// memory-mapped device covering [start, end]
+struct mem_device
+{
+    uint16_t start;
+    uint16_t end;
+    MemReadFunc read;       // NULL -> reads go to memory
+    MemWriteFunc write;     // NULL -> writes go to memory
+};
+
+extern int bank_count;
+extern uint8_t bank_selected;
+
+extern int mem_prot_mode;
+extern int mem_sparse;
+extern volatile int mem_fault;
+extern volatile uint16_t mem_fault_addr;
+extern uint8_t code_dirty[MEM_PAGES];
+extern volatile uint32_t smc_writes;
+
+int mem_init(void);
+int mem_init_cpu(struct cpu *c);
+void mem_map_shared(struct cpu *c, int page, uint8_t *host);
+void mem_clone(struct cpu *c, struct cpu *src);
+void mem_release(struct cpu *c);
+void mem_clear(struct cpu *c);
+int mem_map_device(uint16_t start, uint16_t end, MemReadFunc read, MemWriteFunc write);
+void mem_profile(struct cpu *c, struct mem_prof *p);
+void mem_log_writes(struct cpu *c, int on);
+uint8_t mem_fetch(uint16_t addr);
+uint8_t mem_read_slow(uint16_t addr);
+void mem_write_slow(uint16_t addr, uint8_t val);
+
+uint8_t mem_peek(uint16_t addr);
+void mem_poke(uint16_t addr, uint8_t val);
+void mem_load(uint16_t addr, const uint8_t *buf, uint32_t len);
+void mem_save_view(uint8_t *buf);
+void mem_restore_view(const uint8_t *buf);
+
+int bank_init(int banks, uint16_t start, uint16_t end, uint16_t select_addr);
+void bank_select(uint8_t bank);
+int bank_of(uint16_t addr);
+uint8_t bank_peek(int bank, uint16_t addr);
+
+int mem_protect_init(int mode);
+void mem_protect_code(uint16_t start, uint32_t len);
+int mem_guard_rearm(void);
+
+static inline uint8_t mem_read(uint16_t addr)
+{
+    uint8_t *p = cpu->mem_rmap[addr >> MEM_PAGE_SHIFT];
+
+    if (p != NULL)
+        return p[addr & MEM_PAGE_MASK];
+
+    return mem_read_slow(addr);
+}
+
+static inline void mem_write(uint16_t addr, uint8_t val)
+{
+    uint8_t *p = cpu->mem_wmap[addr >> MEM_PAGE_SHIFT];
+
+    if (p != NULL)
+        p[addr & MEM_PAGE_MASK] = val;
+    else
+        mem_write_slow(addr, val);
+}
+
+#endif /* MEM_H_ */
@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <limits.h>
+
+#include "native.h"
+#include "aot.h"
+#include "cpu.h"
+#include "mem.h"
+#include "hle.h"
+#include "opcodes.h"
+#include "perf.h"
+
+uint8_t native_index[MEMORY_MAX];
+
+static AotEntryFunc native_entry = NULL;
+static const uint8_t *native_image;
+static uint16_t native_start;
+static uint32_t native_len;
+static const uint16_t *native_blocks;
+static uint32_t native_count;
+static const void **native_code;
+
+// a compiled block in host memory
+struct host_block
+{
+    uintptr_t addr;
+    uint16_t guest;
+};
+
+static const struct aot_host native_host =
+{
+    &mem_read_slow,
+    &mem_write_slow,
+    hle_index,
+    &hle_call,
+    code_dirty
+};
+
+static void *lookup(void *lib, const char *path, const char *name)
+{
+    void *sym = dlsym(lib, name);
+
+    if (sym == NULL)
+        fprintf(stderr, "Error: %s has no symbol %s, not built by 8085aot?\n", path, name);
+
+    return sym;
+}
+
+// load a shared object built by 8085aot
+int native_load(const char *path)
+{
+    char buf[PATH_MAX];
+    void *lib;
+    const uint32_t *version, *cpu_size, *len, *count;
+    const uint16_t *start, *blocks;
+
+    // a bare file name would make dlopen search the library path
+    if (strchr(path, '/') == NULL)
+    {
+        snprintf(buf, sizeof(buf), "./%s", path);
+        path = buf;
+    }
+
+    lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL)
+    {
+        fprintf(stderr, "Error: %s\n", dlerror());
+        return -1;
+    }
+
+    if ((version = lookup(lib, path, AOT_SYM_VERSION)) == NULL
+        || (cpu_size = lookup(lib, path, AOT_SYM_CPU_SIZE)) == NULL
+        || (native_entry = lookup(lib, path, AOT_SYM_ENTRY)) == NULL
+        || (blocks = lookup(lib, path, AOT_SYM_BLOCKS)) == NULL
+        || (count = lookup(lib, path, AOT_SYM_BLOCK_COUNT)) == NULL
+        || (native_code = lookup(lib, path, AOT_SYM_BLOCK_CODE)) == NULL
+        || (native_image = lookup(lib, path, AOT_SYM_IMAGE)) == NULL
+        || (start = lookup(lib, path, AOT_SYM_IMAGE_START)) == NULL
+        || (len = lookup(lib, path, AOT_SYM_IMAGE_LEN)) == NULL)
+        return -1;
+
+    if (*version != AOT_ABI_VERSION || *cpu_size != sizeof(struct cpu))
+    {
+        fprintf(stderr, "Error: %s was built for a different version of 8085vm\n", path);
+        return -1;
+    }
+
+    native_start = *start;
+    native_len = *len;
+    native_blocks = blocks;
+    native_count = *count;
+
+    for (uint32_t i = 0; i < *count; ++i)
+        native_index[blocks[i]] = 1;
+
+    return 0;
+}
+
+// 1 if the memory of the calling CPU holds the program the object was built from
+int native_match(void)
+{
+    if (native_entry == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < native_len; ++i)
+        if (mem_peek(native_start + i) != native_image[i])
+            return 0;
+
+    return 1;
+}
+
+static int by_host_addr(const void *a, const void *b)
+{
+    uintptr_t x = ((const struct host_block *)a)->addr, y = ((const struct host_block *)b)->addr;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * describe the compiled blocks to perf. They are all in the entry function,
+ * so a block is taken to run up to the next one in host memory.
+ */
+int native_perf(void)
+{
+    struct host_block *hb;
+    const ElfW(Sym) *sym;
+    Dl_info info;
+    uintptr_t end;
+    char name[PERF_MAX_NAME + 16];
+
+    if (native_entry == NULL)
+        return 0;
+
+    if (dladdr1((void *)native_entry, &info, (void **)&sym, RTLD_DL_SYMENT) == 0 || sym == NULL)
+    {
+        fprintf(stderr, "Error: no symbol information for the compiled code\n");
+        return -1;
+    }
+
+    if ((hb = malloc(native_count * sizeof(*hb))) == NULL)
+    {
+        fprintf(stderr, "Error: malloc failed\n");
+        return -1;
+    }
+
+    native_entry(NULL, 0, NULL);
+    for (uint32_t i = 0; i < native_count; ++i)
+    {
+        hb[i].addr = (uintptr_t)native_code[i];
+        hb[i].guest = native_blocks[i];
+    }
+    qsort(hb, native_count, sizeof(*hb), &by_host_addr);
+
+    end = (uintptr_t)info.dli_saddr + sym->st_size;
+    for (uint32_t i = 0; i < native_count; ++i)
+    {
+        uintptr_t next = i + 1 < native_count ? hb[i + 1].addr : end;
+
+        // blocks the compiler merged or moved out of the function
+        if (next <= hb[i].addr || hb[i].addr < (uintptr_t)info.dli_saddr || next > end)
+            continue;
+
+        perf_guest_name(name, sizeof(name), hb[i].guest);
+        perf_jit_code(name, (const void *)hb[i].addr, next - hb[i].addr);
+    }
+
+    free(hb);
+    return 0;
+}
+
+void native_run(uint64_t limit)
+{
+    native_entry(cpu, limit, &native_host);
+}
+
+#define DIFF_MAX_BLOCK 64       // instructions of a diverging block listed in the report
+
+// what the checker compares after every block
+struct diff_state
+{
+    uint8_t regs[R_COUNT];
+    uint8_t flags;
+    uint8_t running;
+    uint8_t trap;
+    uint16_t PC;
+    uint16_t SP;
+    uint64_t cycles;
+    uint64_t write_hash;
+};
+
+static void get_state(const struct cpu *c, struct diff_state *s)
+{
+    memcpy(s->regs, c->regs, R_COUNT);
+    s->regs[R_MEM] = 0;
+    s->flags = c->flags;
+    s->running = c->running;
+    s->trap = c->trap;
+    s->PC = c->PC;
+    s->SP = c->SP;
+    s->cycles = c->cycles;
+    s->write_hash = c->write_hash;
+}
+
+static int same_state(const struct diff_state *a, const struct diff_state *b)
+{
+    return memcmp(a->regs, b->regs, R_COUNT) == 0 && a->flags == b->flags && a->running == b->running
+        && a->trap == b->trap && a->PC == b->PC && a->SP == b->SP && a->cycles == b->cycles
+        && a->write_hash == b->write_hash;
+}
+
+static void print_state(const char *what, const struct diff_state *s)
+{
+    fprintf(stderr, "%-12s PC=%04X SP=%04X A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X F=%02X cycles=%llu writes=%016llx%s%s\n",
+        what, s->PC, s->SP, s->regs[R_A], s->regs[R_B], s->regs[R_C], s->regs[R_D], s->regs[R_E],
+        s->regs[R_H], s->regs[R_L], s->flags, (unsigned long long)s->cycles, (unsigned long long)s->write_hash,
+        s->running ? "" : " halted", s->trap ? " trapped" : "");
+}
+
+// the instructions the interpreter ran for the block, the states and the memory that differs
+static void report(const struct cpu *ref, const uint16_t *pcs, const uint8_t *ops, int n, uint64_t block,
+    const struct diff_state *pre, const struct diff_state *fast, const struct diff_state *slow)
+{
+    fprintf(stderr, "Error: block %llu at 0x%04X diverged\n", (unsigned long long)block, pre->PC);
+
+    for (int i = 0; i < n && i < DIFF_MAX_BLOCK; ++i)
+        fprintf(stderr, "  0x%04X: %s\n", pcs[i], name_table[ops[i]] ? name_table[ops[i]] : "undefined");
+    if (n > DIFF_MAX_BLOCK)
+        fprintf(stderr, "  ... %d more\n", n - DIFF_MAX_BLOCK);
+
+    print_state("before", pre);
+    print_state("native", fast);
+    print_state("interpreter", slow);
+
+    if (fast->write_hash == slow->write_hash)
+        return;
+
+    for (int p = 0; p < MEM_PAGES; ++p)
+        for (int i = 0; i < MEM_PAGE_SIZE; ++i)
+            if (cpu0.mem_page[p][i] != ref->mem_page[p][i])
+                fprintf(stderr, "0x%04X: native 0x%02X, interpreter 0x%02X\n", (p << MEM_PAGE_SHIFT) | i,
+                    cpu0.mem_page[p][i], ref->mem_page[p][i]);
+}
+
+/*
+ * run the loaded program with the compiled blocks and, on a second CPU
+ * with its own memory, interpreted. After every compiled block (or
+ * interpreted instruction) the interpreter is run up to the same cycle
+ * count and the registers, flags, PC, SP, cycles and a hash of the memory
+ * writes of both have to match. Returns the number of differences.
+ */
+int native_validate(uint64_t max_cycles)
+{
+    static struct cpu ref;
+    struct diff_state pre, fast, slow;
+    uint16_t pcs[DIFF_MAX_BLOCK];
+    uint8_t ops[DIFF_MAX_BLOCK];
+    uint8_t *view;
+    uint64_t limit = cpu0.cycles + max_cycles, blocks = 0;
+    int fast_ret, slow_ret, diffs = 0;
+
+    if (!cpu0.native)
+    {
+        fprintf(stderr, "Error: the program doesn't match the compiled image\n");
+        return -1;
+    }
+
+    if (mem_init_cpu(&ref) < 0)
+        return -1;
+
+    if ((view = malloc(MEMORY_MAX)) == NULL)
+    {
+        fprintf(stderr, "Error: malloc failed\n");
+        return -1;
+    }
+
+    // through the views, so a sparse interpreter only gets the pages that aren't zero
+    mem_save_view(view);
+    cpu = &ref;
+    mem_restore_view(view);
+    cpu = &cpu0;
+    free(view);
+
+    memcpy(ref.regs, cpu0.regs, R_COUNT);
+    ref.flags = cpu0.flags;
+    ref.PC = cpu0.PC;
+    ref.SP = cpu0.SP;
+    ref.cycles = cpu0.cycles;
+    ref.running = cpu0.running;
+    ref.im = cpu0.im;
+    ref.id = 1;
+
+    mem_log_writes(&cpu0, 1);
+    mem_log_writes(&ref, 1);
+
+    do
+    {
+        int n = 0;
+
+        get_state(&cpu0, &pre);
+
+        // one compiled block, or one instruction where there is none
+        cpu = &cpu0;
+        fast_ret = cpu_run(1);
+
+        cpu = &ref;
+        do
+        {
+            if (n < DIFF_MAX_BLOCK)
+            {
+                pcs[n] = ref.PC;
+                ops[n] = mem_peek(ref.PC);
+            }
+            n++;
+            slow_ret = cpu_run(1);
+        }
+        while (slow_ret == RUN_LIMIT && ref.cycles < cpu0.cycles);
+
+        get_state(&cpu0, &fast);
+        get_state(&ref, &slow);
+        blocks++;
+
+        if (fast_ret != slow_ret || !same_state(&fast, &slow))
+        {
+            report(&ref, pcs, ops, n, blocks, &pre, &fast, &slow);
+            diffs++;
+            break;
+        }
+    }
+    while (fast_ret == RUN_LIMIT && cpu0.cycles < limit);
+
+    cpu = &cpu0;
+    mem_log_writes(&cpu0, 0);
+
+    // the hash could only miss a difference by collision, memory is compared once at the end
+    for (int p = 0; p < MEM_PAGES && diffs == 0; ++p)
+        for (int i = 0; i < MEM_PAGE_SIZE; ++i)
+            if (cpu0.mem_page[p][i] != ref.mem_page[p][i])
+            {
+                fprintf(stderr, "0x%04X: native 0x%02X, interpreter 0x%02X\n", (p << MEM_PAGE_SHIFT) | i,
+                    cpu0.mem_page[p][i], ref.mem_page[p][i]);
+                diffs++;
+            }
+
+    if (diffs == 0)
+        printf("%llu blocks checked\n", (unsigned long long)blocks);
+
+    return diffs;
+}
@@ -0,0 +1,15 @@
+#ifndef NATIVE_H_
+#define NATIVE_H_
+
+#include <stdint.h>
+#include "cpu.h"
+
+extern uint8_t native_index[MEMORY_MAX];    // 1 where a compiled block starts
+
+int native_load(const char *path);
+int native_match(void);
+void native_run(uint64_t limit);
+int native_perf(void);
+int native_validate(uint64_t max_cycles);
+
+#endif /* NATIVE_H_ */
@@ -5,24 +5,34 @@
 
 #include "opcodes.h"
 #include "cpu.h"
+#include "mem.h"
+#include "hle.h"
+#include "io.h"
+#include "rr.h"
+#ifdef INSTRUMENT
+#include "instr.h"
+#endif
 
-InstrFunc opcode_table[256];
+// templates are inlined into every handler, so the operands fold into constants
+#define TEMPLATE static inline __attribute__((always_inline))
 
-void update_flags(uint16_t res, uint8_t op_type)
+int undef_policy = UNDEF_TRAP;
+
+TEMPLATE void update_flags(uint16_t res, uint8_t op_type)
 {
     // carry flag (CY)
     switch (op_type)
     {
         case OP_ARITHMETIC:
             if (res & 0x0100)
-                flags |= FL_CY;
+                cpu->flags |= FL_CY;
             else
-                flags &= ~FL_CY;
+                cpu->flags &= ~FL_CY;
             break;
 
         // logical ops always clear CY
         case OP_LOGICAL:
-            flags &= ~FL_CY;
+            cpu->flags &= ~FL_CY;
             break;
 
         // INR and DCR don't touch CY
@@ -36,625 +46,604 @@ void update_flags(uint16_t res, uint8_t op_type)
         if (res & (1 << i)) count++;
 
     if (count & 1)
-        flags &= ~FL_P;
+        cpu->flags &= ~FL_P;
     else
-        flags |= FL_P; 
+        cpu->flags |= FL_P; 
 
     // zero flag (Z)
     if ((res & 0x00FF) == 0)
-        flags |= FL_Z;
+        cpu->flags |= FL_Z;
     else
-        flags &= ~FL_Z;
+        cpu->flags &= ~FL_Z;
 
     // sign flag (S)
     if (res & 0x0080)
-        flags |= FL_S;
+        cpu->flags |= FL_S;
     else
-        flags &= ~FL_S;
+        cpu->flags &= ~FL_S;
 
 }
 
-void op_mov(void)
+// auxiliary carry (AC), carry out of bit 3
+TEMPLATE void set_ac(int ac)
 {
-    uint8_t src = opcode & 0x07;
-    uint8_t dst = (opcode >> 3) & 0x07;
-
-    if (src == R_MEM)
-        regs[dst] = memory[(regs[R_H] << 8) | regs[R_L]];
-    else if (dst == R_MEM)
-        memory[(regs[R_H] << 8) | regs[R_L]] = regs[src];
+    if (ac)
+        cpu->flags |= FL_AC;
     else
-        regs[dst] = regs[src];
+        cpu->flags &= ~FL_AC;
 }
 
-void op_mvi(void)
+// A + data + carry in, all flags
+TEMPLATE uint8_t alu_add(uint8_t data, uint8_t carry)
 {
-    uint8_t dst = (opcode >> 3) & 0x07;
-    
-    if (dst == R_MEM)
-        memory[(regs[R_H] << 8) | regs[R_L]] = memory[PC++];
+    uint16_t res = cpu->regs[R_A] + data + carry;
+
+    update_flags(res, OP_ARITHMETIC);
+    set_ac((cpu->regs[R_A] ^ data ^ res) & 0x10);
+    return res;
+}
+
+// A - data - borrow in, all flags. AC is the carry of A + ~data + !borrow
+TEMPLATE uint8_t alu_sub(uint8_t data, uint8_t borrow)
+{
+    uint16_t res = (uint16_t)(cpu->regs[R_A] - data - borrow);
+
+    update_flags(res, OP_ARITHMETIC);
+    set_ac(!((cpu->regs[R_A] ^ data ^ res) & 0x10));
+    return res;
+}
+
+// PSW is kept in the pair slot of SP, SP on its own
+TEMPLATE uint16_t read_rp(int rp)
+{
+    if (rp == RP_SP)
+        return cpu->SP;
+
+    return cpu->pairs[rp == RP_PSW ? RP_SP : rp];
+}
+
+TEMPLATE void write_rp(int rp, uint16_t val)
+{
+    if (rp == RP_SP)
+        cpu->SP = val;
     else
-        regs[dst] = memory[PC++];
+        cpu->pairs[rp == RP_PSW ? RP_SP : rp] = val;
 }
 
-void op_add(void)
+// source operand of the register/memory forms
+TEMPLATE uint8_t read_src(int src)
 {
-    uint8_t src = opcode & 0x07;
-    uint8_t data;
-    uint16_t res;
+    if (src == R_MEM)
+        return mem_read(cpu->HL);
+
+    return cpu->regs[src];
+}
+
+TEMPLATE int cond_taken(int cond)
+{
+    switch (cond)
+    {
+        case COND_NZ:
+            return (cpu->flags & FL_Z) == 0;
 
-    uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-    data = (src == R_MEM) ? memory[addr] : regs[src];
+        case COND_Z:
+            return cpu->flags & FL_Z;
 
-    res = regs[R_A] + data;
-    regs[R_A] = (uint8_t)res;      
+        case COND_NC:
+            return (cpu->flags & FL_CY) == 0;
 
-    update_flags(res, OP_ARITHMETIC);
+        case COND_C:
+            return cpu->flags & FL_CY;
+
+        case COND_PO:
+            return (cpu->flags & FL_P) == 0;
+
+        case COND_PE:
+            return cpu->flags & FL_P;
+
+        case COND_P:
+            return (cpu->flags & FL_S) == 0;
+
+        case COND_M:
+            return cpu->flags & FL_S;
+
+        default:
+            return 1;
+    }
 }
 
-void op_adc(void)
+TEMPLATE uint16_t read_addr(void)
 {
-    uint8_t src = opcode & 0x07;
-    uint8_t data;
-    uint16_t res;
+    uint8_t addr_low = mem_read(cpu->PC++);
+    uint8_t addr_high = mem_read(cpu->PC++);
 
-    uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-    data = (src == R_MEM) ? memory[addr] : regs[src];
+    return (addr_high << 8) | addr_low;
+}
 
-    res = regs[R_A] + data + ((flags & FL_CY) ? 1 : 0);
-    regs[R_A] = (uint8_t)res;      
+TEMPLATE void i_mov(int dst, int src)
+{
+    if (src == R_MEM)
+        cpu->regs[dst] = mem_read(cpu->HL);
+    else if (dst == R_MEM)
+        mem_write(cpu->HL, cpu->regs[src]);
+    else
+        cpu->regs[dst] = cpu->regs[src];
+}
 
-    update_flags(res, OP_ARITHMETIC);
+TEMPLATE void i_mvi(int dst)
+{
+    if (dst == R_MEM)
+        mem_write(cpu->HL, mem_read(cpu->PC++));
+    else
+        cpu->regs[dst] = mem_read(cpu->PC++);
+}
+
+TEMPLATE void i_add(int src)
+{
+    cpu->regs[R_A] = alu_add(read_src(src), 0);
+}
+
+TEMPLATE void i_adc(int src)
+{
+    cpu->regs[R_A] = alu_add(read_src(src), cpu->flags & FL_CY);
+}
+
+TEMPLATE void i_sub(int src)
+{
+    cpu->regs[R_A] = alu_sub(read_src(src), 0);
 }
 
-void op_inr(void)
+TEMPLATE void i_sbb(int src)
+{
+    cpu->regs[R_A] = alu_sub(read_src(src), cpu->flags & FL_CY);
+}
+
+TEMPLATE void i_inr(int dst)
 {
-    uint8_t dst = (opcode >> 3) & 0x07;
     uint16_t res;
 
     if (dst == R_MEM)
     {
-        uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-        res = memory[addr] + 1;
-        memory[addr]++;
+        uint16_t addr = cpu->HL;
+        res = mem_read(addr) + 1;
+        mem_write(addr, res);
     }
 
     else
     {
-        res = regs[dst] + 1;
-        regs[dst]++;
+        res = cpu->regs[dst] + 1;
+        cpu->regs[dst]++;
     }
 
     update_flags(res, OP_INRDCR);
+    set_ac((res & 0x0F) == 0);
 }
 
-void op_dcr(void)
+TEMPLATE void i_dcr(int dst)
 {
-    uint8_t dst = (opcode >> 3) & 0x07;
     uint16_t res;
 
     if (dst == R_MEM)
     {
-        uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-        res = memory[addr] - 1;
-        memory[addr]--;
+        uint16_t addr = cpu->HL;
+        res = mem_read(addr) - 1;
+        mem_write(addr, res);
     }
 
     else
     {
-        res = regs[dst] - 1;
-        regs[dst]--;
+        res = cpu->regs[dst] - 1;
+        cpu->regs[dst]--;
     }
 
     update_flags(res, OP_INRDCR);
+    set_ac((res & 0x0F) != 0x0F);
 }
 
-void op_ana(void)
+// the 8085 sets AC on AND, OR and XOR clear it
+TEMPLATE void i_ana(int src)
 {
-    uint8_t src = opcode & 0x07;
-    uint8_t data;
-    uint8_t res;
-    
-    uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-    data = (src == R_MEM) ? memory[addr] : regs[src];
-
-    res = regs[R_A] & data;
-    regs[R_A] &= data;
-
-    update_flags(res, OP_LOGICAL);
+    cpu->regs[R_A] &= read_src(src);
+    update_flags(cpu->regs[R_A], OP_LOGICAL);
+    set_ac(1);
 }
 
-void op_xra(void)
+TEMPLATE void i_xra(int src)
 {
-    uint8_t src = opcode & 0x07;
-    uint8_t data;
-    uint8_t res;
-    
-    uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-    data = (src == R_MEM) ? memory[addr] : regs[src];
-
-    res = regs[R_A] ^ data;
-    regs[R_A] ^= data;
-
-    update_flags(res, OP_LOGICAL);
+    cpu->regs[R_A] ^= read_src(src);
+    update_flags(cpu->regs[R_A], OP_LOGICAL);
+    set_ac(0);
 }
 
-void op_ora(void)
+TEMPLATE void i_ora(int src)
 {
-    uint8_t src = opcode & 0x07;
-    uint8_t data;
-    uint8_t res;
-
-    uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-    data = (src == R_MEM) ? memory[addr] : regs[src];
-
-    res = regs[R_A] | data;
-    regs[R_A] |= data;
-
-    update_flags(res, OP_LOGICAL);
+    cpu->regs[R_A] |= read_src(src);
+    update_flags(cpu->regs[R_A], OP_LOGICAL);
+    set_ac(0);
 }
 
-void op_cmp(void)
+TEMPLATE void i_cmp(int src)
 {
-    uint8_t src = opcode & 0x07;
-    uint8_t data;
-    uint16_t res;
-
-    uint16_t addr = (regs[R_H] << 8) | regs[R_L];
-    data = (src == R_MEM) ? memory[addr] : regs[src];
-    res = (uint16_t)regs[R_A] - data;
-
-    update_flags(res, OP_ARITHMETIC);
+    alu_sub(read_src(src), 0);
 }
 
-void op_lxi(void)
+TEMPLATE void i_lxi(int rp)
 {
-    uint8_t rp = (opcode >> 4) & 0x03;
-    uint8_t data_low = memory[PC++];
-    uint8_t data_high = memory[PC++];
-    
-    set_rp(rp, (data_high << 8) | data_low);
+    write_rp(rp, read_addr());
 }
 
-void op_ldax(void)
+TEMPLATE void i_ldax(int rp)
 {
-    uint8_t rp = (opcode >> 4) & 0x03;
-    regs[R_A] = memory[get_rp(rp)];     // A <- (RP)
+    cpu->regs[R_A] = mem_read(read_rp(rp));     // A <- (RP)
 }
 
-void op_stax(void)
+TEMPLATE void i_stax(int rp)
 {
-    uint8_t rp = (opcode >> 4) & 0x03;
-    memory[get_rp(rp)] = regs[R_A];     // (RP) <- A
+    mem_write(read_rp(rp), cpu->regs[R_A]);     // (RP) <- A
 }
 
-void op_inx(void)
+TEMPLATE void i_inx(int rp)
 {
-    uint16_t res;
-    uint8_t rp = (opcode >> 4) & 0x03;
+    write_rp(rp, read_rp(rp) + 1);
+}
 
-    res = get_rp(rp) + 1;
-    set_rp(rp, res);
+TEMPLATE void i_dcx(int rp)
+{
+    write_rp(rp, read_rp(rp) - 1);
 }
 
-void op_dcx(void)
+// HL <- HL + RP, only CY
+TEMPLATE void i_dad(int rp)
 {
-    uint16_t res;
-    uint8_t rp = (opcode >> 4) & 0x03;
+    uint32_t res = read_rp(RP_HL) + read_rp(rp);
 
-    res = get_rp(rp) - 1;
-    set_rp(rp, res);
+    write_rp(RP_HL, res);
+    cpu->flags = (res & 0x10000) ? (cpu->flags | FL_CY) : (cpu->flags & ~FL_CY);
 }
 
-void op_nop(void)
+TEMPLATE void i_nop(void)
 {
     return;
 }
 
-void op_hlt(void)
+TEMPLATE void i_hlt(void)
 {
-    running = 0;
+    cpu->running = 0;
 }
 
-void op_push(void)
+TEMPLATE void i_push(int rp)
 {
-    uint8_t rp = (opcode >> 4) & 0x03;
-    uint16_t val = get_rp(rp);
+    uint16_t val = read_rp(rp);
 
-    memory[--SP] = (val >> 8) & 0xFF;
-    memory[--SP] = val & 0xFF;
+    mem_write(--cpu->SP, (val >> 8) & 0xFF);
+    mem_write(--cpu->SP, val & 0xFF);
 }
 
-void op_pop(void)
+TEMPLATE void i_pop(int rp)
 {
-    uint8_t rp = (opcode >> 4) & 0x03;
-    uint8_t low = memory[SP++];
-    uint8_t high = memory[SP++];
+    uint8_t low = mem_read(cpu->SP++);
+    uint8_t high = mem_read(cpu->SP++);
 
-    set_rp(rp, (high << 8) | low);
+    write_rp(rp, (high << 8) | low);
 }
 
-void op_jmp(void)
+TEMPLATE void i_jmp(int cond)
 {
-    uint8_t cond = (opcode >> 3) & 0x07;
-    uint8_t take_jump;
-    uint8_t addr_low = memory[PC++];
-    uint8_t addr_high = memory[PC++];
+    uint16_t target = read_addr();
 
-    switch (cond)
+    if (cond_taken(cond))
     {
-        case COND_ALWAYS:
-            take_jump = 1;
-            break;
-
-        case COND_Z:
-            take_jump = flags & FL_Z;
-            break;
-
-        case COND_NZ:
-            take_jump = (flags & FL_Z) == 0;
-            break;
-
-        case COND_C:
-            take_jump = flags & FL_CY;
-            break;
-
-        case COND_NC:
-            take_jump = (flags & FL_CY) == 0;
-            break;
-
-        default:
-            take_jump = 0;
-            break;
+        cpu->PC = target;
+        if (cond != COND_ALWAYS)
+        {
+            cpu->cycles += 3;
+            cpu->stats.taken++;
+        }
     }
-
-    if (take_jump)
-        PC = (addr_high << 8) | addr_low;
 }
 
-void op_call(void)
+TEMPLATE void i_call(int cond)
 {
-    uint8_t cond = (opcode >> 3) & 0x07;
-    uint8_t take_call;
-    uint8_t addr_low = memory[PC++];
-    uint8_t addr_high = memory[PC++];
+    uint16_t target = read_addr();
 
-    switch (cond)
+    if (cond_taken(cond))
     {
-        case COND_ALWAYS:
-            take_call = 1;
-            break;
-
-        case COND_Z:
-            take_call = flags & FL_Z;
-            break;
-
-        case COND_NZ:
-            take_call = (flags & FL_Z) == 0;
-            break;
-
-        case COND_C:
-            take_call = flags & FL_CY;
-            break;
-
-        case COND_NC:
-            take_call = (flags & FL_CY) == 0;
-            break;
-
-        default:
-            take_call = 0;
-            break;
-    }
+        if (cond != COND_ALWAYS)
+        {
+            cpu->cycles += 9;
+            cpu->stats.taken++;
+        }
+
+        // native replacement runs instead of the routine and returns here
+        if (hle_index[target] && hle_call(target))
+            return;
 
-    if (take_call)
-    {
         // store next instruction PC in stack
-        memory[--SP] = (PC >> 8) & 0xFF;
-        memory[--SP] = PC & 0xFF;
+        mem_write(--cpu->SP, (cpu->PC >> 8) & 0xFF);
+        mem_write(--cpu->SP, cpu->PC & 0xFF);
 
-        PC = (addr_high << 8) | addr_low;
+        cpu->PC = target;
     }
 }
 
-void op_ret(void)
+TEMPLATE void i_ret(int cond)
 {
-    uint8_t cond = (opcode >> 3) & 0x07;
-    uint8_t take_ret;
-
-    switch (cond)
-    {
-        case COND_ALWAYS:
-            take_ret = 1;
-            break;
-
-        case COND_Z:
-            take_ret = flags & FL_Z;
-            break;
-
-        case COND_NZ:
-            take_ret = (flags & FL_Z) == 0;
-            break;
-
-        case COND_C:
-            take_ret = flags & FL_CY;
-            break;
-
-        case COND_NC:
-            take_ret = (flags & FL_CY) == 0;
-            break;
-
-        default:
-            take_ret = 0;
-            break;
-    }
-
-    if (take_ret)
+    if (cond_taken(cond))
     {
-        uint8_t low = memory[SP++];
-        uint8_t high = memory[SP++];
+        uint8_t low = mem_read(cpu->SP++);
+        uint8_t high = mem_read(cpu->SP++);
 
         // restore PC
-        PC = (high << 8) | low;
+        cpu->PC = (high << 8) | low;
+        if (cond != COND_ALWAYS)
+        {
+            cpu->cycles += 6;
+            cpu->stats.taken++;
+        }
     }
 }
 
-void op_lda(void)
+TEMPLATE void i_rst(int target)
 {
-    uint8_t addr_low = memory[PC++];
-    uint8_t addr_high = memory[PC++];
+    mem_write(--cpu->SP, (cpu->PC >> 8) & 0xFF);
+    mem_write(--cpu->SP, cpu->PC & 0xFF);
 
-    regs[R_A] = memory[(addr_high << 8) | addr_low];
+    cpu->PC = target;
 }
 
-void op_sta(void)
+TEMPLATE void i_pchl(void)
 {
-    uint8_t addr_low = memory[PC++];
-    uint8_t addr_high = memory[PC++];
-
-    memory[(addr_high << 8) | addr_low] = regs[R_A];
+    cpu->PC = read_rp(RP_HL);
 }
 
-void op_lhld(void)
+TEMPLATE void i_sphl(void)
 {
-    uint8_t addr_low = memory[PC++];
-    uint8_t addr_high = memory[PC++];
-    
-    regs[R_L] = memory[(addr_high << 8) | addr_low];
-    regs[R_H] = memory[((addr_high << 8) | addr_low) + 1];
+    cpu->SP = read_rp(RP_HL);
 }
 
-void op_shld(void)
+// exchange HL with the top of the stack
+TEMPLATE void i_xthl(void)
 {
-    uint8_t addr_low = memory[PC++];
-    uint8_t addr_high = memory[PC++];
-    
-    memory[(addr_high << 8) | addr_low] = regs[R_L];
-    memory[((addr_high << 8) | addr_low) + 1] = regs[R_H];
+    uint8_t low = mem_read(cpu->SP);
+    uint8_t high = mem_read(cpu->SP + 1);
+
+    mem_write(cpu->SP, cpu->regs[R_L]);
+    mem_write(cpu->SP + 1, cpu->regs[R_H]);
+    cpu->regs[R_L] = low;
+    cpu->regs[R_H] = high;
 }
 
-void op_xchg(void)
+TEMPLATE void i_lda(void)
 {
-    uint16_t temp = get_rp(RP_HL);
-    set_rp(RP_HL, get_rp(RP_DE));
-    set_rp(RP_DE, temp);
+    cpu->regs[R_A] = mem_read(read_addr());
 }
 
-void op_adi(void)
+TEMPLATE void i_sta(void)
 {
-    uint16_t res = (uint16_t)regs[R_A];
-    uint8_t data = memory[PC++];
-
-    res += data;
-    regs[R_A] = (uint8_t)res;
-
-    update_flags(res, OP_ARITHMETIC);
+    mem_write(read_addr(), cpu->regs[R_A]);
 }
 
-void op_aci(void)
+TEMPLATE void i_lhld(void)
 {
-    uint16_t res = (uint16_t)regs[R_A];
-    uint8_t data = memory[PC++];
-
-    res += data + ((flags & FL_CY) ? 1 : 0);
-    regs[R_A] = (uint8_t)res;
+    uint16_t addr = read_addr();
 
-    update_flags(res, OP_ARITHMETIC);
+    cpu->regs[R_L] = mem_read(addr);
+    cpu->regs[R_H] = mem_read(addr + 1);
 }
 
-void op_sui(void)
+TEMPLATE void i_shld(void)
 {
-    uint16_t res = (uint16_t)regs[R_A];
-    uint8_t data = memory[PC++];
+    uint16_t addr = read_addr();
 
-    res -= data;
-    regs[R_A] = (uint8_t)res;
+    mem_write(addr, cpu->regs[R_L]);
+    mem_write(addr + 1, cpu->regs[R_H]);
+}
 
-    update_flags(res, OP_ARITHMETIC);
+TEMPLATE void i_xchg(void)
+{
+    uint16_t temp = read_rp(RP_HL);
+    write_rp(RP_HL, read_rp(RP_DE));
+    write_rp(RP_DE, temp);
 }
 
-void op_ani(void)
+TEMPLATE void i_adi(void)
 {
-    uint8_t data = memory[PC++];
-    uint16_t res = (uint16_t)regs[R_A] & data;
-    regs[R_A] &= data;
+    cpu->regs[R_A] = alu_add(mem_read(cpu->PC++), 0);
+}
 
-    update_flags(res, OP_LOGICAL);
+TEMPLATE void i_aci(void)
+{
+    cpu->regs[R_A] = alu_add(mem_read(cpu->PC++), cpu->flags & FL_CY);
 }
 
-void op_xri(void)
+TEMPLATE void i_sui(void)
 {
-    uint8_t data = memory[PC++];
-    uint16_t res = (uint16_t)regs[R_A] ^ data;
-    regs[R_A] ^= data;
+    cpu->regs[R_A] = alu_sub(mem_read(cpu->PC++), 0);
+}
 
-    update_flags(res, OP_LOGICAL);
+TEMPLATE void i_sbi(void)
+{
+    cpu->regs[R_A] = alu_sub(mem_read(cpu->PC++), cpu->flags & FL_CY);
 }
 
-void op_ori(void)
+TEMPLATE void i_ani(void)
 {
-    uint8_t data = memory[PC++];
-    uint16_t res = (uint16_t)regs[R_A] | data;
-    regs[R_A] |= data;
+    cpu->regs[R_A] &= mem_read(cpu->PC++);
+    update_flags(cpu->regs[R_A], OP_LOGICAL);
+    set_ac(1);
+}
 
-    update_flags(res, OP_LOGICAL);
+TEMPLATE void i_xri(void)
+{
+    cpu->regs[R_A] ^= mem_read(cpu->PC++);
+    update_flags(cpu->regs[R_A], OP_LOGICAL);
+    set_ac(0);
 }
 
-void op_cpi(void)
+TEMPLATE void i_ori(void)
 {
-    uint8_t data = memory[PC++];
-    uint16_t res = (uint16_t)regs[R_A] - data;
-    update_flags(res, OP_ARITHMETIC);
+    cpu->regs[R_A] |= mem_read(cpu->PC++);
+    update_flags(cpu->regs[R_A], OP_LOGICAL);
+    set_ac(0);
 }
 
-void op_rlc(void)
+TEMPLATE void i_cpi(void)
 {
-    uint8_t a7 = (regs[R_A] & 0x80) ? 1 : 0;
-    regs[R_A] = (regs[R_A] << 1) | a7;
-    flags = a7 ? (flags | FL_CY) : (flags & ~FL_CY);
+    alu_sub(mem_read(cpu->PC++), 0);
 }
 
-void op_rrc(void)
+TEMPLATE void i_rlc(void)
 {
-    uint8_t a0 = (regs[R_A] & 0x01) ? 1 : 0;
-    regs[R_A] = (regs[R_A] >> 1) | (a0 << 7);
-    flags = a0 ? (flags | FL_CY) : (flags & ~FL_CY);
+    uint8_t a7 = (cpu->regs[R_A] & 0x80) ? 1 : 0;
+    cpu->regs[R_A] = (cpu->regs[R_A] << 1) | a7;
+    cpu->flags = a7 ? (cpu->flags | FL_CY) : (cpu->flags & ~FL_CY);
 }
 
-void op_ral(void)
+TEMPLATE void i_rrc(void)
 {
-    uint8_t a7 = (regs[R_A] & 0x80) ? 1 : 0;
-    regs[R_A] = (regs[R_A] << 1) | (flags & FL_CY);
-    flags = a7 ? (flags | FL_CY) : (flags & ~FL_CY);
+    uint8_t a0 = (cpu->regs[R_A] & 0x01) ? 1 : 0;
+    cpu->regs[R_A] = (cpu->regs[R_A] >> 1) | (a0 << 7);
+    cpu->flags = a0 ? (cpu->flags | FL_CY) : (cpu->flags & ~FL_CY);
 }
 
-void op_rar(void)
+TEMPLATE void i_ral(void)
 {
-    uint8_t a0 = (regs[R_A] & 0x01) ? 1 : 0;
-    regs[R_A] = (regs[R_A] >> 1) | ((flags & FL_CY) << 7);
-    flags = a0 ? (flags | FL_CY) : (flags & ~FL_CY);
+    uint8_t a7 = (cpu->regs[R_A] & 0x80) ? 1 : 0;
+    cpu->regs[R_A] = (cpu->regs[R_A] << 1) | (cpu->flags & FL_CY);
+    cpu->flags = a7 ? (cpu->flags | FL_CY) : (cpu->flags & ~FL_CY);
 }
 
-void init_opcodes(void)
+TEMPLATE void i_rar(void)
 {
-    // initialize opcodes
-    for (uint16_t i = 0; i <= 0xFF; ++i)
-        opcode_table[i] = NULL;
+    uint8_t a0 = (cpu->regs[R_A] & 0x01) ? 1 : 0;
+    cpu->regs[R_A] = (cpu->regs[R_A] >> 1) | ((cpu->flags & FL_CY) << 7);
+    cpu->flags = a0 ? (cpu->flags | FL_CY) : (cpu->flags & ~FL_CY);
+}
 
-    // MOV -> 01DDDSSS
-    for (uint8_t i = 0x40; i <= 0x7F; ++i)
-        opcode_table[i] = &op_mov;
+// decimal adjust after a BCD addition
+TEMPLATE void i_daa(void)
+{
+    uint8_t a = cpu->regs[R_A];
+    uint8_t fix = 0, cy = cpu->flags & FL_CY;
+    uint16_t res;
 
-    for (uint8_t i = 0; i <= 7; ++i)
+    if ((a & 0x0F) > 9 || (cpu->flags & FL_AC))
+        fix |= 0x06;
+    if (a > 0x99 || cy)
     {
-        opcode_table[0x06 | (i << 3)] = &op_mvi;    // MVI -> 00DDD110
-
-        opcode_table[0x80 | i] = &op_add;           // ADD -> 10000SSS
-        opcode_table[0x88 | i] = &op_adc;           // ADC -> 10001SSS
-
-        opcode_table[0x04 | (i << 3)] = &op_inr;    // INR -> 00DDD100
-        opcode_table[0x05 | (i << 3)] = &op_dcr;    // DCR -> 00DDD101
-
-        opcode_table[0xA0 | i] = &op_ana;           // ANA -> 10100SSS
-        opcode_table[0xA8 | i] = &op_xra;           // XRA -> 10101SSS
-        opcode_table[0xB0 | i] = &op_ora;           // ORA -> 10110SSS
-        opcode_table[0xB8 | i] = &op_cmp;           // CMP -> 10111SSS
-
-        opcode_table[0xC2 | (i << 3)] = &op_jmp;    // JMP -> 11CCC010
-        opcode_table[0xC4 | (i << 3)] = &op_call;   // CALL -> 11CCC100
-        opcode_table[0xC0 | (i << 3)] = &op_ret;    // RET -> 11CCC000
+        fix |= 0x60;
+        cy = 1;
     }
-    
-    for (uint8_t i = 0; i <= 3; ++i)
-    {
-        opcode_table[0x01 | (i << 4)] = &op_lxi;    // LXI -> 00RP0001
-        opcode_table[0x0A | (i << 4)] = &op_ldax;   // LDAX -> 00RP1010
-        opcode_table[0x02 | (i << 4)] = &op_stax;   // STAX -> 00RP0010
-
-        opcode_table[0x03 | (i << 4)] = &op_inx;    // INX -> 00RP0011 
-        opcode_table[0x0B | (i << 4)] = &op_dcx;    // DCX -> 00RP1011
 
-        opcode_table[0xC5 | (i << 4)] = &op_push;          // PUSH -> 11RP0101
-        opcode_table[0xC1 | (i << 4)] = &op_pop;           // POP -> 11RP0001
-    }
+    res = a + fix;
+    cpu->regs[R_A] = (uint8_t)res;
+    update_flags(res, OP_INRDCR);
+    set_ac((a ^ fix ^ res) & 0x10);
+    cpu->flags = cy ? (cpu->flags | FL_CY) : (cpu->flags & ~FL_CY);
+}
 
-    opcode_table[0x00] = &op_nop;   // NOP -> 0x00
-    opcode_table[0x76] = &op_hlt;   // HLT -> 0x76
+TEMPLATE void i_cma(void)
+{
+    cpu->regs[R_A] = ~cpu->regs[R_A];
+}
 
-    opcode_table[0x3A] = &op_lda;   // LDA -> 0x3A
-    opcode_table[0x32] = &op_sta;   // STA -> 0x32
-    opcode_table[0x2A] = &op_lhld;  // LHLD -> 0x2A
-    opcode_table[0x22] = &op_shld;  // SHLD -> 0x22
-    opcode_table[0xEB] = &op_xchg;  // XCHG -> 0xEB
+TEMPLATE void i_stc(void)
+{
+    cpu->flags |= FL_CY;
+}
 
-    opcode_table[0xC6] = &op_adi;   // ADI -> 0xC6
-    opcode_table[0xCE] = &op_aci;   // ACI -> 0xCE
-    opcode_table[0xD6] = &op_sui;   // SUI -> 0xD6
+TEMPLATE void i_cmc(void)
+{
+    cpu->flags ^= FL_CY;
+}
 
-    opcode_table[0xE6] = &op_ani;   // ANI -> 0xE6
-    opcode_table[0xEE] = &op_xri;   // XRI -> 0xEE
-    opcode_table[0xF6] = &op_ori;   // ORI -> 0xF6
-    opcode_table[0xFE] = &op_cpi;   // CPI -> 0xFE
+TEMPLATE void i_in(void)
+{
+    uint8_t port = mem_read(cpu->PC++);
 
-    opcode_table[0x07] = &op_rlc;   // RLC -> 0x07
-    opcode_table[0x0F] = &op_rrc;   // RRC -> 0x0F
-    opcode_table[0x17] = &op_ral;   // RAL -> 0x17
-    opcode_table[0x1F] = &op_rar;   // RAR -> 0x1F
+    if (rr_mode != RR_OFF)
+        cpu->regs[R_A] = rr_input(RR_IN, port, io.ports[port]);
+    else
+        cpu->regs[R_A] = io.ports[port];
 }
 
-uint16_t get_rp(int rp)
+TEMPLATE void i_out(void)
 {
-    switch (rp)
-    {
-        case RP_BC:
-            return (regs[R_B] << 8) | regs[R_C];
-
-        case RP_DE:
-            return (regs[R_D] << 8) | regs[R_E];
+    io.ports[mem_read(cpu->PC++)] = cpu->regs[R_A];
+}
 
-        case RP_HL:
-            return (regs[R_H] << 8) | regs[R_L];
+// interrupts are never raised, EI/DI/SIM only keep the state RIM reads back
+TEMPLATE void i_ei(void)
+{
+    cpu->im |= 0x08;
+}
 
-        case RP_SP:
-            return SP;
+TEMPLATE void i_di(void)
+{
+    cpu->im &= ~0x08;
+}
 
-        case RP_PSW:
-            return (regs[R_A] << 8) | flags;
+TEMPLATE void i_rim(void)
+{
+    cpu->regs[R_A] = cpu->im;
+}
 
-        default:
-            return -1;
-    }
+TEMPLATE void i_sim(void)
+{
+    // MSE (bit 3) enables setting the masks
+    if (cpu->regs[R_A] & 0x08)
+        cpu->im = (cpu->im & 0x08) | (cpu->regs[R_A] & 0x07);
 }
 
-void set_rp(int rp, uint16_t val)
+// no stdio here, the caller reports traps once execution stops
+TEMPLATE void i_undef(void)
 {
-    switch (rp)
+    switch (undef_policy)
     {
-        case RP_BC:
-            regs[R_C] = val & 0xFF;
-            regs[R_B] = (val >> 8) & 0xFF;
-            return;
+        case UNDEF_TRAP:
+            cpu->PC--;
+            cpu->trap = 1;
+            cpu->running = 0;
+            break;
 
-        case RP_DE:
-            regs[R_E] = val & 0xFF;
-            regs[R_D] = (val >> 8) & 0xFF;
-            return;
+        case UNDEF_HALT:
+            cpu->running = 0;
+            break;
 
-        case RP_HL:
-            regs[R_L] = val & 0xFF;
-            regs[R_H] = (val >> 8) & 0xFF;
-            return;
+        default:
+            cpu->undef_count++;
+            break;
+    }
+}
 
-        case RP_SP:
-            SP = val;
-            return;
+// one handler per opcode with its operands baked in
+#ifdef INSTRUMENT
+#define OP(code, name, len, cyc, cls, tmpl, ...) \
+    static void op_##code(void) { instr_exec(code); i_##tmpl(__VA_ARGS__); }
+#else
+#define OP(code, name, len, cyc, cls, tmpl, ...) \
+    static void op_##code(void) { i_##tmpl(__VA_ARGS__); }
+#endif
+#define UNDEF(code, cyc) OP(code, NULL, 1, cyc, UNDEF, undef)
+#include "isa.def"
+#undef OP
+#undef UNDEF
+
+#define OP(code, name, len, cyc, ...) [code] = &op_##code,
+#define UNDEF(code, cyc) [code] = &op_##code,
+InstrFunc opcode_table[256] =
+{
+#include "isa.def"
+};
+#undef OP
+#undef UNDEF
 
-        case RP_PSW:
-            flags = val & 0xFF;
-            regs[R_A] = (val >> 8) & 0xFF;
-            return;
+uint16_t get_rp(int rp)
+{
+    return read_rp(rp);
+}
 
-        default:
-            fprintf(stderr, "Error: invalid register pair\n");
-            return;
-    }
-}
\ No newline at end of file
+void set_rp(int rp, uint16_t val)
+{
+    write_rp(rp, val);
+}
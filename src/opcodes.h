@@ -11,70 +11,51 @@ enum
     OP_INRDCR
 };
 
+// condition field of Jcc/Ccc/Rcc, bits 3-5 of the opcode
 enum
 {
-    COND_ALWAYS = 0,
+    COND_NZ = 0,
     COND_Z,
     COND_NC,
     COND_C,
-    COND_NZ
+    COND_PO,
+    COND_PE,
+    COND_P,
+    COND_M,
+    COND_ALWAYS         // JMP, CALL and RET
+};
+
+// what an undefined opcode does
+enum
+{
+    UNDEF_TRAP = 0,     // stop with PC on the opcode
+    UNDEF_HALT,         // stop as if it were HLT
+    UNDEF_COUNT         // count it and go on, like a NOP
+};
+
+// instruction groups of the Intel manual, class_table
+enum
+{
+    ISA_TRANSFER = 0,   // MOV, MVI, LXI, loads and stores, XCHG
+    ISA_ARITH,          // ADD to DAA, INR/DCR, INX/DCX, DAD
+    ISA_LOGIC,          // ANA to CMP, rotates, CMA, CMC, STC
+    ISA_BRANCH,         // jumps, calls, returns, RST, PCHL
+    ISA_CONTROL,        // stack, I/O, interrupts, HLT, NOP
+    ISA_UNDEF,
+    ISA_CLASSES
 };
 
 typedef void (*InstrFunc) (void);
 
 extern InstrFunc opcode_table[256];
-extern uint8_t memory[MEMORY_MAX];
-extern uint8_t regs[R_COUNT];
-extern uint8_t flags;
-extern uint8_t opcode;
-extern uint16_t PC;
-extern uint16_t SP;
-extern uint8_t running;
+extern int undef_policy;
+extern const uint8_t cycle_table[256];
+extern const uint8_t length_table[256];
+extern const char *const name_table[256];     // NULL for undefined opcodes
+extern const uint8_t class_table[256];
 
-void init_opcodes(void);
 uint16_t get_rp(int rp);
 void set_rp(int rp, uint16_t val);
 void push_helper(uint16_t val);
 
-void op_mov(void);
-void op_mvi(void);
-void op_add(void);
-void op_adc(void);
-void op_inr(void);
-void op_dcr(void);
-void op_ana(void);
-void op_xra(void);
-void op_ora(void);
-void op_cmp(void);
-void op_lxi(void);
-void op_ldax(void);
-void op_stax(void);
-void op_inx(void);
-void op_dcx(void);
-void op_nop(void);
-void op_hlt(void);
-void op_call(void);
-void op_ret(void);
-void op_jmp(void);
-void op_jnz(void);
-void op_jz(void);
-void op_jnc(void);
-void op_jc(void);
-void op_lda(void);
-void op_sta(void);
-void op_lhld(void);
-void op_shld(void);
-void op_xchg(void);
-void op_adi(void);
-void op_aci(void);
-void op_sui(void);
-void op_ani(void);
-void op_xri(void);
-void op_ori(void);
-void op_cpi(void);
-void op_rlc(void);
-void op_rrc(void);
-void op_ral(void);
-void op_rar(void);
-
 #endif /* OPCODES_H_ */
\ No newline at end of file
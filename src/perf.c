@@ -0,0 +1,435 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <elf.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "perf.h"
+#include "cpu.h"
+#include "mem.h"
+
+/*
+ * guest code as seen by Linux perf:
+ * - the compiled blocks of -A are described in /tmp/perf-<pid>.map and in
+ *   a jitdump (/tmp/jit-<pid>.dump, for perf inject --jit), named by guest
+ *   address and symbol
+ * - interpreted code is sampled by a SIGPROF timer on the CPU time of every
+ *   CPU thread. The handler keeps PC and the call sites found on the guest
+ *   stack, and the samples are written at exit in the format of perf script,
+ *   which the flame graph scripts read.
+ */
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define JIT_MAGIC 0x4A695444
+#define JIT_VERSION 1
+#define JIT_CODE_LOAD 0
+
+#if defined(__x86_64__)
+#define JIT_ELF_MACH EM_X86_64
+#elif defined(__aarch64__)
+#define JIT_ELF_MACH EM_AARCH64
+#else
+#define JIT_ELF_MACH EM_NONE
+#endif
+
+struct jit_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jit_code_load
+{
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+struct perf_symbol
+{
+    uint16_t addr;
+    char name[PERF_MAX_NAME];
+};
+
+// one guest sample: pc[0] is PC, then the call sites, target[i] the routine called at pc[i]
+struct perf_sample
+{
+    uint64_t time;
+    uint8_t id;
+    uint8_t depth;
+    uint16_t pc[PERF_MAX_DEPTH];
+    uint16_t target[PERF_MAX_DEPTH];
+};
+
+int perf_sampling = 0;
+
+static struct perf_symbol symbols[PERF_MAX_SYMBOLS];
+static int symbol_count = 0;
+
+static FILE *map_file = NULL;
+static FILE *jit_file = NULL;
+static void *jit_marker;
+static uint64_t jit_index = 0;
+
+static struct perf_sample *samples;
+static atomic_uint sample_count = 0;
+static const char *sample_path;
+static int sample_hz;
+static __thread timer_t sample_timer;
+static __thread int sample_armed = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int by_addr(const void *a, const void *b)
+{
+    return (int)((const struct perf_symbol *)a)->addr - (int)((const struct perf_symbol *)b)->addr;
+}
+
+// symbol file, one <address> <name> per line like the hook file
+int perf_load_symbols(const char *path)
+{
+    char line[256], name[PERF_MAX_NAME];
+    unsigned int addr;
+    int line_no = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open symbol file %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        line_no++;
+        if (line[strspn(line, " \t\r\n")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+
+        if (sscanf(line, "%x %63s", &addr, name) != 2 || addr >= MEMORY_MAX)
+        {
+            fprintf(stderr, "Error: %s:%d: expected <address> <name>\n", path, line_no);
+            fclose(f);
+            return -1;
+        }
+
+        if (symbol_count >= PERF_MAX_SYMBOLS)
+        {
+            fprintf(stderr, "Error: %s:%d: too many symbols (max %d)\n", path, line_no, PERF_MAX_SYMBOLS);
+            fclose(f);
+            return -1;
+        }
+
+        symbols[symbol_count].addr = addr;
+        strcpy(symbols[symbol_count].name, name);
+        symbol_count++;
+    }
+
+    fclose(f);
+    qsort(symbols, symbol_count, sizeof(symbols[0]), &by_addr);
+    return 0;
+}
+
+// last symbol at or below addr, NULL if there is none
+static const struct perf_symbol *find_symbol(uint16_t addr)
+{
+    int lo = 0, hi = symbol_count - 1, found = -1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (symbols[mid].addr <= addr)
+        {
+            found = mid;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+
+    return found >= 0 ? &symbols[found] : NULL;
+}
+
+// routine+offset of addr, with entry (the routine it was called as) when there are no symbols
+static void routine_name(char *buf, size_t size, uint16_t addr, uint16_t entry)
+{
+    const struct perf_symbol *s = find_symbol(addr);
+
+    if (s != NULL)
+        snprintf(buf, size, "%s+0x%x", s->name, addr - s->addr);
+    else if (entry <= addr)
+        snprintf(buf, size, "sub_%04X+0x%x", entry, addr - entry);
+    else
+        snprintf(buf, size, "sub_%04X", entry);
+}
+
+// name of compiled code starting at addr
+void perf_guest_name(char *buf, size_t size, uint16_t addr)
+{
+    const struct perf_symbol *s = find_symbol(addr);
+
+    if (s != NULL)
+        snprintf(buf, size, "8085:%04X %s+0x%x", addr, s->name, addr - s->addr);
+    else
+        snprintf(buf, size, "8085:%04X", addr);
+}
+
+/* perf map and jitdump */
+
+int perf_jit_open(void)
+{
+    char path[64];
+    struct jit_header h;
+
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    if ((map_file = fopen(path, "w")) == NULL)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", (int)getpid());
+    if ((jit_file = fopen(path, "w+")) == NULL)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    h.magic = JIT_MAGIC;
+    h.version = JIT_VERSION;
+    h.total_size = sizeof(h);
+    h.elf_mach = JIT_ELF_MACH;
+    h.pid = getpid();
+    h.timestamp = now_ns();
+    fwrite(&h, sizeof(h), 1, jit_file);
+    fflush(jit_file);
+
+    // perf record finds the dump through this executable mapping of it
+    jit_marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(jit_file), 0);
+    if (jit_marker == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    return 0;
+}
+
+// host code at [addr, addr + size) runs the guest code called name
+void perf_jit_code(const char *name, const void *addr, uint64_t size)
+{
+    struct jit_code_load r;
+    uint32_t name_len = strlen(name) + 1;
+
+    if (map_file == NULL)
+        return;
+
+    fprintf(map_file, "%lx %lx %s\n", (unsigned long)(uintptr_t)addr, (unsigned long)size, name);
+    fflush(map_file);
+
+    r.id = JIT_CODE_LOAD;
+    r.total_size = sizeof(r) + name_len + size;
+    r.timestamp = now_ns();
+    r.pid = getpid();
+    r.tid = syscall(SYS_gettid);
+    r.vma = (uintptr_t)addr;
+    r.code_addr = (uintptr_t)addr;
+    r.code_size = size;
+    r.code_index = jit_index++;
+
+    fwrite(&r, sizeof(r), 1, jit_file);
+    fwrite(name, name_len, 1, jit_file);
+    fwrite(addr, size, 1, jit_file);
+}
+
+void perf_jit_close(void)
+{
+    if (map_file == NULL)
+        return;
+
+    fclose(map_file);
+    fclose(jit_file);
+    map_file = NULL;
+    jit_file = NULL;
+}
+
+/* guest sampling */
+
+// the CPU of this thread, between two instructions or in the middle of one
+static void take_sample(int sig, siginfo_t *info, void *ctx)
+{
+    uint32_t i = atomic_fetch_add_explicit(&sample_count, 1, memory_order_relaxed);
+    struct perf_sample *s;
+
+    (void)sig;
+    (void)info;
+    (void)ctx;
+
+    if (i >= PERF_MAX_SAMPLES)
+        return;
+
+    s = &samples[i];
+    s->time = now_ns();
+    s->id = cpu->id;
+    s->pc[0] = cpu->PC;
+    s->depth = 1;
+
+    // words on the stack right after a CALL, Ccc or RST are taken as return addresses
+    for (uint32_t a = cpu->SP; a + 1 < MEMORY_MAX && a < (uint32_t)cpu->SP + PERF_STACK_SCAN && s->depth < PERF_MAX_DEPTH; a += 2)
+    {
+        uint16_t ret = mem_peek(a) | mem_peek(a + 1) << 8;
+        uint8_t op = mem_peek(ret - 3);
+
+        if (ret >= 3 && (op == 0xCD || (op & 0xC7) == 0xC4))
+        {
+            s->pc[s->depth] = ret - 3;
+            s->target[s->depth - 1] = mem_peek(ret - 2) | mem_peek(ret - 1) << 8;
+        }
+        else if (ret >= 1 && (mem_peek(ret - 1) & 0xC7) == 0xC7)
+        {
+            s->pc[s->depth] = ret - 1;
+            s->target[s->depth - 1] = mem_peek(ret - 1) & 0x38;
+        }
+        else
+            continue;
+
+        s->depth++;
+    }
+
+    // the outermost frame is the program
+    s->target[s->depth - 1] = 0x0800;
+}
+
+int perf_sample_init(const char *path, int hz)
+{
+    struct sigaction sa;
+
+    samples = calloc(PERF_MAX_SAMPLES, sizeof(*samples));
+    if (samples == NULL)
+    {
+        fprintf(stderr, "Error: malloc failed\n");
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &take_sample;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) < 0)
+    {
+        perror("sigaction");
+        return -1;
+    }
+
+    sample_path = path;
+    sample_hz = hz;
+    perf_sampling = 1;
+    return 0;
+}
+
+// start sampling the CPU the calling thread runs, by its CPU time
+void perf_sample_thread(void)
+{
+    struct sigevent sev;
+    struct itimerspec its;
+
+    if (!perf_sampling)
+        return;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &sample_timer) < 0)
+    {
+        perror("timer_create");
+        return;
+    }
+
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 1000000000 / sample_hz;
+    its.it_value = its.it_interval;
+    timer_settime(sample_timer, 0, &its, NULL);
+    sample_armed = 1;
+}
+
+void perf_sample_thread_end(void)
+{
+    if (sample_armed)
+        timer_delete(sample_timer);
+    sample_armed = 0;
+}
+
+// the samples as perf script prints them, one stack per sample, innermost frame first
+int perf_sample_write(void)
+{
+    uint32_t count = atomic_load(&sample_count);
+    char name[PERF_MAX_NAME + 32];
+    FILE *f;
+
+    if (!perf_sampling)
+        return 0;
+
+    f = fopen(sample_path, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", sample_path);
+        return -1;
+    }
+
+    if (count > (uint32_t)PERF_MAX_SAMPLES)
+    {
+        fprintf(stderr, "%u guest samples dropped, the first %d are in %s\n", count - PERF_MAX_SAMPLES,
+            PERF_MAX_SAMPLES, sample_path);
+        count = PERF_MAX_SAMPLES;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        struct perf_sample *s = &samples[i];
+
+        fprintf(f, "8085vm %d [%03d] %llu.%06llu: %d cpu-clock:\n", (int)getpid(), s->id,
+            (unsigned long long)(s->time / 1000000000ULL), (unsigned long long)(s->time % 1000000000ULL / 1000),
+            1000000000 / sample_hz);
+
+        for (int d = 0; d < s->depth; ++d)
+        {
+            routine_name(name, sizeof(name), s->pc[d], s->target[d]);
+            fprintf(f, "\t%16x %s (8085)\n", s->pc[d], name);
+        }
+
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+    return 0;
+}
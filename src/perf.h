@@ -0,0 +1,28 @@
+#ifndef PERF_H_
+#define PERF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PERF_DEFAULT_HZ 1000            // guest samples per second of CPU time
+#define PERF_MAX_SAMPLES (1 << 20)      // later samples are dropped
+#define PERF_MAX_DEPTH 16               // frames kept per sample
+#define PERF_STACK_SCAN 128             // stack bytes searched for return addresses
+#define PERF_MAX_SYMBOLS 4096
+#define PERF_MAX_NAME 64
+
+extern int perf_sampling;
+
+int perf_load_symbols(const char *path);
+void perf_guest_name(char *buf, size_t size, uint16_t addr);
+
+int perf_jit_open(void);
+void perf_jit_code(const char *name, const void *addr, uint64_t size);
+void perf_jit_close(void);
+
+int perf_sample_init(const char *path, int hz);
+void perf_sample_thread(void);
+void perf_sample_thread_end(void);
+int perf_sample_write(void);
+
+#endif /* PERF_H_ */
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "prof.h"
+#include "cpu.h"
+#include "mem.h"
+#include "smp.h"
+
+// set from the command line, NULL = no profiling
+char *prof_file = NULL;
+
+// attach a profile to every CPU, after smp_init
+int prof_init(void)
+{
+    for (int i = 0; i < (smp_count ? smp_count : 1); ++i)
+    {
+        struct cpu *c = i ? smp_cpu[i] : &cpu0;
+        struct mem_prof *p = calloc(1, sizeof(struct mem_prof));
+
+        if (p == NULL)
+        {
+            fprintf(stderr, "Error: malloc failed\n");
+            return -1;
+        }
+
+        for (int d = 0; d < PROF_MAX_DEPTH; ++d)
+            p->sp_low[d] = c->SP;
+
+        mem_profile(c, p);
+    }
+
+    return 0;
+}
+
+static void print_cpu(FILE *f, const struct mem_prof *p)
+{
+    static const char heat[] = " .:-=+*#%@";
+    uint64_t hottest = 0;
+    uint16_t low = 0xFFFF;
+    int depths = p->max_depth < PROF_MAX_DEPTH ? p->max_depth + 1 : PROF_MAX_DEPTH;
+
+    for (int i = 0; i < PROF_PAGES; ++i)
+    {
+        uint64_t total = p->reads[i] + p->writes[i] + p->execs[i];
+        if (total > hottest)
+            hottest = total;
+    }
+
+    // one line per 256 byte page that was touched, the bar is relative to the busiest page
+    fprintf(f, "page       heat       reads     writes      execs\n");
+    for (int i = 0; i < PROF_PAGES; ++i)
+    {
+        uint64_t total = p->reads[i] + p->writes[i] + p->execs[i];
+
+        if (total == 0)
+            continue;
+
+        fprintf(f, "%04X-%04X  %c %10llu %10llu %10llu\n", i << PROF_SHIFT, (i << PROF_SHIFT) | 0xFF,
+            heat[1 + (total * 8) / hottest], (unsigned long long)p->reads[i],
+            (unsigned long long)p->writes[i], (unsigned long long)p->execs[i]);
+    }
+
+    for (int d = 0; d < depths; ++d)
+        if (p->sp_low[d] < low)
+            low = p->sp_low[d];
+
+    fprintf(f, "\nlowest SP 0x%04X, %u bytes of stack, deepest call %d\n", low, 0xFFFF - low, p->max_depth);
+    if (low < STACK_SEGMENT_START)
+        fprintf(f, "stack went below the stack segment at 0x%04X\n", STACK_SEGMENT_START);
+
+    for (int d = 0; d < depths; ++d)
+        fprintf(f, "depth %2d%s: lowest SP 0x%04X\n", d, d == PROF_MAX_DEPTH - 1 ? "+" : "", p->sp_low[d]);
+}
+
+void prof_print(FILE *f)
+{
+    for (int i = 0; i < (smp_count ? smp_count : 1); ++i)
+    {
+        struct cpu *c = i ? smp_cpu[i] : &cpu0;
+
+        if (smp_count > 1)
+            fprintf(f, "%sCPU %d:\n", i ? "\n" : "", i);
+
+        print_cpu(f, c->prof);
+    }
+}
+
+int prof_write(void)
+{
+    FILE *f = fopen(prof_file, "w");
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot write %s\n", prof_file);
+        return -1;
+    }
+
+    prof_print(f);
+    fclose(f);
+    return 0;
+}
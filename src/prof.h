@@ -0,0 +1,49 @@
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define PROF_SHIFT 8                        // counted in 256 byte pages, the high address byte
+#define PROF_PAGES (MEMORY_MAX >> PROF_SHIFT)
+#define PROF_MAX_DEPTH 32                   // deeper calls are counted with the last depth
+
+// memory profile of one CPU, only kept while profiling
+struct mem_prof
+{
+    uint64_t reads[PROF_PAGES];             // data and operand reads
+    uint64_t writes[PROF_PAGES];
+    uint64_t execs[PROF_PAGES];             // opcode fetches
+    uint16_t sp_low[PROF_MAX_DEPTH];        // lowest SP seen at each CALL depth
+    int depth;
+    int max_depth;
+};
+
+extern char *prof_file;
+
+int prof_init(void);
+void prof_print(FILE *f);
+int prof_write(void);
+
+// follow the call depth and the stack low-water mark after an instruction
+static inline void prof_step(struct mem_prof *p, uint8_t op, uint16_t old_sp)
+{
+    int d;
+
+    // CALL, Ccc and RST push the return address, RET and Rcc pop it
+    if (cpu->SP == (uint16_t)(old_sp - 2) && (op == 0xCD || (op & 0xC7) == 0xC4 || (op & 0xC7) == 0xC7))
+    {
+        if (++p->depth > p->max_depth)
+            p->max_depth = p->depth;
+    }
+    else if (cpu->SP == (uint16_t)(old_sp + 2) && (op == 0xC9 || (op & 0xC7) == 0xC0) && p->depth > 0)
+        p->depth--;
+
+    d = p->depth < PROF_MAX_DEPTH ? p->depth : PROF_MAX_DEPTH - 1;
+    if (cpu->SP < p->sp_low[d])
+        p->sp_low[d] = cpu->SP;
+}
+
+#endif /* PROF_H_ */
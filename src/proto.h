@@ -0,0 +1,63 @@
+#ifndef PROTO_H_
+#define PROTO_H_
+
+#include <stdint.h>
+
+/*
+ * daemon wire protocol, host byte order (Unix sockets only):
+ *   client -> daemon: proto_request, program bytes, input bytes
+ *   daemon -> client: proto_reply, output bytes
+ * one request per connection
+ */
+
+#define PROTO_MAGIC 0x35383038      // "8085"
+#define PROTO_VERSION 1
+#define PROTO_DEFAULT_SOCKET "/tmp/8085vm.sock"
+
+#define PROTO_MAX_PROGRAM (0xE000 - 0x0800)
+#define PROTO_MAX_INPUT (1 << 20)
+#define PROTO_MAX_OUTPUT (1 << 20)
+
+// reply status
+enum
+{
+    PROTO_HALTED = 0,       // HLT
+    PROTO_CYCLE_LIMIT,      // ran out of cycles
+    PROTO_SEGMENT_END,      // PC ran into the stack segment
+    PROTO_BAD_REQUEST,
+    PROTO_UNDEFINED         // stopped on an undefined opcode (at PC)
+};
+
+// reply flags
+enum
+{
+    PROTO_OUTPUT_TRUNCATED = 1 << 0
+};
+
+struct proto_request
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t program_len;
+    uint32_t input_len;
+    uint64_t max_cycles;    // 0 -> daemon default
+    uint32_t max_output;    // 0 -> daemon default
+    uint32_t reserved2;
+};
+
+struct proto_reply
+{
+    uint32_t magic;
+    uint8_t status;
+    uint8_t flags;
+    uint8_t regs[8];        // B, C, D, E, H, L, (unused), A
+    uint8_t psw;            // 8085 flag register
+    uint8_t reserved;
+    uint16_t PC;
+    uint16_t SP;
+    uint32_t output_len;
+    uint64_t cycles;
+};
+
+#endif /* PROTO_H_ */
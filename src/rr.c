@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rr.h"
+#include "cpu.h"
+#include "mem.h"
+#include "debug.h"
+#include "ctl.h"
+
+int rr_mode = RR_OFF;
+int rr_diverged = 0;
+
+static FILE *rr_file;
+static volatile int rr_stopping = 0;
+static uint64_t rr_last;            // cycle count of the previous record
+
+// next record of the replay log, kind 0 once the log is exhausted
+static struct
+{
+    int kind;
+    uint64_t cycles;
+    uint8_t port;
+    uint8_t val;
+    uint64_t hash;
+} next;
+
+// FNV-1a over the registers and the mapped memory
+static uint64_t state_hash(void)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    uint8_t regs[R_COUNT + 5];
+
+    cpu_get_regs(cpu, regs);
+    regs[R_COUNT] = cpu->flags;
+    regs[R_COUNT + 1] = cpu->PC >> 8;
+    regs[R_COUNT + 2] = cpu->PC & 0xFF;
+    regs[R_COUNT + 3] = cpu->SP >> 8;
+    regs[R_COUNT + 4] = cpu->SP & 0xFF;
+
+    for (size_t i = 0; i < sizeof(regs); ++i)
+        h = (h ^ regs[i]) * 0x100000001B3ULL;
+
+    for (int p = 0; p < MEM_PAGES; ++p)
+        for (int i = 0; i < MEM_PAGE_SIZE; ++i)
+            h = (h ^ cpu->mem_page[p][i]) * 0x100000001B3ULL;
+
+    return h;
+}
+
+static void put_varint(uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        fputc((v & 0x7F) | 0x80, rr_file);
+        v >>= 7;
+    }
+
+    fputc(v, rr_file);
+}
+
+static int get_varint(uint64_t *v)
+{
+    int c, shift = 0;
+
+    *v = 0;
+    do
+    {
+        if ((c = fgetc(rr_file)) == EOF || shift > 63)
+            return -1;
+
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+    }
+    while (c & 0x80);
+
+    return 0;
+}
+
+static void put_record(int kind, const uint8_t *payload, size_t len)
+{
+    fputc(kind, rr_file);
+    put_varint(cpu->cycles - rr_last);
+    fwrite(payload, 1, len, rr_file);
+    rr_last = cpu->cycles;
+}
+
+// read the next record into next, a truncated log just ends early
+static void get_record(void)
+{
+    uint64_t delta;
+    uint8_t buf[8];
+
+    next.kind = fgetc(rr_file);
+    if (next.kind == EOF || get_varint(&delta) < 0)
+    {
+        next.kind = 0;
+        return;
+    }
+
+    next.cycles += delta;
+
+    switch (next.kind)
+    {
+        case RR_INPUT:
+            if (fread(&next.val, 1, 1, rr_file) != 1)
+                next.kind = 0;
+            break;
+
+        case RR_IN:
+            if (fread(buf, 1, 2, rr_file) != 2)
+                next.kind = 0;
+            next.port = buf[0];
+            next.val = buf[1];
+            break;
+
+        case RR_HASH:
+        case RR_END:
+            if (fread(&next.hash, 1, 8, rr_file) != 8)
+                next.kind = 0;
+            break;
+
+        default:
+            fprintf(stderr, "Error: corrupt replay log\n");
+            next.kind = 0;
+            break;
+    }
+}
+
+static void diverge(const char *what)
+{
+    fprintf(stderr, "Error: replay diverged at cycle %llu: %s\n", (unsigned long long)cpu->cycles, what);
+    rr_diverged = 1;
+    cpu->running = 0;
+}
+
+int rr_open(const char *path, int mode)
+{
+    char magic[5];
+
+    rr_file = fopen(path, mode == RR_RECORD ? "wb" : "rb");
+    if (rr_file == NULL)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+
+    if (mode == RR_RECORD)
+    {
+        fwrite(RR_MAGIC, 1, 4, rr_file);
+        fputc(RR_VERSION, rr_file);
+    }
+    else
+    {
+        if (fread(magic, 1, 5, rr_file) != 5 || memcmp(magic, RR_MAGIC, 4) != 0 || magic[4] != RR_VERSION)
+        {
+            fprintf(stderr, "Error: %s is not a replay log of this version\n", path);
+            return -1;
+        }
+
+        get_record();
+
+        // the log already paced the input, nothing to wait for
+        step_sec = 0;
+    }
+
+    rr_mode = mode;
+    return 0;
+}
+
+/*
+ * an input read returning val: logged when recording, replaced by the
+ * logged value when replaying
+ */
+uint8_t rr_input(int kind, uint8_t port, uint8_t val)
+{
+    uint8_t rec[2] = { port, val };
+
+    if (rr_mode == RR_RECORD)
+    {
+        if (kind == RR_IN)
+            put_record(kind, rec, 2);
+        else
+            put_record(kind, &rec[1], 1);
+
+        return val;
+    }
+
+    if (rr_diverged)
+        return val;
+
+    if (next.kind != kind || next.cycles != cpu->cycles || (kind == RR_IN && next.port != port))
+    {
+        diverge(kind == RR_IN ? "unexpected IN" : "unexpected input read");
+        return val;
+    }
+
+    val = next.val;
+    get_record();
+    return val;
+}
+
+static void checkpoint(int kind)
+{
+    uint64_t h = state_hash();
+
+    if (rr_mode == RR_RECORD)
+    {
+        put_record(kind, (uint8_t *)&h, 8);
+        fflush(rr_file);
+        return;
+    }
+
+    if (rr_diverged)
+        return;
+
+    if (next.kind == 0 && kind == RR_END)
+        return;
+
+    if (next.kind != kind || next.cycles != cpu->cycles)
+    {
+        // stopped from the debugger before the recorded run ended
+        if (kind == RR_END && !cpu->running && next.cycles > cpu->cycles)
+        {
+            printf("Replay stopped at cycle %llu before the end of the log\n", (unsigned long long)cpu->cycles);
+            return;
+        }
+
+        diverge(kind == RR_END ? "run ended at a different point" : "state hash out of step");
+        return;
+    }
+
+    if (next.hash != h)
+    {
+        diverge("state hash differs");
+        return;
+    }
+
+    if (kind == RR_END)
+        printf("Replay matches the recorded run\n");
+
+    get_record();
+}
+
+// run the CPU to the end, hashing its state every RR_CHECK_CYCLES T-states
+// stop the run at the next state hash, the debugger's exit
+void rr_stop(void)
+{
+    rr_stopping = 1;
+}
+
+int rr_run(void)
+{
+    int ret;
+
+    for (;;)
+    {
+        uint64_t target = cpu->cycles + RR_CHECK_CYCLES;
+
+        // in slices, so an exit doesn't wait for the next state hash
+        do
+        {
+            uint64_t left = target - cpu->cycles;
+
+            ret = cpu_run(step_sec ? 1 : (left < CTL_SLICE_CYCLES ? left : CTL_SLICE_CYCLES));
+        }
+        while (ret == RUN_LIMIT && cpu->cycles < target && !rr_stopping);
+
+        // exit from the debugger
+        if (ret == RUN_LIMIT && rr_stopping)
+        {
+            cpu->running = 0;
+            ret = RUN_HALT;
+        }
+
+        if (ret != RUN_LIMIT || rr_diverged)
+            break;
+
+        checkpoint(RR_HASH);
+    }
+
+    checkpoint(RR_END);
+    fclose(rr_file);
+    return ret;
+}
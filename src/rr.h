@@ -0,0 +1,34 @@
+#ifndef RR_H_
+#define RR_H_
+
+#include <stdint.h>
+
+#define RR_MAGIC "85RR"
+#define RR_VERSION 1
+#define RR_CHECK_CYCLES 10000000ULL      // T-states between state hashes
+
+enum
+{
+    RR_OFF = 0,
+    RR_RECORD,
+    RR_REPLAY
+};
+
+// log records, each is a kind byte, the cycle delta as a varint and the payload
+enum
+{
+    RR_INPUT = 1,       // read of the standard input cell: value
+    RR_IN,              // IN instruction: port, value
+    RR_HASH,            // periodic state hash: 8 bytes
+    RR_END              // state hash at the end of the run: 8 bytes
+};
+
+extern int rr_mode;
+extern int rr_diverged;
+
+int rr_open(const char *path, int mode);
+uint8_t rr_input(int kind, uint8_t port, uint8_t val);
+int rr_run(void);
+void rr_stop(void);
+
+#endif /* RR_H_ */
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "script.h"
+#include "cpu.h"
+#include "debug.h"
+
+/*
+ * debugger commands read from a file and run by the CPU thread itself,
+ * with no debugger thread: at a T-state count, every time PC reaches an
+ * address, or at the end of the run. Cycle commands cut the run into
+ * cpu_run calls that end at the next one, address commands are
+ * breakpoints of the run loop, so a scripted run is reproducible and
+ * only pays for checking addresses while it has some.
+ */
+
+#define SCRIPT_DELIM " \t\r\n"
+
+// when a command runs
+enum
+{
+    AT_CYCLES = 0,      // first instruction boundary at or past a T-state count
+    AT_PC,              // before each instruction at an address
+    AT_END              // after the program ended
+};
+
+struct script_cmd
+{
+    int when;
+    uint64_t at;
+    char text[SCRIPT_MAX_LINE];
+    char *argv[SCRIPT_MAX_ARGS + 1];
+};
+
+int script_loaded = 0;
+
+static struct script_cmd cmds[SCRIPT_MAX_COMMANDS];
+static int cmd_count = 0;
+
+// cycle commands by T-state count, in file order for the same count
+static struct script_cmd *by_cycles[SCRIPT_MAX_COMMANDS];
+static int cycle_count = 0;
+
+static uint8_t breaks[MEMORY_MAX];
+static int break_count = 0;
+
+// the commands that wait on the console don't make sense here
+static const char *const interactive[] = { "pause", "resume", "stepi", "until", "finish" };
+
+static int check_command(const char *path, int line_no, char **argv)
+{
+    int known = 0;
+
+    for (int i = 0; i < NUM_CMDS; ++i)
+        if (strcmp(argv[0], cmd_names[i]) == 0)
+            known = 1;
+
+    for (size_t i = 0; i < sizeof(interactive) / sizeof(interactive[0]); ++i)
+    {
+        if (strcmp(argv[0], interactive[i]) == 0)
+        {
+            fprintf(stderr, "Error: %s:%d: %s can't be used in a script\n", path, line_no, argv[0]);
+            return -1;
+        }
+    }
+
+    if (!known)
+    {
+        fprintf(stderr, "Error: %s:%d: unknown command \"%s\"\n", path, line_no, argv[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+// each line: <cycles> | @<address> | end, then the command
+int script_load(const char *path)
+{
+    char line[SCRIPT_MAX_LINE];
+    int line_no = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open script %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        struct script_cmd *c = &cmds[cmd_count];
+        char *when, *end;
+        int argc = 0;
+
+        line_no++;
+        if (line[strspn(line, " \t\r\n")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+
+        if (cmd_count >= SCRIPT_MAX_COMMANDS)
+        {
+            fprintf(stderr, "Error: %s:%d: too many commands (max %d)\n", path, line_no, SCRIPT_MAX_COMMANDS);
+            fclose(f);
+            return -1;
+        }
+
+        strcpy(c->text, line);
+        when = strtok(c->text, SCRIPT_DELIM);
+
+        for (char *arg = strtok(NULL, SCRIPT_DELIM); arg != NULL; arg = strtok(NULL, SCRIPT_DELIM))
+        {
+            if (argc == SCRIPT_MAX_ARGS)
+            {
+                fprintf(stderr, "Error: %s:%d: too many arguments\n", path, line_no);
+                fclose(f);
+                return -1;
+            }
+
+            c->argv[argc++] = arg;
+        }
+        c->argv[argc] = NULL;
+
+        if (strcmp(when, "end") == 0)
+            c->when = AT_END;
+        else if (when[0] == '@')
+        {
+            c->when = AT_PC;
+            c->at = strtoul(when + 1, &end, 16);
+            if (*end != '\0' || end == when + 1 || c->at >= MEMORY_MAX)
+                argc = 0;
+        }
+        else
+        {
+            c->when = AT_CYCLES;
+            c->at = strtoull(when, &end, 0);
+            if (*end != '\0')
+                argc = 0;
+        }
+
+        if (argc == 0)
+        {
+            fprintf(stderr, "Error: %s:%d: expected <cycles>|@<address>|end <command> [arguments]\n", path, line_no);
+            fclose(f);
+            return -1;
+        }
+
+        if (check_command(path, line_no, c->argv) < 0)
+        {
+            fclose(f);
+            return -1;
+        }
+
+        if (c->when == AT_PC)
+        {
+            breaks[c->at] = 1;
+            break_count++;
+        }
+
+        // insertion keeps the file order of equal counts
+        if (c->when == AT_CYCLES)
+        {
+            int i = cycle_count++;
+
+            for (; i > 0 && by_cycles[i - 1]->at > c->at; --i)
+                by_cycles[i] = by_cycles[i - 1];
+            by_cycles[i] = c;
+        }
+
+        cmd_count++;
+    }
+
+    fclose(f);
+    script_loaded = 1;
+    return 0;
+}
+
+static void run_at(int when, uint16_t pc)
+{
+    for (int i = 0; i < cmd_count; ++i)
+        if (cmds[i].when == when && (when != AT_PC || cmds[i].at == pc))
+            exec_cmd(cmds[i].argv);
+}
+
+// run the loaded program with the script, instead of ctl_run
+int script_run(void)
+{
+    int next = 0, ret;
+
+    for (;;)
+    {
+        uint64_t limit = 0;
+
+        while (next < cycle_count && by_cycles[next]->at <= cpu->cycles)
+            exec_cmd(by_cycles[next++]->argv);
+
+        if (next < cycle_count)
+            limit = by_cycles[next]->at - cpu->cycles;
+
+        cpu->breaks = break_count ? breaks : NULL;
+        ret = cpu_run(limit);
+
+        if (ret == RUN_BREAK)
+        {
+            run_at(AT_PC, cpu->PC);
+            cpu->break_skip = 1;
+        }
+        else if (ret != RUN_LIMIT || limit == 0)
+            break;
+    }
+
+    cpu->breaks = NULL;
+    run_at(AT_END, 0);
+    return ret;
+}
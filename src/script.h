@@ -0,0 +1,15 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#include <stdint.h>
+
+#define SCRIPT_MAX_COMMANDS 1024
+#define SCRIPT_MAX_LINE 256
+#define SCRIPT_MAX_ARGS 8
+
+extern int script_loaded;
+
+int script_load(const char *path);
+int script_run(void);
+
+#endif /* SCRIPT_H_ */
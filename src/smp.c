@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "smp.h"
+#include "cpu.h"
+#include "mem.h"
+#include "perf.h"
+
+int smp_count = 0;
+struct cpu *smp_cpu[SMP_MAX_CPUS];
+
+static int smp_mode;
+static uint16_t shared_start;
+static uint32_t shared_size;
+static uint8_t *shared;             // committed contents of the shared window
+
+// strict mode: writes of the current quantum, private to each CPU
+struct smp_log
+{
+    uint8_t *data;
+    uint8_t *written;               // 1 if data[off] holds a pending write
+    uint16_t *dirty;                // offsets to commit, in write order
+    uint32_t dirty_count;
+};
+
+static struct smp_log logs[SMP_MAX_CPUS];
+
+// quantum barrier, CPUs that stopped leave it
+static pthread_mutex_t smp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smp_cond = PTHREAD_COND_INITIALIZER;
+static int smp_active, smp_arrived, smp_leaving;
+static uint64_t smp_epoch;
+static uint64_t smp_quantum;
+static volatile int smp_stopping = 0;
+
+static uint8_t shared_read(uint16_t addr)
+{
+    struct smp_log *l = &logs[cpu->id];
+    uint32_t off = addr - shared_start;
+
+    return l->written[off] ? l->data[off] : shared[off];
+}
+
+static void shared_write(uint16_t addr, uint8_t val)
+{
+    struct smp_log *l = &logs[cpu->id];
+    uint32_t off = addr - shared_start;
+
+    if (!l->written[off])
+    {
+        l->written[off] = 1;
+        l->dirty[l->dirty_count++] = off;
+    }
+
+    l->data[off] = val;
+}
+
+// apply the logged writes in CPU order, so the last CPU wins a conflict
+static void commit_logs(void)
+{
+    for (int i = 0; i < smp_count; ++i)
+    {
+        struct smp_log *l = &logs[i];
+
+        for (uint32_t j = 0; j < l->dirty_count; ++j)
+        {
+            uint16_t off = l->dirty[j];
+
+            shared[off] = l->data[off];
+            l->written[off] = 0;
+        }
+
+        l->dirty_count = 0;
+    }
+}
+
+/*
+ * ncpus: total number of CPUs, cpu0 included. Every CPU gets its own 64KB
+ * except for the window [start, end], which must be aligned to 4KB pages.
+ */
+int smp_init(int ncpus, uint16_t start, uint16_t end, int mode)
+{
+    if (ncpus < 2 || ncpus > SMP_MAX_CPUS)
+    {
+        fprintf(stderr, "Error: CPU count must be between 2 and %d\n", SMP_MAX_CPUS);
+        return -1;
+    }
+
+    if ((start & MEM_PAGE_MASK) != 0 || ((end + 1) & MEM_PAGE_MASK) != 0 || end < start)
+    {
+        fprintf(stderr, "Error: shared window must be aligned to %d byte pages\n", MEM_PAGE_SIZE);
+        return -1;
+    }
+
+    smp_mode = mode;
+    shared_start = start;
+    shared_size = (uint32_t)end - start + 1;
+    shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    // in strict mode every access to the window goes through the log
+    if (mode == SMP_STRICT && mem_map_device(start, end, &shared_read, &shared_write) < 0)
+        return -1;
+
+    smp_cpu[0] = &cpu0;
+    for (int i = 1; i < ncpus; ++i)
+    {
+        smp_cpu[i] = aligned_alloc(CPU_ALIGN, sizeof(struct cpu));
+        if (smp_cpu[i] == NULL)
+        {
+            fprintf(stderr, "Error: malloc failed\n");
+            return -1;
+        }
+
+        memset(smp_cpu[i], 0, sizeof(struct cpu));
+
+        smp_cpu[i]->PC = 0x0800;
+        smp_cpu[i]->SP = 0xFFFF;
+        smp_cpu[i]->running = 1;
+        smp_cpu[i]->im = 0x07;
+        smp_cpu[i]->id = i;
+
+        if (mem_init_cpu(smp_cpu[i]) < 0)
+            return -1;
+    }
+
+    for (int i = 0; i < ncpus; ++i)
+    {
+        // debugger and dump see the committed contents
+        for (int p = start >> MEM_PAGE_SHIFT; p <= end >> MEM_PAGE_SHIFT; ++p)
+            mem_map_shared(smp_cpu[i], p, shared + ((p << MEM_PAGE_SHIFT) - start));
+
+        if (mode == SMP_STRICT)
+        {
+            logs[i].data = malloc(shared_size);
+            logs[i].written = calloc(shared_size, 1);
+            logs[i].dirty = malloc(shared_size * sizeof(uint16_t));
+
+            if (logs[i].data == NULL || logs[i].written == NULL || logs[i].dirty == NULL)
+            {
+                fprintf(stderr, "Error: malloc failed\n");
+                return -1;
+            }
+        }
+    }
+
+    smp_count = ncpus;
+    return 0;
+}
+
+// wait for the other CPUs at the end of a quantum, the last one to arrive commits
+static void smp_barrier(int leaving)
+{
+    uint64_t epoch;
+
+    pthread_mutex_lock(&smp_lock);
+    epoch = smp_epoch;
+    smp_leaving += leaving;
+
+    if (++smp_arrived == smp_active)
+    {
+        if (smp_mode == SMP_STRICT)
+            commit_logs();
+
+        smp_active -= smp_leaving;
+        smp_leaving = 0;
+        smp_arrived = 0;
+        smp_epoch++;
+        pthread_cond_broadcast(&smp_cond);
+    }
+    else
+    {
+        while (epoch == smp_epoch)
+            pthread_cond_wait(&smp_cond, &smp_lock);
+    }
+
+    pthread_mutex_unlock(&smp_lock);
+}
+
+static void *smp_thread(void *arg)
+{
+    uint64_t target = 0;
+    int ret;
+
+    cpu = smp_cpu[(int)(intptr_t)arg];
+    perf_sample_thread();
+
+    do
+    {
+        // absolute targets, so overshooting a quantum doesn't add up
+        target += smp_quantum;
+        ret = cpu->cycles < target ? cpu_run(target - cpu->cycles) : RUN_LIMIT;
+
+        if (smp_stopping)
+        {
+            cpu->running = 0;
+            ret = RUN_HALT;
+        }
+
+        smp_barrier(ret != RUN_LIMIT);
+    }
+    while (ret == RUN_LIMIT);
+
+    perf_sample_thread_end();
+    return NULL;
+}
+
+// run all CPUs until each of them stops, cpu0 on the calling thread
+void smp_run(uint64_t quantum)
+{
+    pthread_t threads[SMP_MAX_CPUS];
+
+    smp_active = smp_count;
+    smp_quantum = quantum;
+
+    for (int i = 1; i < smp_count; ++i)
+        pthread_create(&threads[i], NULL, &smp_thread, (void *)(intptr_t)i);
+
+    smp_thread((void *)0);
+
+    for (int i = 1; i < smp_count; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+// ask every CPU to stop at the end of its quantum
+void smp_stop(void)
+{
+    smp_stopping = 1;
+}
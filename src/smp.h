@@ -0,0 +1,27 @@
+#ifndef SMP_H_
+#define SMP_H_
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define SMP_MAX_CPUS 16
+#define SMP_DEFAULT_QUANTUM 1000        // T-states between synchronization points
+#define SMP_DEFAULT_SHARED_START 0xC000
+#define SMP_DEFAULT_SHARED_END 0xCFFF
+
+// ordering of shared memory accesses
+enum
+{
+    SMP_STRICT = 0,     // writes become visible at the end of the quantum, in CPU order
+    SMP_RELAXED         // shared pages mapped directly into every CPU
+};
+
+extern int smp_count;
+extern struct cpu *smp_cpu[SMP_MAX_CPUS];
+
+int smp_init(int ncpus, uint16_t shared_start, uint16_t shared_end, int mode);
+void smp_run(uint64_t quantum);
+void smp_stop(void);
+
+#endif /* SMP_H_ */
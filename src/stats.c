@@ -0,0 +1,345 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "stats.h"
+#include "cpu.h"
+#include "smp.h"
+#include "opcodes.h"
+
+#define STATS_HISTORY 61        // one sample per second, enough for the 60s window
+
+const int stats_windows[STATS_WINDOWS] = { 1, 10, 60 };
+
+// set from the command line, NULL = keep the counters but write no file
+char *stats_file = NULL;
+int stats_interval = STATS_DEFAULT_INTERVAL;
+
+static const char *class_names[ISA_CLASSES] =
+{
+    "transfer", "arithmetic", "logical", "branch", "control", "undefined"
+};
+
+static pthread_t stats_thread;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int stats_running = 0;
+static char stats_path[PATH_MAX];
+
+// totals at the last STATS_HISTORY seconds, oldest first once the ring wrapped
+static uint64_t hist_insns[STATS_HISTORY], hist_cycles[STATS_HISTORY];
+static int hist_next = 0, hist_count = 0;
+
+// Jcc, Ccc and Rcc, the branches that can be not taken
+static int conditional(int op)
+{
+    return class_table[op] == ISA_BRANCH && ((op & 0xC7) == 0xC0 || (op & 0xC7) == 0xC2 || (op & 0xC7) == 0xC4);
+}
+
+static void rates(struct stats_total *t)
+{
+    int last = (hist_next + STATS_HISTORY - 1) % STATS_HISTORY;
+
+    for (int w = 0; w < STATS_WINDOWS; ++w)
+    {
+        int span = stats_windows[w] < hist_count - 1 ? stats_windows[w] : hist_count - 1;
+        int first = (last + STATS_HISTORY - span) % STATS_HISTORY;
+
+        if (span <= 0)
+            continue;
+
+        t->ips[w] = (double)(hist_insns[last] - hist_insns[first]) / span;
+        t->cps[w] = (double)(hist_cycles[last] - hist_cycles[first]) / span;
+    }
+}
+
+// add up the counters of every CPU, other threads keep running meanwhile
+void stats_collect(struct stats_total *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->cpus = smp_count ? smp_count : 1;
+
+    for (int i = 0; i < t->cpus; ++i)
+    {
+        struct cpu *c = i ? smp_cpu[i] : &cpu0;
+        const struct cpu_stats *s = &c->stats;
+
+        for (int op = 0; op < 256; ++op)
+        {
+            t->instructions += s->ops[op];
+            t->classes[class_table[op]] += s->ops[op];
+            if (conditional(op))
+                t->branches += s->ops[op];
+        }
+
+        t->cycles += s->cycles_done + c->cycles;
+        t->taken += s->taken;
+        t->in_bytes += s->in_bytes;
+        t->out_bytes += s->out_bytes;
+        t->native_runs += s->native_runs;
+        t->native_cycles += s->native_cycles;
+        t->native_stale += s->native_stale;
+        t->throttle_sec += s->throttle_sec;
+
+        for (int r = 0; r < CPU_REPORTS; ++r)
+        {
+            if (s->report_count[r] == 0)
+                continue;
+
+            if (t->report_count[r] == 0 || s->report_min[r] < t->report_min[r])
+                t->report_min[r] = s->report_min[r];
+            if (s->report_max[r] > t->report_max[r])
+                t->report_max[r] = s->report_max[r];
+            t->report_count[r] += s->report_count[r];
+            t->report_cycles[r] += s->report_cycles[r];
+        }
+    }
+
+    pthread_mutex_lock(&stats_mutex);
+    rates(t);
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_print(void)
+{
+    struct stats_total t;
+
+    stats_collect(&t);
+
+    printf("\nInstructions = %llu (interpreted)\n", (unsigned long long)t.instructions);
+    printf("Cycles = %llu\n", (unsigned long long)t.cycles);
+    printf("Instructions/s = %.0f (1s), %.0f (10s), %.0f (60s)\n", t.ips[0], t.ips[1], t.ips[2]);
+    printf("Cycles/s = %.0f (1s), %.0f (10s), %.0f (60s)\n", t.cps[0], t.cps[1], t.cps[2]);
+
+    printf("\nInstruction mix:\n");
+    for (int i = 0; i < ISA_CLASSES; ++i)
+        printf("%-10s %llu (%.1f%%)\n", class_names[i], (unsigned long long)t.classes[i],
+            t.instructions ? 100.0 * t.classes[i] / t.instructions : 0.0);
+
+    printf("\nBranches taken = %llu of %llu (%.1f%%)\n", (unsigned long long)t.taken, (unsigned long long)t.branches,
+        t.branches ? 100.0 * t.taken / t.branches : 0.0);
+    printf("Input bytes = %llu\n", (unsigned long long)t.in_bytes);
+    printf("Output bytes = %llu\n", (unsigned long long)t.out_bytes);
+    printf("Native blocks run = %llu (%llu cycles), skipped as modified = %llu\n", (unsigned long long)t.native_runs,
+        (unsigned long long)t.native_cycles, (unsigned long long)t.native_stale);
+    printf("Throttled = %llu s\n", (unsigned long long)t.throttle_sec);
+    if (t.cpus > 1)
+        printf("CPUs = %d\n", t.cpus);
+
+    for (int r = 0; r < CPU_REPORTS; ++r)
+        if (t.report_count[r])
+            printf("Report %d = %llu times, %.1f T-states on average (%llu - %llu)\n", r,
+                (unsigned long long)t.report_count[r], (double)t.report_cycles[r] / t.report_count[r],
+                (unsigned long long)t.report_min[r], (unsigned long long)t.report_max[r]);
+    printf("\n");
+}
+
+static void write_json(FILE *f, const struct stats_total *t)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"cpus\": %d,\n", t->cpus);
+    fprintf(f, "  \"instructions\": %llu,\n", (unsigned long long)t->instructions);
+    fprintf(f, "  \"cycles\": %llu,\n", (unsigned long long)t->cycles);
+
+    fprintf(f, "  \"instructions_per_second\": {");
+    for (int w = 0; w < STATS_WINDOWS; ++w)
+        fprintf(f, "%s\"%ds\": %.1f", w ? ", " : " ", stats_windows[w], t->ips[w]);
+    fprintf(f, " },\n");
+
+    fprintf(f, "  \"cycles_per_second\": {");
+    for (int w = 0; w < STATS_WINDOWS; ++w)
+        fprintf(f, "%s\"%ds\": %.1f", w ? ", " : " ", stats_windows[w], t->cps[w]);
+    fprintf(f, " },\n");
+
+    fprintf(f, "  \"classes\": {");
+    for (int i = 0; i < ISA_CLASSES; ++i)
+        fprintf(f, "%s\"%s\": %llu", i ? ", " : " ", class_names[i], (unsigned long long)t->classes[i]);
+    fprintf(f, " },\n");
+
+    fprintf(f, "  \"branches\": %llu,\n", (unsigned long long)t->branches);
+    fprintf(f, "  \"branches_taken\": %llu,\n", (unsigned long long)t->taken);
+    fprintf(f, "  \"input_bytes\": %llu,\n", (unsigned long long)t->in_bytes);
+    fprintf(f, "  \"output_bytes\": %llu,\n", (unsigned long long)t->out_bytes);
+    fprintf(f, "  \"native_runs\": %llu,\n", (unsigned long long)t->native_runs);
+    fprintf(f, "  \"native_cycles\": %llu,\n", (unsigned long long)t->native_cycles);
+    fprintf(f, "  \"native_stale\": %llu,\n", (unsigned long long)t->native_stale);
+    fprintf(f, "  \"throttled_seconds\": %llu,\n", (unsigned long long)t->throttle_sec);
+
+    fprintf(f, "  \"reports\": {");
+    for (int r = 0, n = 0; r < CPU_REPORTS; ++r)
+        if (t->report_count[r])
+            fprintf(f, "%s\n    \"%d\": { \"count\": %llu, \"cycles\": %llu, \"min\": %llu, \"max\": %llu }",
+                n++ ? "," : "", r, (unsigned long long)t->report_count[r], (unsigned long long)t->report_cycles[r],
+                (unsigned long long)t->report_min[r], (unsigned long long)t->report_max[r]);
+    fprintf(f, " }\n");
+    fprintf(f, "}\n");
+}
+
+static void prom_counter(FILE *f, const char *name, const char *help, uint64_t val)
+{
+    fprintf(f, "# HELP vm8085_%s %s\n", name, help);
+    fprintf(f, "# TYPE vm8085_%s counter\n", name);
+    fprintf(f, "vm8085_%s %llu\n", name, (unsigned long long)val);
+}
+
+static void write_prom(FILE *f, const struct stats_total *t)
+{
+    prom_counter(f, "instructions_total", "Interpreted instructions", t->instructions);
+    prom_counter(f, "cycles_total", "T-states executed", t->cycles);
+
+    fprintf(f, "# HELP vm8085_instructions_per_second Interpreted instructions per second\n");
+    fprintf(f, "# TYPE vm8085_instructions_per_second gauge\n");
+    for (int w = 0; w < STATS_WINDOWS; ++w)
+        fprintf(f, "vm8085_instructions_per_second{window=\"%ds\"} %.1f\n", stats_windows[w], t->ips[w]);
+
+    fprintf(f, "# HELP vm8085_cycles_per_second T-states per second\n");
+    fprintf(f, "# TYPE vm8085_cycles_per_second gauge\n");
+    for (int w = 0; w < STATS_WINDOWS; ++w)
+        fprintf(f, "vm8085_cycles_per_second{window=\"%ds\"} %.1f\n", stats_windows[w], t->cps[w]);
+
+    fprintf(f, "# HELP vm8085_class_instructions_total Interpreted instructions by instruction group\n");
+    fprintf(f, "# TYPE vm8085_class_instructions_total counter\n");
+    for (int i = 0; i < ISA_CLASSES; ++i)
+        fprintf(f, "vm8085_class_instructions_total{class=\"%s\"} %llu\n", class_names[i], (unsigned long long)t->classes[i]);
+
+    prom_counter(f, "branches_total", "Conditional jumps, calls and returns", t->branches);
+    prom_counter(f, "branches_taken_total", "Conditional branches taken", t->taken);
+    prom_counter(f, "input_bytes_total", "Reads of the standard input cell", t->in_bytes);
+    prom_counter(f, "output_bytes_total", "Writes to the standard output cell", t->out_bytes);
+    prom_counter(f, "native_runs_total", "Entries into compiled blocks", t->native_runs);
+    prom_counter(f, "native_cycles_total", "T-states spent in compiled blocks", t->native_cycles);
+    prom_counter(f, "native_stale_total", "Compiled blocks skipped because their page was written", t->native_stale);
+    prom_counter(f, "throttled_seconds_total", "Seconds slept for the debugger step delay", t->throttle_sec);
+
+    // one series per report slot the guest used
+    fprintf(f, "# HELP vm8085_report_count_total Stopwatch times reported by the guest\n");
+    fprintf(f, "# TYPE vm8085_report_count_total counter\n");
+    for (int r = 0; r < CPU_REPORTS; ++r)
+        if (t->report_count[r])
+            fprintf(f, "vm8085_report_count_total{slot=\"%d\"} %llu\n", r, (unsigned long long)t->report_count[r]);
+
+    fprintf(f, "# HELP vm8085_report_cycles_total T-states of the stopwatch times reported by the guest\n");
+    fprintf(f, "# TYPE vm8085_report_cycles_total counter\n");
+    for (int r = 0; r < CPU_REPORTS; ++r)
+        if (t->report_count[r])
+            fprintf(f, "vm8085_report_cycles_total{slot=\"%d\"} %llu\n", r, (unsigned long long)t->report_cycles[r]);
+
+    fprintf(f, "# HELP vm8085_report_min_cycles Shortest stopwatch time reported by the guest\n");
+    fprintf(f, "# TYPE vm8085_report_min_cycles gauge\n");
+    for (int r = 0; r < CPU_REPORTS; ++r)
+        if (t->report_count[r])
+            fprintf(f, "vm8085_report_min_cycles{slot=\"%d\"} %llu\n", r, (unsigned long long)t->report_min[r]);
+
+    fprintf(f, "# HELP vm8085_report_max_cycles Longest stopwatch time reported by the guest\n");
+    fprintf(f, "# TYPE vm8085_report_max_cycles gauge\n");
+    for (int r = 0; r < CPU_REPORTS; ++r)
+        if (t->report_count[r])
+            fprintf(f, "vm8085_report_max_cycles{slot=\"%d\"} %llu\n", r, (unsigned long long)t->report_max[r]);
+}
+
+// rewrite the stats file through a temporary so readers never see half of it
+static void write_file(void)
+{
+    char tmp[PATH_MAX + 8];
+    struct stats_total t;
+    const char *ext = strrchr(stats_path, '.');
+    FILE *f;
+
+    stats_collect(&t);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+    f = fopen(tmp, "w");
+    if (f == NULL)
+        return;
+
+    if (ext != NULL && strcmp(ext, ".prom") == 0)
+        write_prom(f, &t);
+    else
+        write_json(f, &t);
+
+    if (fclose(f) == 0)
+        rename(tmp, stats_path);
+}
+
+static void *stats_loop(void *arg)
+{
+    int ticks = 0;
+
+    (void)arg;
+
+    while (1)
+    {
+        struct stats_total t;
+
+        sleep(1);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        stats_collect(&t);
+        pthread_mutex_lock(&stats_mutex);
+        hist_insns[hist_next] = t.instructions;
+        hist_cycles[hist_next] = t.cycles;
+        hist_next = (hist_next + 1) % STATS_HISTORY;
+        if (hist_count < STATS_HISTORY)
+            hist_count++;
+        pthread_mutex_unlock(&stats_mutex);
+
+        if (stats_file != NULL && ++ticks >= stats_interval)
+        {
+            write_file();
+            ticks = 0;
+        }
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
+
+    return NULL;
+}
+
+/*
+ * start sampling the counters once a second for the rates and rewriting
+ * stats_file every stats_interval seconds. instance >= 0 goes into the file
+ * name before the extension, for processes sharing one -M option
+ */
+int stats_start(int instance)
+{
+    if (stats_file != NULL)
+    {
+        const char *ext = strrchr(stats_file, '.');
+        int base = (ext != NULL && strchr(ext, '/') == NULL) ? (int)(ext - stats_file) : (int)strlen(stats_file);
+
+        if (instance >= 0)
+            snprintf(stats_path, sizeof(stats_path), "%.*s.%d%s", base, stats_file, instance, stats_file + base);
+        else
+            snprintf(stats_path, sizeof(stats_path), "%s", stats_file);
+    }
+
+    // the first sample is the zero point of every window
+    hist_insns[0] = hist_cycles[0] = 0;
+    hist_next = hist_count = 1;
+
+    if (pthread_create(&stats_thread, NULL, &stats_loop, NULL) != 0)
+    {
+        fprintf(stderr, "Error: cannot start the stats thread\n");
+        return -1;
+    }
+
+    stats_running = 1;
+    return 0;
+}
+
+// stop sampling and write the final counters
+void stats_stop(void)
+{
+    if (!stats_running)
+        return;
+
+    pthread_cancel(stats_thread);
+    pthread_join(stats_thread, NULL);
+    stats_running = 0;
+
+    if (stats_file != NULL)
+        write_file();
+}
@@ -0,0 +1,44 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+#include "opcodes.h"
+#include "cpu.h"
+
+#define STATS_DEFAULT_INTERVAL 5        // seconds between rewrites of the stats file
+#define STATS_WINDOWS 3                 // 1s, 10s and 60s rates
+
+// counters of all CPUs added up, see struct cpu_stats
+struct stats_total
+{
+    int cpus;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t classes[ISA_CLASSES];
+    uint64_t branches;                  // conditional jumps, calls and returns executed
+    uint64_t taken;
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    uint64_t native_runs;
+    uint64_t native_cycles;
+    uint64_t native_stale;
+    uint64_t throttle_sec;
+    uint64_t report_count[CPU_REPORTS];   // guest timing reports by slot
+    uint64_t report_cycles[CPU_REPORTS];
+    uint64_t report_min[CPU_REPORTS];
+    uint64_t report_max[CPU_REPORTS];
+    double ips[STATS_WINDOWS];          // instructions per second over each window
+    double cps[STATS_WINDOWS];          // T-states per second over each window
+};
+
+extern const int stats_windows[STATS_WINDOWS];
+extern char *stats_file;
+extern int stats_interval;
+
+void stats_collect(struct stats_total *t);
+void stats_print(void);
+int stats_start(int instance);
+void stats_stop(void);
+
+#endif /* STATS_H_ */
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "timer.h"
+#include "cpu.h"
+#include "mem.h"
+
+/*
+ * T-state counter, stopwatch and timing reports for programs that time
+ * their own routines. Reads come straight from the cycles of the CPU
+ * reading them, so running instructions costs nothing extra. A 32-bit
+ * value is latched when its low byte is read and the other bytes come
+ * from the latch, so LHLD of the low half and then of the high half read
+ * one value. The cycles include the reading instruction.
+ */
+
+int timer_enabled = 0;
+
+static uint8_t timer_read(uint16_t addr)
+{
+    struct cpu_timer *t = &cpu->timer;
+
+    if (addr == TIMER_COUNTER)
+        t->latch = cpu->cycles;
+    if (addr >= TIMER_COUNTER && addr < TIMER_COUNTER + 4)
+        return t->latch >> (8 * (addr - TIMER_COUNTER));
+
+    if (addr == TIMER_ELAPSED)
+        t->elapsed_latch = t->running ? cpu->cycles - t->start : t->elapsed;
+    if (addr >= TIMER_ELAPSED && addr < TIMER_ELAPSED + 4)
+        return t->elapsed_latch >> (8 * (addr - TIMER_ELAPSED));
+
+    if (addr == TIMER_CONTROL)
+        return t->running;
+
+    return 0;
+}
+
+static void timer_write(uint16_t addr, uint8_t val)
+{
+    struct cpu_timer *t = &cpu->timer;
+    struct cpu_stats *s = &cpu->stats;
+    uint64_t time;
+
+    if (addr == TIMER_CONTROL)
+    {
+        if (val && !t->running)
+            t->start = cpu->cycles;
+        else if (!val && t->running)
+            t->elapsed = cpu->cycles - t->start;
+        t->running = val != 0;
+    }
+
+    // the time so far if the stopwatch still runs
+    if (addr == TIMER_REPORT && val < CPU_REPORTS)
+    {
+        time = t->running ? cpu->cycles - t->start : t->elapsed;
+
+        if (s->report_count[val] == 0 || time < s->report_min[val])
+            s->report_min[val] = time;
+        if (time > s->report_max[val])
+            s->report_max[val] = time;
+        s->report_count[val]++;
+        s->report_cycles[val] += time;
+    }
+}
+
+int timer_attach(void)
+{
+    if (mem_map_device(TIMER_COUNTER, TIMER_END, &timer_read, &timer_write) < 0)
+        return -1;
+
+    timer_enabled = 1;
+    return 0;
+}
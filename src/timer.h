@@ -0,0 +1,17 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+
+// registers next to the standard input cell, in the page its device already takes off the fast path
+#define TIMER_COUNTER 0x2010        // 4 bytes, T-states, read-only
+#define TIMER_CONTROL 0x2014        // write 1 to start the stopwatch, 0 to stop it, reads 1 while it runs
+#define TIMER_ELAPSED 0x2015        // 4 bytes, T-states of the stopwatch, read-only
+#define TIMER_REPORT 0x2019         // write a slot number to report the stopwatch time in it
+#define TIMER_END TIMER_REPORT
+
+extern int timer_enabled;
+
+int timer_attach(void);
+
+#endif /* TIMER_H_ */
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "vm.h"
+#include "mem.h"
+
+/*
+ * vm_run swaps the VM's CPU and I/O stream in as those of the calling
+ * thread, so any thread can run any VM as long as one VM isn't run by
+ * two threads at once. Needs mem_init and io_attach to have been called.
+ */
+
+// power-on state with program loaded at 0x0800, no input and no room for output yet
+int vm_init(struct vm *vm, const uint8_t *program, uint32_t len)
+{
+    struct cpu *prev = cpu;
+
+    memset(vm, 0, sizeof(*vm));
+    if (mem_init_cpu(&vm->cpu) < 0)
+        return -1;
+
+    cpu = &vm->cpu;
+    cpu_reset();
+    mem_load(cpu->PC, program, len);
+    cpu = prev;
+
+    vm->io.async = 1;
+    return 0;
+}
+
+// next input bytes, in must stay valid until the VM asks for more
+void vm_input(struct vm *vm, const uint8_t *in, uint32_t len)
+{
+    vm->io.in = in;
+    vm->io.in_len = len;
+    vm->io.in_pos = 0;
+}
+
+// new output buffer, the bytes written so far are in the old one, io.out_len of them
+void vm_output(struct vm *vm, uint8_t *out, uint32_t cap)
+{
+    vm->io.out = out;
+    vm->io.out_len = 0;
+    vm->io.out_cap = cap;
+}
+
+// run up to budget T-states (0 = no limit) from where the last call stopped
+int vm_run(struct vm *vm, uint64_t budget)
+{
+    struct cpu *prev = cpu;
+    struct io_stream prev_io = io;
+    int ret;
+
+    cpu = &vm->cpu;
+    io = vm->io;
+    ret = cpu_run(budget);
+    vm->io = io;
+    io = prev_io;
+    cpu = prev;
+
+    return ret;
+}
+
+void vm_free(struct vm *vm)
+{
+    cpu_release(&vm->cpu);
+    if (vm->cpu.memory != NULL)
+        munmap(vm->cpu.memory, MEMORY_MAX);
+    vm->cpu.memory = NULL;
+}
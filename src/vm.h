@@ -0,0 +1,33 @@
+#ifndef VM_H_
+#define VM_H_
+
+#include <stdint.h>
+#include "cpu.h"
+#include "io.h"
+
+/*
+ * a program run step by step from an event loop: vm_run returns when the
+ * budget is used up or the program has to wait for the I/O cells, with
+ * everything needed to resume in the struct, so no thread or stack is
+ * kept per program. Returns RUN_ codes:
+ *   RUN_LIMIT   budget used up, call again
+ *   RUN_INPUT   reads 0x2000 with no input left, give more with vm_input
+ *   RUN_OUTPUT  writes 0x3000 with the output buffer full, drain it with vm_output
+ *   RUN_BREAK   breakpoint in cpu.breaks
+ *   anything else: the program is over
+ * The CPU state is cache line aligned, a vm on the heap comes from
+ * aligned_alloc(CPU_ALIGN, sizeof(struct vm)).
+ */
+struct vm
+{
+    struct cpu cpu;
+    struct io_stream io;
+};
+
+int vm_init(struct vm *vm, const uint8_t *program, uint32_t len);
+void vm_input(struct vm *vm, const uint8_t *in, uint32_t len);
+void vm_output(struct vm *vm, uint8_t *out, uint32_t cap);
+int vm_run(struct vm *vm, uint64_t budget);
+void vm_free(struct vm *vm);
+
+#endif /* VM_H_ */
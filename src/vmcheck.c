@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vm.h"
+#include "mem.h"
+
+/*
+ * check of the embedding API, built and run by make vmcheck: two VMs on
+ * one thread, run in turns with small budgets, input handed over in
+ * pieces and an output buffer of two bytes, so both stop many times for
+ * input and for output and are resumed from the undone instruction. Each
+ * one latches its first input byte into port 10H and reads it back at the
+ * end, which only works if the VMs don't share ports.
+ */
+
+#define CHECK_BUDGET 40
+#define CHECK_OUT_CAP 2
+
+// defined in main.c, which isn't linked into the check
+int step_sec = 0;
+
+/*
+ *      LDA 2000H / OUT 10H
+ * LOOP: LDA 2000H / ORA A / JZ DONE / STA 3000H / JMP LOOP
+ * DONE: IN 10H / HLT
+ */
+static const uint8_t program[] =
+{
+    0x3A, 0x00, 0x20, 0xD3, 0x10,
+    0x3A, 0x00, 0x20, 0xB7, 0xCA, 0x12, 0x08, 0x32, 0x00, 0x30, 0xC3, 0x05, 0x08,
+    0xDB, 0x10, 0x76
+};
+
+struct check
+{
+    struct vm vm;
+    const char *const *pieces;      // input, in the pieces it's handed over in
+    int next;
+    char out[64];
+    int out_len;
+    uint8_t buf[CHECK_OUT_CAP];
+    int inputs, outputs;            // RUN_INPUT and RUN_OUTPUT returns
+    int ret;
+};
+
+static const char *const pieces_a[] = { "A", "ech", "o o", "f a", "\0", NULL };
+static const char *const pieces_b[] = { "Bs", "econd ", "VM", "\0", NULL };
+
+static void drain(struct check *c)
+{
+    memcpy(c->out + c->out_len, c->buf, c->vm.io.out_len);
+    c->out_len += c->vm.io.out_len;
+    vm_output(&c->vm, c->buf, sizeof(c->buf));
+}
+
+// one turn, 0 once the program is over
+static int step(struct check *c)
+{
+    c->ret = vm_run(&c->vm, CHECK_BUDGET);
+
+    if (c->ret == RUN_INPUT)
+    {
+        const char *piece = c->pieces[c->next++];
+
+        c->inputs++;
+        if (piece == NULL)
+        {
+            fprintf(stderr, "Error: VM %c asked for more input than there is\n", c->pieces[0][0]);
+            exit(1);
+        }
+
+        // the terminating zero is a piece of its own
+        vm_input(&c->vm, (const uint8_t *)piece, piece[0] ? strlen(piece) : 1);
+    }
+    else if (c->ret == RUN_OUTPUT)
+    {
+        c->outputs++;
+        drain(c);
+    }
+
+    return c->ret == RUN_LIMIT || c->ret == RUN_INPUT || c->ret == RUN_OUTPUT;
+}
+
+static int verify(struct check *c, const char *expect, uint32_t in_bytes)
+{
+    char name = c->pieces[0][0];
+    int ok = 1;
+
+    drain(c);
+    c->out[c->out_len] = '\0';
+
+    if (c->ret != RUN_HALT || strcmp(c->out, expect) != 0)
+    {
+        fprintf(stderr, "Error: VM %c ended with %d and output \"%s\", expected \"%s\"\n", name, c->ret, c->out, expect);
+        ok = 0;
+    }
+
+    if (c->inputs == 0 || c->outputs == 0)
+    {
+        fprintf(stderr, "Error: VM %c never waited for input or output\n", name);
+        ok = 0;
+    }
+
+    if (c->vm.cpu.regs[R_A] != (uint8_t)name)
+    {
+        fprintf(stderr, "Error: VM %c read %02X back from its port\n", name, c->vm.cpu.regs[R_A]);
+        ok = 0;
+    }
+
+    if (c->vm.cpu.stats.in_bytes != in_bytes || c->vm.cpu.stats.out_bytes != strlen(expect))
+    {
+        fprintf(stderr, "Error: VM %c counted %llu bytes in and %llu out, expected %u and %zu\n", name,
+            (unsigned long long)c->vm.cpu.stats.in_bytes, (unsigned long long)c->vm.cpu.stats.out_bytes,
+            in_bytes, strlen(expect));
+        ok = 0;
+    }
+
+    if (ok)
+        printf("VM %c: %d input and %d output waits, output \"%s\"\n", name, c->inputs, c->outputs, c->out);
+    return ok;
+}
+
+int main(void)
+{
+    static struct check a = { .pieces = pieces_a }, b = { .pieces = pieces_b };
+    int run_a = 1, run_b = 1, ok;
+
+    if (mem_init() < 0 || io_attach() < 0)
+        return 1;
+    if (vm_init(&a.vm, program, sizeof(program)) < 0 || vm_init(&b.vm, program, sizeof(program)) < 0)
+        return 1;
+
+    vm_output(&a.vm, a.buf, sizeof(a.buf));
+    vm_output(&b.vm, b.buf, sizeof(b.buf));
+
+    while (run_a || run_b)
+    {
+        if (run_a)
+            run_a = step(&a);
+        if (run_b)
+            run_b = step(&b);
+    }
+
+    ok = verify(&a, "echo of a", 11);
+    ok &= verify(&b, "second VM", 11);
+
+    vm_free(&a.vm);
+    vm_free(&b.vm);
+    return !ok;
+}
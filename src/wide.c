@@ -0,0 +1,666 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wide.h"
+#include "cpu.h"
+#include "mem.h"
+#include "io.h"
+#include "opcodes.h"
+
+/*
+ * lockstep engine: N copies of the loaded program, one per input vector.
+ * Registers, flags, PC, SP and cycles are kept in structure-of-arrays form.
+ * Every step picks the lanes at the lowest PC; register-only ALU
+ * instructions run for all of them at once in the kernels below, everything
+ * else (memory, jumps, calls, stack) runs lane by lane through the regular
+ * opcode handlers.
+ */
+
+// kernels are built for AVX2, SSE4.2 and baseline SSE2, picked at load time
+#if defined(__x86_64__) && defined(__GNUC__)
+#define WIDE_KERNEL __attribute__((target_clones("avx2", "sse4.2", "default")))
+#else
+#define WIDE_KERNEL
+#endif
+
+// fixed-length inner loop so the compiler vectorizes without a scalar tail
+#define FOR_LANES(n) \
+    for (int b = 0; b < (n); b += WIDE_BLOCK) \
+        for (int i = b; i < b + WIDE_BLOCK; ++i)
+
+struct lane
+{
+    struct cpu cpu;         // memory of the lane, registers only during scalar steps
+    struct io_stream io;
+    uint8_t in[WIDE_MAX_INPUT];
+    uint8_t out[WIDE_MAX_OUTPUT];
+};
+
+static int lane_count, padded;
+static struct lane *lanes;
+
+// structure-of-arrays state, padded to a multiple of WIDE_BLOCK
+static uint8_t *wregs[R_COUNT];
+static uint8_t *wflags;
+static uint16_t *wpc, *wsp;
+static uint64_t *wcycles;
+static uint8_t *wmask;      // 0xFF for lanes taking part in the current step
+static uint8_t *wdone;      // 1 once a lane stopped
+static uint8_t *wstatus;    // RUN_* of stopped lanes
+static uint8_t *wimm;       // broadcast operand
+
+static uint32_t private_pages[MEM_PAGES];   // lanes that own a copy of each page
+
+static inline uint8_t blend(uint8_t m, uint8_t a, uint8_t b)
+{
+    return (a & m) | (b & ~m);
+}
+
+// S, Z and P of an 8-bit result, as update_flags sets them
+static inline uint8_t szp(uint8_t r)
+{
+    uint8_t p = r ^ (r >> 4);
+    p ^= p >> 2;
+    p ^= p >> 1;
+
+    return (r & FL_S) | (r == 0 ? FL_Z : 0) | ((p & 1) ? 0 : FL_P);
+}
+
+static inline void arith(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d,
+    const uint8_t *restrict m, int n, int sub, int carry, int store)
+{
+    FOR_LANES(n)
+    {
+        uint16_t cin = carry ? (f[i] & FL_CY) : 0;
+        uint16_t res = sub ? (uint16_t)(a[i] - d[i] - cin) : (uint16_t)(a[i] + d[i] + cin);
+        uint8_t ac = ((a[i] ^ d[i] ^ res) & FL_AC) ^ (sub ? FL_AC : 0);
+        uint8_t nf = (f[i] & ~(FL_CY | FL_P | FL_AC | FL_Z | FL_S)) | ((res >> 8) & FL_CY) | ac | szp(res);
+
+        if (store)
+            a[i] = blend(m[i], res, a[i]);
+        f[i] = blend(m[i], nf, f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_add(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    arith(a, f, d, m, n, 0, 0, 1);
+}
+
+WIDE_KERNEL static void k_adc(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    arith(a, f, d, m, n, 0, 1, 1);
+}
+
+WIDE_KERNEL static void k_sub(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    arith(a, f, d, m, n, 1, 0, 1);
+}
+
+WIDE_KERNEL static void k_sbb(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    arith(a, f, d, m, n, 1, 1, 1);
+}
+
+WIDE_KERNEL static void k_cmp(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    arith(a, f, d, m, n, 1, 0, 0);
+}
+
+// logical ops clear CY, ANA sets AC and the others clear it
+WIDE_KERNEL static void k_ana(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t res = a[i] & d[i];
+        a[i] = blend(m[i], res, a[i]);
+        f[i] = blend(m[i], (f[i] & ~(FL_CY | FL_P | FL_AC | FL_Z | FL_S)) | FL_AC | szp(res), f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_xra(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t res = a[i] ^ d[i];
+        a[i] = blend(m[i], res, a[i]);
+        f[i] = blend(m[i], (f[i] & ~(FL_CY | FL_P | FL_AC | FL_Z | FL_S)) | szp(res), f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_ora(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict d, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t res = a[i] | d[i];
+        a[i] = blend(m[i], res, a[i]);
+        f[i] = blend(m[i], (f[i] & ~(FL_CY | FL_P | FL_AC | FL_Z | FL_S)) | szp(res), f[i]);
+    }
+}
+
+// INR and DCR leave CY alone
+WIDE_KERNEL static void k_inr(uint8_t *restrict r, uint8_t *restrict f, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t res = r[i] + 1;
+        uint8_t ac = (res & 0x0F) == 0 ? FL_AC : 0;
+        r[i] = blend(m[i], res, r[i]);
+        f[i] = blend(m[i], (f[i] & ~(FL_P | FL_AC | FL_Z | FL_S)) | ac | szp(res), f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_dcr(uint8_t *restrict r, uint8_t *restrict f, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t res = r[i] - 1;
+        uint8_t ac = (res & 0x0F) != 0x0F ? FL_AC : 0;
+        r[i] = blend(m[i], res, r[i]);
+        f[i] = blend(m[i], (f[i] & ~(FL_P | FL_AC | FL_Z | FL_S)) | ac | szp(res), f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_mov(uint8_t *restrict dst, const uint8_t *restrict src, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+        dst[i] = blend(m[i], src[i], dst[i]);
+}
+
+// RLC, RRC, RAL and RAR only touch CY
+WIDE_KERNEL static void k_rlc(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t out = a[i] >> 7;
+        a[i] = blend(m[i], (a[i] << 1) | out, a[i]);
+        f[i] = blend(m[i], (f[i] & ~FL_CY) | out, f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_rrc(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t out = a[i] & 1;
+        a[i] = blend(m[i], (a[i] >> 1) | (out << 7), a[i]);
+        f[i] = blend(m[i], (f[i] & ~FL_CY) | out, f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_ral(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t out = a[i] >> 7;
+        a[i] = blend(m[i], (a[i] << 1) | (f[i] & FL_CY), a[i]);
+        f[i] = blend(m[i], (f[i] & ~FL_CY) | out, f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_rar(uint8_t *restrict a, uint8_t *restrict f, const uint8_t *restrict m, int n)
+{
+    FOR_LANES(n)
+    {
+        uint8_t out = a[i] & 1;
+        a[i] = blend(m[i], (a[i] >> 1) | ((f[i] & FL_CY) << 7), a[i]);
+        f[i] = blend(m[i], (f[i] & ~FL_CY) | out, f[i]);
+    }
+}
+
+WIDE_KERNEL static void k_advance(uint16_t *restrict pc, uint64_t *restrict cycles, const uint8_t *restrict m, int n,
+    uint16_t len, uint64_t t)
+{
+    FOR_LANES(n)
+    {
+        uint16_t sel = m[i] & 1;
+
+        pc[i] += sel * len;
+        cycles[i] += sel * t;
+    }
+}
+
+// lowest PC among running lanes, 0xFFFF if none
+WIDE_KERNEL static uint16_t k_min_pc(const uint16_t *restrict pc, const uint8_t *restrict done, int n)
+{
+    uint16_t min = 0xFFFF;
+
+    FOR_LANES(n)
+    {
+        uint16_t p = pc[i] | (uint16_t)-done[i];
+        min = p < min ? p : min;
+    }
+
+    return min;
+}
+
+WIDE_KERNEL static int k_select(const uint16_t *restrict pc, const uint8_t *restrict done, uint8_t *restrict m, int n,
+    uint16_t target)
+{
+    int count = 0;
+
+    FOR_LANES(n)
+    {
+        uint8_t hit = (pc[i] == target) & !done[i];
+
+        m[i] = -hit;
+        count += hit;
+    }
+
+    return count;
+}
+
+// stop lanes that ran out of cycles or into the stack segment
+WIDE_KERNEL static void k_retire(const uint16_t *restrict pc, const uint64_t *restrict cycles, uint8_t *restrict done,
+    uint8_t *restrict status, const uint8_t *restrict m, int n, uint64_t limit)
+{
+    FOR_LANES(n)
+    {
+        uint8_t end = pc[i] >= STACK_SEGMENT_START;
+        uint8_t stop = (m[i] & 1) & (end | (cycles[i] >= limit));
+
+        status[i] = stop ? (end ? RUN_END : RUN_LIMIT) : status[i];
+        done[i] |= stop;
+    }
+}
+
+// memory every lane started from, cpu0 doesn't run while the lanes do
+static inline uint8_t image(uint16_t addr)
+{
+    return cpu0.mem_page[addr >> MEM_PAGE_SHIFT][addr & MEM_PAGE_MASK];
+}
+
+static void *lane_alloc(size_t size)
+{
+    void *p = aligned_alloc(WIDE_BLOCK, (size + WIDE_BLOCK - 1) / WIDE_BLOCK * WIDE_BLOCK);
+
+    if (p == NULL)
+    {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(1);
+    }
+
+    memset(p, 0, size);
+    return p;
+}
+
+// run one lane through the regular interpreter for up to max_cycles T-states
+static void lane_run(int i, uint64_t max_cycles, uint64_t limit)
+{
+    struct lane *l = &lanes[i];
+    uint16_t shared = l->cpu.mem_cow;
+    int ret;
+
+    for (int r = 0; r < R_COUNT; ++r)
+        l->cpu.regs[r] = wregs[r][i];
+    l->cpu.flags = wflags[i];
+    l->cpu.PC = wpc[i];
+    l->cpu.SP = wsp[i];
+    l->cpu.cycles = wcycles[i];
+
+    cpu = &l->cpu;
+    io = l->io;
+    ret = cpu_run(max_cycles);
+    l->io = io;
+    cpu = &cpu0;
+
+    for (int r = 0; r < R_COUNT; ++r)
+        wregs[r][i] = l->cpu.regs[r];
+    wflags[i] = l->cpu.flags;
+    wpc[i] = l->cpu.PC;
+    wsp[i] = l->cpu.SP;
+    wcycles[i] = l->cpu.cycles;
+
+    // pages this lane just copied no longer match the image
+    for (int p = 0; p < MEM_PAGES; ++p)
+        if ((shared & ~l->cpu.mem_cow) & (1 << p))
+            private_pages[p]++;
+
+    if (ret != RUN_LIMIT || l->cpu.cycles >= limit)
+    {
+        wdone[i] = 1;
+        wstatus[i] = ret;
+    }
+}
+
+// register-only instructions the kernels handle
+static int wide_op(uint8_t op)
+{
+    uint8_t hi = op & 0xC7;
+
+    if (op == 0x00 || op == 0x07 || op == 0x0F || op == 0x17 || op == 0x1F)
+        return 1;
+
+    if (op >= 0x40 && op <= 0x7F)
+        return op != 0x76 && REG_INDEX(op & 0x07) != R_MEM && REG_INDEX((op >> 3) & 0x07) != R_MEM;
+
+    // MVI, INR, DCR
+    if (hi == 0x06 || hi == 0x04 || hi == 0x05)
+        return REG_INDEX((op >> 3) & 0x07) != R_MEM;
+
+    // ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP
+    if (op >= 0x80 && op <= 0xBF)
+        return REG_INDEX(op & 0x07) != R_MEM;
+
+    return op >= 0xC0 && (op & 0x07) == 0x06;
+}
+
+static void wide_exec(uint8_t op, uint8_t imm)
+{
+    uint8_t dst = REG_INDEX((op >> 3) & 0x07);
+    uint8_t *a = wregs[R_A];
+    const uint8_t *src = wregs[REG_INDEX(op & 0x07)];
+    uint16_t len = 1;
+
+    // immediate forms take the same byte in every lane
+    if (op >= 0xC0 || (op & 0xC7) == 0x06)
+    {
+        memset(wimm, imm, padded);
+        src = wimm;
+        len = 2;
+    }
+    // the kernels don't allow their operands to overlap
+    else if (src == a)
+    {
+        memcpy(wimm, a, padded);
+        src = wimm;
+    }
+
+    if (op >= 0x40 && op <= 0x7F)
+    {
+        if (dst != REG_INDEX(op & 0x07))
+            k_mov(wregs[dst], src, wmask, padded);
+    }
+    else if ((op & 0xC7) == 0x06)
+        k_mov(wregs[dst], src, wmask, padded);
+    else if ((op & 0xC7) == 0x04)
+        k_inr(wregs[dst], wflags, wmask, padded);
+    else if ((op & 0xC7) == 0x05)
+        k_dcr(wregs[dst], wflags, wmask, padded);
+    else if (op == 0x07)
+        k_rlc(a, wflags, wmask, padded);
+    else if (op == 0x0F)
+        k_rrc(a, wflags, wmask, padded);
+    else if (op == 0x17)
+        k_ral(a, wflags, wmask, padded);
+    else if (op == 0x1F)
+        k_rar(a, wflags, wmask, padded);
+    else
+    {
+        switch (op >= 0xC0 ? (op & 0x38) | 0x80 : op & 0xF8)
+        {
+            case 0x80:
+                k_add(a, wflags, src, wmask, padded);
+                break;
+
+            case 0x88:
+                k_adc(a, wflags, src, wmask, padded);
+                break;
+
+            case 0x90:
+                k_sub(a, wflags, src, wmask, padded);
+                break;
+
+            case 0x98:
+                k_sbb(a, wflags, src, wmask, padded);
+                break;
+
+            case 0xA0:
+                k_ana(a, wflags, src, wmask, padded);
+                break;
+
+            case 0xA8:
+                k_xra(a, wflags, src, wmask, padded);
+                break;
+
+            case 0xB0:
+                k_ora(a, wflags, src, wmask, padded);
+                break;
+
+            case 0xB8:
+                k_cmp(a, wflags, src, wmask, padded);
+                break;
+        }
+    }
+
+    k_advance(wpc, wcycles, wmask, padded, len, cycle_table[op]);
+}
+
+// one lane per line of hex bytes, which the lane reads from 0x2000
+static int load_inputs(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char *line = NULL;
+    size_t size = 0;
+    int count = 0, capacity = 0;
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+
+    lanes = NULL;
+    while (getline(&line, &size, f) != -1)
+    {
+        char *p = line, *end;
+        struct lane *l, *grown;
+
+        if (line[0] == '#')
+            continue;
+
+        if (count == WIDE_MAX_LANES)
+        {
+            fprintf(stderr, "Error: at most %d input vectors\n", WIDE_MAX_LANES);
+            return -1;
+        }
+
+        // doubled, realloc doesn't keep the cache line alignment of struct cpu
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            grown = aligned_alloc(CPU_ALIGN, (size_t)capacity * sizeof(struct lane));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Error: malloc failed\n");
+                return -1;
+            }
+
+            if (count)
+                memcpy(grown, lanes, count * sizeof(struct lane));
+            free(lanes);
+            lanes = grown;
+        }
+
+        l = &lanes[count++];
+        memset(l, 0, sizeof(*l));
+
+        for (long v = strtol(p, &end, 16); end != p; v = strtol(p, &end, 16))
+        {
+            if (l->io.in_len == WIDE_MAX_INPUT)
+            {
+                fprintf(stderr, "Error: input vector %d longer than %d bytes\n", count - 1, WIDE_MAX_INPUT);
+                return -1;
+            }
+
+            l->in[l->io.in_len++] = (uint8_t)v;
+            p = end;
+        }
+    }
+
+    free(line);
+    fclose(f);
+
+    if (count == 0)
+    {
+        fprintf(stderr, "Error: no input vectors in %s\n", path);
+        return -1;
+    }
+
+    return count;
+}
+
+static void print_lane(int i)
+{
+    static const char *status_names[] =
+    {
+        [RUN_HALT] = "halted", [RUN_LIMIT] = "cycle limit", [RUN_END] = "segment end", [RUN_FAULT] = "fault",
+        [RUN_UNDEF] = "undefined opcode", [RUN_BREAK] = "breakpoint", [RUN_INPUT] = "waiting for input",
+        [RUN_OUTPUT] = "output full"
+    };
+    struct lane *l = &lanes[i];
+    const char *status = wstatus[i] < sizeof(status_names) / sizeof(status_names[0]) ? status_names[wstatus[i]] : "stopped";
+
+    printf("lane %d: %s, PC=%04X SP=%04X A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X F=%02X, %llu cycles",
+        i, status, wpc[i], wsp[i], wregs[R_A][i], wregs[R_B][i], wregs[R_C][i], wregs[R_D][i],
+        wregs[R_E][i], wregs[R_H][i], wregs[R_L][i], wflags[i], (unsigned long long)wcycles[i]);
+
+    if (l->io.out_len)
+    {
+        printf(", output:");
+        for (uint32_t j = 0; j < l->io.out_len; ++j)
+            printf(" %02X", l->out[j]);
+    }
+
+    printf("\n");
+}
+
+// run cpu0 up to the first time PC reaches addr, without input
+static int run_to(uint16_t addr, uint64_t max_cycles)
+{
+    static uint8_t breaks[MEMORY_MAX];
+    int ret;
+
+    breaks[addr] = 1;
+    cpu0.breaks = breaks;
+    ret = cpu_run(max_cycles);
+    cpu0.breaks = NULL;
+
+    if (ret != RUN_BREAK)
+    {
+        fprintf(stderr, "Error: the program didn't reach 0x%04X\n", addr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * run the program already loaded into cpu0 once per input vector, from the
+ * start or from the first time it reaches fork_addr (-1 for none). Each
+ * lane is a clone of cpu0, sharing its memory copy-on-write.
+ */
+int wide_main(const char *inputs_path, uint64_t max_cycles, int fork_addr)
+{
+    uint64_t steps = 0, lane_steps = 0, simd_steps = 0;
+    uint64_t window_steps = 0, window_lanes = 0;
+    int active, scalar_only = 0;
+
+    lane_count = load_inputs(inputs_path);
+    if (lane_count < 0)
+        return -1;
+
+    if (fork_addr >= 0 && run_to(fork_addr, max_cycles) < 0)
+        return -1;
+
+    if (io_attach() < 0)
+        return -1;
+
+    padded = (lane_count + WIDE_BLOCK - 1) / WIDE_BLOCK * WIDE_BLOCK;
+
+    for (int r = 0; r < R_COUNT; ++r)
+        wregs[r] = lane_alloc(padded);
+    wflags = lane_alloc(padded);
+    wpc = lane_alloc(padded * sizeof(uint16_t));
+    wsp = lane_alloc(padded * sizeof(uint16_t));
+    wcycles = lane_alloc(padded * sizeof(uint64_t));
+    wmask = lane_alloc(padded);
+    wdone = lane_alloc(padded);
+    wstatus = lane_alloc(padded);
+    wimm = lane_alloc(padded);
+
+    for (int i = 0; i < padded; ++i)
+    {
+        for (int r = 0; r < R_COUNT; ++r)
+            wregs[r][i] = cpu0.regs[r];
+        wpc[i] = cpu0.PC;
+        wsp[i] = cpu0.SP;
+        wflags[i] = cpu0.flags;
+        wcycles[i] = cpu0.cycles;
+        wdone[i] = i >= lane_count;
+    }
+
+    for (int i = 0; i < lane_count; ++i)
+    {
+        struct lane *l = &lanes[i];
+
+        cpu_clone(&l->cpu, &cpu0);
+        l->cpu.id = i;
+        l->io.in = l->in;
+        l->io.out = l->out;
+        l->io.out_cap = WIDE_MAX_OUTPUT;
+    }
+
+    active = lane_count;
+    while (active > 0 && !scalar_only)
+    {
+        uint16_t pc = k_min_pc(wpc, wdone, padded);
+        int group = k_select(wpc, wdone, wmask, padded, pc);
+        uint8_t op = image(pc);
+
+        // the instruction bytes are the same in every lane only while nobody wrote to them
+        int uniform = private_pages[pc >> MEM_PAGE_SHIFT] == 0
+            && private_pages[(uint16_t)(pc + 1) >> MEM_PAGE_SHIFT] == 0;
+
+        if (uniform && wide_op(op) && group * WIDE_SCALAR_RATIO >= padded)
+        {
+            wide_exec(op, image(pc + 1));
+            k_retire(wpc, wcycles, wdone, wstatus, wmask, padded, max_cycles);
+            simd_steps += group;
+        }
+        else
+        {
+            for (int i = 0; i < lane_count; ++i)
+                if (wmask[i])
+                    lane_run(i, 1, max_cycles);
+        }
+
+        for (int i = 0; i < lane_count; ++i)
+            if (wmask[i] && wdone[i])
+                active--;
+
+        steps++;
+        lane_steps += group;
+        window_steps++;
+        window_lanes += group;
+
+        // lanes rarely meet at the same PC any more, lockstep only adds overhead
+        if (window_steps == WIDE_WINDOW)
+        {
+            if (window_lanes * WIDE_DIVERGENCE < window_steps * active)
+                scalar_only = 1;
+
+            window_steps = window_lanes = 0;
+        }
+    }
+
+    for (int i = 0; i < lane_count; ++i)
+    {
+        if (!wdone[i])
+            lane_run(i, max_cycles - wcycles[i], max_cycles);
+    }
+
+    for (int i = 0; i < lane_count; ++i)
+    {
+        print_lane(i);
+        cpu_release(&lanes[i].cpu);
+    }
+
+    fprintf(stderr, "%d lanes, %llu lockstep steps, %.1f%% of lockstep lane steps vectorized%s\n", lane_count,
+        (unsigned long long)steps, lane_steps ? 100.0 * simd_steps / lane_steps : 0.0,
+        scalar_only ? ", switched to scalar after diverging" : "");
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef WIDE_H_
+#define WIDE_H_
+
+#include <stdint.h>
+
+#define WIDE_BLOCK 32               // lanes per kernel iteration, one AVX2 register of bytes
+#define WIDE_MAX_LANES (1 << 16)
+#define WIDE_MAX_INPUT 256          // input bytes per lane
+#define WIDE_MAX_OUTPUT 256         // output bytes kept per lane
+#define WIDE_DEFAULT_CYCLES 10000000ULL
+
+// a group this many times smaller than the lane count runs scalar
+#define WIDE_SCALAR_RATIO 16
+// average group this many times smaller than the active lanes -> all scalar
+#define WIDE_DIVERGENCE 8
+#define WIDE_WINDOW 256             // steps between divergence checks
+
+int wide_main(const char *inputs_path, uint64_t max_cycles, int fork_addr);
+
+#endif /* WIDE_H_ */